@@ -0,0 +1,264 @@
+/*
+ * Source file:
+ *	archive.c
+ *
+ * With --archive, appends a record of each printed file to the archive
+ * in ~/.trueprint/files: its name, the pages it was printed on and the
+ * functions in it with their pages.  tpsearch reads the archive, so it
+ * can tell which listing a function was printed in without going back
+ * to the files.
+ *
+ * Each job adds one segment to the end of the archive, written with a
+ * single write() to a file opened for appending, so that jobs running
+ * at the same time don't mix their segments.  The layout is described
+ * in archive_fl.h.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int close(int fildes);
+extern int write(int fildes, const void *buf, size_t nbyte);
+#endif
+
+#ifndef O_APPEND
+# define O_APPEND 0
+#endif
+
+#include "trueprint.h"
+#include "utils.h"
+#include "debug.h"
+#include "options.h"
+#include "index.h"
+#include "encode.h"
+#include "main.h"
+
+#include "archive_fl.h"
+#include "archive.h"
+
+/*
+ * Private part
+ */
+static boolean	archive_job;
+static char	*archive_dir;
+
+static char *archive_path(void);
+static void add_text(char **text, size_t *length, size_t *size, const char *string);
+
+/*****************************************************************************
+ * Function:
+ *	setup_archive
+ */
+void
+setup_archive(void)
+
+{
+  archive_dir = NULL;
+
+  boolean_option(NULL, "archive", "no-archive", FALSE, &archive_job, NULL, NULL,
+		 OPT_OUTPUT,
+		 "record the files and functions printed in the archive that\n"
+		 "    tpsearch searches",
+		 "don't record the job in the archive");
+
+  string_option(NULL, "archive-dir", "", &archive_dir, NULL, NULL,
+		OPT_OUTPUT,
+		"keep the archive in directory <string> instead of\n"
+		"    ~/.trueprint/files");
+}
+
+/*****************************************************************************
+ * Function:
+ *	archive_path
+ *
+ * Works out the name of the archive, making its directory if need be.
+ */
+static char *
+archive_path(void)
+
+{
+  char	*dir;
+  char	*path;
+
+  if ((archive_dir != NULL) && (*archive_dir != '\0'))
+    {
+      dir = xmalloc(strlen(archive_dir) + 1);
+      strcpy(dir, archive_dir);
+    }
+  else
+    {
+      char *home = getenv("HOME");
+
+      if ((home == NULL) || (*home == '\0'))
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": cannot archive the job, $HOME is not set\n"));
+	  return NULL;
+	}
+      dir = xmalloc(strlen(home) + strlen(ARCHIVE_DIR) + 1);
+      sprintf(dir, "%s%s", home, ARCHIVE_DIR);
+
+      /* ~/.trueprint may not be there yet either */
+      *strrchr(dir, '/') = '\0';
+      mkdir(dir, 0777);
+      dir[strlen(dir)] = '/';
+    }
+
+  if ((mkdir(dir, 0777) == -1) && (errno != EEXIST))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot make archive directory %s, %s\n"),
+	      dir, strerror(errno));
+      free(dir);
+      return NULL;
+    }
+
+  path = xmalloc(strlen(dir) + strlen(ARCHIVE_NAME) + 2);
+  sprintf(path, "%s/%s", dir, ARCHIVE_NAME);
+  free(dir);
+  return path;
+}
+
+/*****************************************************************************
+ * Function:
+ *	add_text
+ */
+static void
+add_text(char **text, size_t *length, size_t *size, const char *string)
+
+{
+  size_t string_length = strlen(string);
+
+  if (*length + string_length > *size)
+    {
+      *size = (*size + string_length) * 2;
+      *text = xrealloc(*text, *size);
+    }
+  memcpy(*text + *length, string, string_length);
+  *length += string_length;
+}
+
+/*****************************************************************************
+ * Function:
+ *	write_archive
+ *
+ * Appends this job to the archive, if --archive was given.  A job that
+ * can't be archived has still been printed, so problems are reported
+ * but don't stop trueprint.
+ */
+void
+write_archive(void)
+
+{
+  char			*text = NULL;
+  size_t		text_length = 0;
+  size_t		text_size = 0;
+  unsigned char		*segment;
+  size_t		segment_length;
+  unsigned char		*compressed;
+  size_t		compressed_length;
+  unsigned char		*next;
+  unsigned int		file;
+  unsigned long long	printed;
+  char			*path;
+  int			fd;
+
+  if (!archive_job) return;
+
+  segment = xmalloc(ARCHIVE_HEADER_SIZE + no_of_files * ARCHIVE_RECORD_SIZE + ARCHIVE_FOOTER_SIZE);
+  next = segment + ARCHIVE_HEADER_SIZE;
+
+  for (file = 0; file < no_of_files; file++)
+    {
+      long	first_page = get_file_first_page(file);
+      long	last_page = get_file_last_page(file);
+      size_t	start = text_length;
+      size_t	function;
+      char	line[64];
+
+      add_text(&text, &text_length, &text_size, "file ");
+      add_text(&text, &text_length, &text_size, file_name(file));
+      if (last_page > first_page)
+	sprintf(line, "\npages %ld-%ld\n", first_page, last_page);
+      else
+	sprintf(line, "\npage %ld\n", first_page);
+      add_text(&text, &text_length, &text_size, line);
+
+      for (function = 0; function < no_of_indexed_functions(); function++)
+	{
+	  char	*name;
+	  long	start_char, end_char, page, end_page;
+
+	  get_indexed_function(function, &name, &start_char, &end_char, &page, &end_page);
+	  if ((page < first_page) || (page > last_page)) continue;
+
+	  add_text(&text, &text_length, &text_size, "function ");
+	  add_text(&text, &text_length, &text_size, name);
+	  if (end_page > page)
+	    sprintf(line, " %ld-%ld\n", page, end_page);
+	  else
+	    sprintf(line, " %ld\n", page);
+	  add_text(&text, &text_length, &text_size, line);
+	}
+
+      put_archive_number(next, (unsigned long)start);
+      put_archive_number(next + 4, (unsigned long)(text_length - start));
+      put_archive_number(next + 8, (unsigned long)first_page);
+      put_archive_number(next + 12, (unsigned long)last_page);
+      next += ARCHIVE_RECORD_SIZE;
+    }
+
+  compressed = lzw_encode((unsigned char *)text, text_length, &compressed_length);
+
+  /*
+   * Put the compressed text between the header and the record table
+   */
+  segment_length = ARCHIVE_HEADER_SIZE + compressed_length
+    + no_of_files * ARCHIVE_RECORD_SIZE + ARCHIVE_FOOTER_SIZE;
+  segment = xrealloc(segment, segment_length);
+  memmove(segment + ARCHIVE_HEADER_SIZE + compressed_length,
+	  segment + ARCHIVE_HEADER_SIZE, no_of_files * ARCHIVE_RECORD_SIZE);
+  memcpy(segment + ARCHIVE_HEADER_SIZE, compressed, compressed_length);
+  free(compressed);
+
+  printed = use_environment ? (unsigned long long)time(NULL) : 0;
+  memcpy(segment, ARCHIVE_MAGIC, 4);
+  put_archive_number(segment + 4, (unsigned long)segment_length);
+  next = segment + segment_length - ARCHIVE_FOOTER_SIZE;
+  put_archive_number(next, (unsigned long)no_of_files);
+  put_archive_number(next + 4, (unsigned long)compressed_length);
+  put_archive_number(next + 8, (unsigned long)text_length);
+  put_archive_number(next + 12, (unsigned long)(printed >> 32));
+  put_archive_number(next + 16, (unsigned long)(printed & 0xffffffffUL));
+  memcpy(next + 20, ARCHIVE_END_MAGIC, 4);
+
+  dm('O',2,"archive.c:write_archive() %lu files, %lu bytes of text in %lu bytes\n",
+     (unsigned long)no_of_files, (unsigned long)text_length, (unsigned long)segment_length);
+
+  if ((path = archive_path()) != NULL)
+    {
+      boolean written = FALSE;
+
+      if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666)) != -1)
+	{
+	  written = (write(fd, segment, segment_length) == (int)segment_length);
+	  if (close(fd) == -1) written = FALSE;
+	}
+      if (!written)
+	fprintf(stderr, gettext(CMD_NAME ": cannot add the job to archive %s, %s\n"),
+		path, strerror(errno));
+      free(path);
+    }
+
+  free(segment);
+  free(text);
+}
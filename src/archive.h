@@ -0,0 +1,7 @@
+/*
+ * Include file:
+ *	archive.h
+ */
+
+extern void setup_archive(void);
+extern void write_archive(void);
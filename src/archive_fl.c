@@ -0,0 +1,258 @@
+/*
+ * Source file:
+ *	archive_fl.c
+ *
+ * Reads the archive of printed listings that trueprint --archive writes,
+ * for tpsearch.  The layout is described in archive_fl.h.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trueprint.h"
+#include "utils.h"
+
+#include "archive_fl.h"
+
+/*
+ * Private part
+ */
+#define LZW_CLEAR	256
+#define LZW_EOD		257
+#define LZW_FIRST_CODE	258
+#define LZW_MAX_BITS	12
+#define LZW_TABLE_SIZE	4096
+
+/*****************************************************************************
+ * Function:
+ *	put_archive_number, get_archive_number
+ *
+ * Four byte numbers in network byte order.
+ */
+void
+put_archive_number(unsigned char *bytes, unsigned long value)
+
+{
+  bytes[0] = (unsigned char)((value >> 24) & 0xff);
+  bytes[1] = (unsigned char)((value >> 16) & 0xff);
+  bytes[2] = (unsigned char)((value >> 8) & 0xff);
+  bytes[3] = (unsigned char)(value & 0xff);
+}
+
+unsigned long
+get_archive_number(const unsigned char *bytes)
+
+{
+  return ((unsigned long)bytes[0] << 24) | ((unsigned long)bytes[1] << 16)
+    | ((unsigned long)bytes[2] << 8) | (unsigned long)bytes[3];
+}
+
+/*****************************************************************************
+ * Function:
+ *	lzw_decode
+ *
+ * The reverse of lzw_encode() in encode.c.  The decoder's table is one
+ * entry behind the encoder's, so it widens its codes one entry early.
+ * Returns NULL if the data is damaged.
+ */
+unsigned char *
+lzw_decode(const unsigned char *data, size_t length, size_t *decoded_length)
+
+{
+  unsigned short	prefix[LZW_TABLE_SIZE];
+  unsigned char		suffix[LZW_TABLE_SIZE];
+  unsigned char		first[LZW_TABLE_SIZE];
+  unsigned char		stack[LZW_TABLE_SIZE];
+  unsigned char		*out = NULL;
+  size_t		out_size = 0;
+  size_t		used = 0;
+  unsigned long		bits = 0;
+  int			no_of_bits = 0;
+  size_t		data_index = 0;
+  unsigned int		next_code = LZW_FIRST_CODE;
+  int			width = 9;
+  int			previous = -1;
+  unsigned int		code;
+
+  for (code = 0; code < 256; code++)
+    {
+      suffix[code] = (unsigned char)code;
+      first[code] = (unsigned char)code;
+    }
+
+  for (;;)
+    {
+      unsigned int	string;
+      int		depth = 0;
+
+      while (no_of_bits < width)
+	{
+	  if (data_index == length)
+	    {
+	      free(out);
+	      return NULL;
+	    }
+	  bits = (bits << 8) | data[data_index++];
+	  no_of_bits += 8;
+	}
+      no_of_bits -= width;
+      code = (unsigned int)(bits >> no_of_bits) & ((1U << width) - 1);
+
+      if (code == LZW_EOD) break;
+      if (code == LZW_CLEAR)
+	{
+	  next_code = LZW_FIRST_CODE;
+	  width = 9;
+	  previous = -1;
+	  continue;
+	}
+
+      if ((code > next_code) || ((code == next_code) && (previous == -1)))
+	{
+	  free(out);
+	  return NULL;
+	}
+
+      if (previous != -1)
+	{
+	  if (next_code >= LZW_TABLE_SIZE)
+	    {
+	      free(out);
+	      return NULL;
+	    }
+	  prefix[next_code] = (unsigned short)previous;
+	  first[next_code] = first[previous];
+	  suffix[next_code] = first[(code == next_code) ? (unsigned int)previous : code];
+	  next_code++;
+	}
+
+      for (string = code; string >= 256; string = prefix[string])
+	stack[depth++] = suffix[string];
+      stack[depth++] = suffix[string];
+
+      if (used + (size_t)depth > out_size)
+	{
+	  out_size = (out_size == 0) ? 4096 : out_size * 2;
+	  if (out_size < used + (size_t)depth) out_size = used + (size_t)depth;
+	  out = xrealloc(out, out_size);
+	}
+      while (depth > 0)
+	out[used++] = stack[--depth];
+
+      previous = (int)code;
+      if ((next_code + 1 >= (1U << width)) && (width < LZW_MAX_BITS))
+	width++;
+    }
+
+  *decoded_length = used;
+  return (out == NULL) ? xmalloc(1) : out;
+}
+
+/*****************************************************************************
+ * Function:
+ *	is_archive
+ */
+boolean
+is_archive(const unsigned char *data, size_t size)
+
+{
+  return (size >= ARCHIVE_HEADER_SIZE) && (memcmp(data, ARCHIVE_MAGIC, 4) == 0);
+}
+
+/*****************************************************************************
+ * Function:
+ *	read_archive
+ *
+ * Decodes every segment of an archive, putting the text of all the
+ * records into *text and returning the records.  Reading stops at the
+ * first damaged segment, e.g. one that is still being written.
+ */
+archive_record *
+read_archive(const unsigned char *data, size_t size,
+	     size_t *no_of_records, char **text, size_t *text_length)
+
+{
+  archive_record	*records = NULL;
+  size_t		records_size = 0;
+  size_t		position = 0;
+
+  *no_of_records = 0;
+  *text = xmalloc(1);
+  *text_length = 0;
+
+  while (size - position >= ARCHIVE_HEADER_SIZE + ARCHIVE_FOOTER_SIZE)
+    {
+      const unsigned char	*segment = data + position;
+      unsigned long		segment_length = get_archive_number(segment + 4);
+      const unsigned char	*footer;
+      unsigned long		segment_records;
+      unsigned long		compressed_length;
+      unsigned long		decoded_length;
+      unsigned char		*decoded;
+      size_t			length;
+      unsigned long		record;
+      time_t			printed;
+
+      if ((memcmp(segment, ARCHIVE_MAGIC, 4) != 0)
+	  || (segment_length < ARCHIVE_HEADER_SIZE + ARCHIVE_FOOTER_SIZE)
+	  || (segment_length > size - position))
+	break;
+
+      footer = segment + segment_length - ARCHIVE_FOOTER_SIZE;
+      segment_records = get_archive_number(footer);
+      compressed_length = get_archive_number(footer + 4);
+      decoded_length = get_archive_number(footer + 8);
+      printed = (time_t)(((unsigned long long)get_archive_number(footer + 12) << 32)
+			 | get_archive_number(footer + 16));
+
+      if ((memcmp(footer + 20, ARCHIVE_END_MAGIC, 4) != 0)
+	  || (compressed_length > segment_length)
+	  || (segment_records > (segment_length - compressed_length) / ARCHIVE_RECORD_SIZE)
+	  || (ARCHIVE_HEADER_SIZE + compressed_length + segment_records * ARCHIVE_RECORD_SIZE
+	      + ARCHIVE_FOOTER_SIZE != segment_length))
+	break;
+
+      decoded = lzw_decode(segment + ARCHIVE_HEADER_SIZE, compressed_length, &length);
+      if ((decoded == NULL) || (length != decoded_length))
+	{
+	  free(decoded);
+	  break;
+	}
+
+      for (record = 0; record < segment_records; record++)
+	{
+	  const unsigned char	*entry = segment + ARCHIVE_HEADER_SIZE + compressed_length
+	    + record * ARCHIVE_RECORD_SIZE;
+	  unsigned long		offset = get_archive_number(entry);
+	  unsigned long		record_length = get_archive_number(entry + 4);
+
+	  if ((offset > length) || (record_length > length - offset)) continue;
+
+	  if (*no_of_records == records_size)
+	    {
+	      records_size = (records_size == 0) ? 64 : records_size * 2;
+	      records = xrealloc(records, records_size * sizeof(archive_record));
+	    }
+	  records[*no_of_records].offset = *text_length + offset;
+	  records[*no_of_records].length = record_length;
+	  records[*no_of_records].first_page = (long)get_archive_number(entry + 8);
+	  records[*no_of_records].last_page = (long)get_archive_number(entry + 12);
+	  records[*no_of_records].printed = printed;
+	  (*no_of_records)++;
+	}
+
+      *text = xrealloc(*text, *text_length + length + 1);
+      memcpy(*text + *text_length, decoded, length);
+      *text_length += length;
+      free(decoded);
+
+      position += segment_length;
+    }
+
+  (*text)[*text_length] = '\0';
+  return records;
+}
@@ -0,0 +1,36 @@
+/*
+ * Include file:
+ *	archive_fl.h
+ *
+ * The archive is a file of segments, one for each job, that is only
+ * ever appended to.  Numbers are in network byte order.
+ *	header		ARCHIVE_MAGIC, length of the whole segment
+ *	text		the records, LZW compressed
+ *	record table	for each record: offset and length of its text,
+ *			first and last page
+ *	footer		number of records, length of the compressed text,
+ *			length of the text, time printed, ARCHIVE_END_MAGIC
+ */
+
+#define ARCHIVE_DIR		"/.trueprint/files"
+#define ARCHIVE_NAME		"archive"
+#define ARCHIVE_MAGIC		"TPAS"
+#define ARCHIVE_END_MAGIC	"TPAE"
+#define ARCHIVE_HEADER_SIZE	8
+#define ARCHIVE_RECORD_SIZE	16
+#define ARCHIVE_FOOTER_SIZE	24
+
+typedef struct {
+  size_t	offset;		/* of the text in the buffer from read_archive() */
+  size_t	length;
+  long		first_page;
+  long		last_page;
+  time_t	printed;
+} archive_record;
+
+extern boolean is_archive(const unsigned char *data, size_t size);
+extern archive_record *read_archive(const unsigned char *data, size_t size,
+				    size_t *no_of_records, char **text, size_t *text_length);
+extern unsigned char *lzw_decode(const unsigned char *data, size_t length, size_t *decoded_length);
+extern void put_archive_number(unsigned char *bytes, unsigned long value);
+extern unsigned long get_archive_number(const unsigned char *bytes);
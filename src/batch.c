@@ -0,0 +1,410 @@
+/*
+ * Source file:
+ *	batch.c
+ *
+ * Runs a file of independent jobs, one per line, from a single
+ * trueprint.  Like server.c, the start-up work is done once and each job
+ * runs in a process forked from that state, so no job can disturb the
+ * global state of another.  Up to a fixed number of jobs run at once,
+ * and the biggest jobs are started first so that a large job doesn't
+ * start last and hold up the end of the batch.
+ *
+ * Anything a job writes to standard output, for example with
+ * --output=-, is held in a temporary file and copied out in the order
+ * of the jobs in the batch file, so the output doesn't depend on which
+ * jobs happen to finish first.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef MSWIN
+# include <sys/wait.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int close(int fildes);
+extern int dup2(int fildes, int fildes2);
+extern pid_t fork(void);
+extern off_t lseek(int fildes, off_t offset, int whence);
+extern int read(int fildes, void *buf, size_t nbyte);
+extern int write(int fildes, const void *buf, size_t nbyte);
+extern long sysconf(int name);
+#endif
+
+#include "trueprint.h"
+#include "utils.h"
+#include "debug.h"
+#include "options.h"
+
+#include "batch.h"
+
+/*
+ * Private part
+ */
+typedef struct batch_job {
+  char	*line;		/* the job as written in the batch file */
+  long	line_number;
+  off_t	size;		/* total size of the files it names */
+  pid_t	pid;		/* 0 until started */
+  FILE	*output;	/* what it wrote to standard output */
+  boolean finished;
+  int	exit_code;
+} batch_job;
+
+static batch_job *jobs;
+static size_t	no_of_jobs;
+
+/*
+ * Output held for finished jobs waiting for earlier ones.  Each holds a
+ * file descriptor, so once this many are waiting the jobs are started
+ * in the order of the batch file until the earliest one can be copied.
+ */
+#define MAX_WAITING	32
+static int	waiting;
+
+static void read_batch_file(const char *batch_file);
+static off_t job_size(const char *line);
+static int compare_sizes(const void *, const void *);
+static void copy_output(batch_job *job);
+
+/******************************************************************************
+ * Function:
+ *	read_batch_file
+ *
+ * Reads the jobs into jobs[].  Blank lines and lines starting with #
+ * are ignored.
+ */
+static void
+read_batch_file(const char *batch_file)
+{
+  FILE		*stream;
+  char		*line = NULL;
+  size_t	line_size = 0;
+  size_t	jobs_size = 0;
+  long		line_number = 0;
+
+  if (strcmp(batch_file, "-") == 0)
+    stream = stdin;
+  else if ((stream = fopen(batch_file, "r")) == NULL)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot open batch file %s, %s\n"),
+	      batch_file, strerror(errno));
+      exit(1);
+    }
+
+  for (;;)
+    {
+      size_t	length = 0;
+      char	*start;
+
+      /*
+       * Read a whole line, however long
+       */
+      do
+	{
+	  if (line_size - length < 2)
+	    {
+	      line_size = (line_size == 0) ? 256 : line_size * 2;
+	      line = xrealloc(line, line_size);
+	    }
+	  if (fgets(line + length, (int)(line_size - length), stream) == NULL)
+	    break;
+	  length += strlen(line + length);
+	}
+      while (line[length-1] != '\n');
+
+      if (length == 0) break;
+      line_number++;
+
+      while ((length > 0) && ((line[length-1] == '\n') || (line[length-1] == '\r')))
+	line[--length] = '\0';
+      for (start = line; (*start == ' ') || (*start == '\t'); start++)
+	;
+      if ((*start == '\0') || (*start == '#')) continue;
+
+      if (no_of_jobs == jobs_size)
+	{
+	  jobs_size = (jobs_size == 0) ? 64 : jobs_size * 2;
+	  jobs = xrealloc(jobs, jobs_size * sizeof(batch_job));
+	}
+      memset(&jobs[no_of_jobs], 0, sizeof(batch_job));
+      jobs[no_of_jobs].line = strdup(start);
+      jobs[no_of_jobs].line_number = line_number;
+      jobs[no_of_jobs].size = job_size(start);
+      no_of_jobs++;
+    }
+
+  if (ferror(stream))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot read batch file %s, %s\n"),
+	      batch_file, strerror(errno));
+      exit(1);
+    }
+  if (stream != stdin) fclose(stream);
+  free(line);
+
+  dm('P',1,"batch.c:read_batch_file() %lu jobs in %s\n", (unsigned long)no_of_jobs, batch_file);
+}
+
+/******************************************************************************
+ * Function:
+ *	job_size
+ *
+ * Estimates how much work a job is by adding up the sizes of the
+ * arguments that are files.  Option values that happen not to be files
+ * add nothing.
+ */
+static off_t
+job_size(const char *line)
+{
+  struct stat	file_stat;
+  char		**argv;
+  int		argc;
+  int		arg_index;
+  off_t		size = 0;
+
+  argv = split_options(line, &argc);
+  for (arg_index = 1; arg_index < argc; arg_index++)
+    {
+      if ((argv[arg_index][0] != '-')
+	  && (stat(argv[arg_index], &file_stat) == 0)
+	  && S_ISREG(file_stat.st_mode))
+	size += file_stat.st_size;
+    }
+  free_options(argv);
+
+  return size;
+}
+
+/******************************************************************************
+ * Function:
+ *	compare_sizes
+ *
+ * For qsort() - biggest first, then in batch file order.
+ */
+static int
+compare_sizes(const void *p1, const void *p2)
+{
+  const batch_job *job1 = *(batch_job * const *)p1;
+  const batch_job *job2 = *(batch_job * const *)p2;
+
+  if (job1->size != job2->size)
+    return (job1->size > job2->size) ? -1 : 1;
+
+  return (job1 < job2) ? -1 : (job1 > job2);
+}
+
+/******************************************************************************
+ * Function:
+ *	copy_output
+ *
+ * Copies anything the job wrote to standard output to the real standard
+ * output.  The job wrote through its own file descriptor, so only the
+ * descriptor is used here.
+ */
+static void
+copy_output(batch_job *job)
+{
+  char		buffer[BUFFER_SIZE];
+  ssize_t	got;
+  int		fd;
+
+  if (job->output == NULL) return;
+
+  fd = fileno(job->output);
+  if (lseek(fd, 0, SEEK_SET) == -1)
+    {
+      perror(CMD_NAME ": cannot read back batch job output");
+      exit(2);
+    }
+
+  while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+      char *next = buffer;
+
+      while (got > 0)
+	{
+	  ssize_t written = write(1, next, (size_t)got);
+
+	  if (written == -1)
+	    {
+	      if (errno == EINTR) continue;
+	      perror(CMD_NAME ": cannot write batch job output");
+	      exit(2);
+	    }
+	  next += written;
+	  got -= written;
+	}
+    }
+
+  fclose(job->output);
+  job->output = NULL;
+  waiting--;
+}
+
+/******************************************************************************
+ * Function:
+ *	run_batch
+ *
+ * Runs every job in batch_file, with at most workers jobs at a time
+ * (0 for one per processor).  Exits when the batch is finished, with 0
+ * if every job succeeded and 1 otherwise.  Returns in each job's own
+ * process, with *argc and *argv set to the job's arguments.
+ */
+void
+run_batch(const char *batch_file, short workers, int *argc, char ***argv)
+{
+#ifdef MSWIN
+  fprintf(stderr, gettext(CMD_NAME ": batch mode is not supported on this system\n"));
+  exit(1);
+#else
+  batch_job	**order;
+  size_t	next_to_start = 0;	/* in order[], biggest first */
+  size_t	next_in_file = 0;	/* in jobs[], in the order of the file */
+  size_t	started = 0;
+  size_t	next_to_copy = 0;
+  size_t	job_index;
+  int		running = 0;
+  int		failures = 0;
+
+  read_batch_file(batch_file);
+
+  if (workers == 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+      long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+      workers = (processors > 0) ? (short)((processors < 256) ? processors : 256) : 1;
+#else
+      workers = 1;
+#endif
+    }
+  dm('P',1,"batch.c:run_batch() Running %lu jobs, %d at a time\n", (unsigned long)no_of_jobs, workers);
+
+  order = xmalloc((no_of_jobs + 1) * sizeof(batch_job *));
+  for (job_index = 0; job_index < no_of_jobs; job_index++)
+    order[job_index] = &jobs[job_index];
+  qsort(order, no_of_jobs, sizeof(batch_job *), compare_sizes);
+
+  fflush(stdout);
+
+  while ((started < no_of_jobs) || (running > 0))
+    {
+      int	status;
+      pid_t	pid;
+
+      /*
+       * Keep every worker busy, with the biggest jobs first unless too
+       * much output is waiting
+       */
+      while ((running < workers) && (started < no_of_jobs))
+	{
+	  batch_job *job;
+
+	  if (waiting >= MAX_WAITING)
+	    {
+	      while (jobs[next_in_file].pid != 0) next_in_file++;
+	      job = &jobs[next_in_file];
+	    }
+	  else
+	    {
+	      while (order[next_to_start]->pid != 0) next_to_start++;
+	      job = order[next_to_start];
+	    }
+	  started++;
+
+	  if ((job->output = tmpfile()) == NULL)
+	    {
+	      perror(CMD_NAME ": cannot create temporary file for batch job");
+	      exit(2);
+	    }
+
+	  if ((job->pid = fork()) == -1)
+	    {
+	      perror(CMD_NAME ": cannot fork batch job");
+	      exit(2);
+	    }
+
+	  if (job->pid == 0)
+	    {
+	      int null_fd;
+
+	      if ((dup2(fileno(job->output), 1) == -1)
+		  || ((null_fd = open("/dev/null", O_RDONLY)) == -1)
+		  || (dup2(null_fd, 0) == -1))
+		{
+		  perror(CMD_NAME ": cannot set up batch job");
+		  exit(2);
+		}
+	      close(null_fd);
+
+	      /* The job only needs its own output, and that is now on 1 */
+	      for (job_index = 0; job_index < no_of_jobs; job_index++)
+		if (jobs[job_index].output != NULL)
+		  {
+		    fclose(jobs[job_index].output);
+		    jobs[job_index].output = NULL;
+		  }
+
+	      dm('P',2,"batch.c:run_batch() Job at line %ld: %s\n", job->line_number, job->line);
+	      *argv = split_options(job->line, argc);
+	      return;
+	    }
+
+	  running++;
+	}
+
+      /*
+       * Wait for a job to finish, and copy out any output that is now
+       * next in line
+       */
+      if ((pid = wait(&status)) == -1)
+	{
+	  if (errno == EINTR) continue;
+	  perror(CMD_NAME ": cannot wait for batch job");
+	  exit(2);
+	}
+
+      for (job_index = 0; job_index < no_of_jobs; job_index++)
+	if ((jobs[job_index].pid == pid) && !jobs[job_index].finished) break;
+      if (job_index == no_of_jobs) continue;
+
+      running--;
+      jobs[job_index].finished = TRUE;
+      jobs[job_index].exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 2;
+      if (jobs[job_index].exit_code != 0)
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": batch job at line %ld failed: %s\n"),
+		  jobs[job_index].line_number, jobs[job_index].line);
+	  failures++;
+	}
+
+      /*
+       * Most jobs write to a file or a printer, so there's no need to
+       * hold on to their empty output while they wait their turn.
+       */
+      if (lseek(fileno(jobs[job_index].output), 0, SEEK_END) == 0)
+	{
+	  fclose(jobs[job_index].output);
+	  jobs[job_index].output = NULL;
+	}
+      else
+	waiting++;
+
+      while ((next_to_copy < no_of_jobs) && jobs[next_to_copy].finished)
+	copy_output(&jobs[next_to_copy++]);
+    }
+
+  exit(failures ? 1 : 0);
+#endif /* MSWIN */
+}
@@ -0,0 +1,6 @@
+/*
+ * Include file:
+ *	batch.h
+ */
+
+extern void run_batch(const char *batch_file, short workers, int *argc, char ***argv);
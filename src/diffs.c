@@ -3,26 +3,24 @@
  *	diffs.c
  *
  * Implements the highlighting of differences between old and new versions
- * of files.
+ * of files.  The differences come either from running diff on each file,
+ * or from a patch (see patch.c), which doesn't need a diff command.
+ * With --diff-revision the old version of each file comes out of its
+ * git repository (see gitrepo.c) into a temporary file for diff.
+ *
+ * The differences for every file are worked out once, before the first
+ * pass, with several diffs running at once, and kept as a table of
+ * hunks and the text of the deleted lines that both passes read.
+ *
+ * With --word-diff each deleted line of a change is paired with the
+ * added line in the same place, and only the words that differ between
+ * the two are marked.  The words are compared with Myers' O(ND)
+ * algorithm, which gives up after MAX_WORD_EDITS edits, so a line that
+ * has been rewritten costs little and is simply marked as a whole.
  */
 
 #include "config.h"
 
-#ifndef DIFF_CMD
-
-#include "trueprint.h"
-#include "diffs.h"
-
-/* If there is no diff command just provide stubs */
-
-void setup_diffs(void) { return; }
-void init_diffs(char newfile[]) { return; }
-void end_diffs(void) { return; }
-boolean	getdelline(long current_line, char *input_line, char_status input_status[]) { return 0; }
-boolean	line_inserted(long current_line) { return 0; }
-
-#else
-
 #include <ctype.h>
 #include <errno.h>
 /* Ultrix needs these sys header files this way around */
@@ -32,27 +30,103 @@ boolean	line_inserted(long current_line) { return 0; }
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef MSWIN
+# include <sys/wait.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int close(int fildes);
+extern int dup2(int fildes, int fildes2);
+extern pid_t fork(void);
+extern long sysconf(int name);
+extern int write(int fildes, const void *buf, size_t nbyte);
+extern int unlink(const char *path);
+#endif
+
 #include "trueprint.h"
 #include "utils.h"
 #include "main.h"
 #include "output.h"
-#include "openpipe.h"
 #include "options.h"
 #include "debug.h"
+#include "patch.h"
+#include "gitrepo.h"
 
 #include "diffs.h"
 
 static char	*diffs_string;
+static char	*patch_filename;
+static char	*diffs_revision;
+static boolean	word_diff;
 
 /*
  * Private part
  */
+#define MAX_WORD_EDITS	32
+
+typedef struct {
+  long		start_line;	/* first line added, or line after the deletion */
+  long		end_line;
+  long		lines_deleted;
+  long		lines_added;
+  size_t	deleted_offset;	/* where its lines start in deleted_text */
+  size_t	added_offset;	/* and in added_text, for --word-diff */
+} diff_hunk;
+
+typedef struct {
+  diff_hunk	*hunks;
+  long		no_of_hunks;
+  char		*deleted_text;	/* the deleted lines, one after another */
+  size_t	deleted_size;
+  char		*added_text;	/* the added lines, only for --word-diff */
+  size_t	added_size;
+} file_diffs;
+
+typedef struct {
+  const char	*start;
+  int		length;
+} word;
+
+#ifdef DIFF_CMD
+typedef struct {
+  pid_t		pid;		/* 0 if there is no diff to run */
+  FILE		*output;
+  char		*old_version_file;
+} diff_job;
+#endif
+
 static unsigned	short read_values(FILE *,long *value1_ptr, long *value2_ptr);
 static boolean read_long(FILE *, long *);
+static boolean skip_line(FILE *stream);
+static void		keep_line(FILE *stream, char **text, size_t *used, size_t *size);
+static char		*take_line(char **text, char *end);
+static void		read_hunks(FILE *stream, file_diffs *diffs);
 static void		parse_line(void);
+#ifdef DIFF_CMD
+static char		*write_old_version(char newfile[]);
+static char		*diff_command(char newfile[], char **old_version_file);
+static void		run_diffs(char *files[]);
+#endif
 static stream_status get_diff_char(char *input_char, char_status *status);
-
-static FILE		*diffs_stream;
+static stream_status get_pair_char(char *input_char, char_status *status);
+static int		split_words(const char *line, word words[]);
+static boolean		diff_words(const word *old_words, int no_of_old,
+				   const word *new_words, int no_of_new,
+				   boolean old_changed[], boolean new_changed[]);
+
+static file_diffs	*all_diffs;	/* one for each file */
+static unsigned int	no_of_diffs;
+static file_diffs	*current_diffs;
+static long		next_hunk;
+static char		*next_deleted_char;
+static diff_hunk	*current_hunk;
+static char		*pair_deleted;	/* deleted line paired with the next added line */
+static char		*pair_added;	/* added line paired with the next deleted line */
+static char		*pair_line;	/* line paired with the current one, if any */
+static boolean		pair_is_old;
+static char		*next_pair_char;
 static boolean		diffs_on;
 static long	diff_start_line;
 static long	diff_end_line;
@@ -68,75 +142,292 @@ void
 setup_diffs(void)
 {
   diffs_string = NULL;
-  diffs_stream = NULL;
-
+  patch_filename = NULL;
+  diffs_revision = NULL;
+  all_diffs = NULL;
+  no_of_diffs = 0;
+  diffs_on = FALSE;
+  word_diff = FALSE;
+
+#ifdef DIFF_CMD
   string_option("O", "diff", NULL, &diffs_string, NULL, NULL,
 		OPT_MISC,
 		"if <string> is a file then print diffs between <string> and input file\n"
 		"    otherwise use as a prefix and print diffs");
+
+  string_option(NULL, "diff-revision", NULL, &diffs_revision, NULL, NULL,
+		OPT_MISC,
+		"print diffs between the input file and its version at git revision\n"
+		"    <string>");
+#endif
+
+  string_option(NULL, "diff-patch", NULL, &patch_filename, NULL, NULL,
+		OPT_MISC,
+		"print diffs from the unified diff or patch series in file <string>");
+
+  boolean_option(NULL, "word-diff", "line-diff", FALSE, &word_diff, NULL, NULL,
+		 OPT_MISC,
+		 "mark only the words that have changed in changed lines",
+		 "mark the whole of each changed line");
 }
 
 /*
  * Function:
- *	init_diffs
+ *	compute_diffs
  *
- * Initialises the diffs system:
- * checks to see if any old version was provided and returns if not;
- * calls end_diffs() if necessary;
- * starts up the diff process; 
+ * Works out the differences for each of files[], which ends with NULL,
+ * if any old version was asked for.  With a patch the changes for each
+ * file come straight from the patch; otherwise diff is run on every
+ * file, as many at once as there are processors.
  */
 void
-init_diffs(char newfile[])
+compute_diffs(char *files[])
 
 {
-  char	command[COMMAND_LEN];
-  char	*diff_cmd;
-  struct stat dummy;
-  /* Check to see if any old versions given */
+  unsigned int	file;
 
-  if (diffs_string == NULL)
+  if ((diffs_string != NULL) + (patch_filename != NULL) + (diffs_revision != NULL) > 1)
     {
-      /* turn off diffs and return */
-      diffs_on = FALSE;
+      fprintf(stderr, gettext(CMD_NAME ": only one of --diff, --diff-patch and --diff-revision can be used\n"));
+      exit(1);
+    }
+
+  if (!diffs_wanted()) return;
+
+  for (no_of_diffs = 0; files[no_of_diffs] != NULL; no_of_diffs++)
+    ;
+  all_diffs = xmalloc((no_of_diffs + 1) * sizeof(file_diffs));
+  memset(all_diffs, 0, (no_of_diffs + 1) * sizeof(file_diffs));
+
+  if (patch_filename != NULL)
+    {
+      for (file = 0; file < no_of_diffs; file++)
+	{
+	  FILE *stream;
+
+	  if ((strcmp(files[file], "-") != 0)
+	      && ((stream = patch_diffs(patch_filename, files[file])) != NULL))
+	    {
+	      read_hunks(stream, &all_diffs[file]);
+	      fclose(stream);
+	    }
+	}
       return;
     }
 
-  diffs_on = TRUE;
+#ifdef DIFF_CMD
+  run_diffs(files);
+#endif
+}
+
+#ifdef DIFF_CMD
+/*
+ * Function:
+ *	diff_command
+ *
+ * Returns the diff command for newfile, or NULL if there is no old
+ * version to compare it with.  Sets *old_version_file to any temporary
+ * file that the command reads.
+ */
+static char *
+diff_command(char newfile[], char **old_version_file)
+
+{
+  char	*command = xmalloc(COMMAND_LEN);
+  char	*diff_cmd;
+  struct stat dummy;
+
+  *old_version_file = NULL;
+
+  /* Standard input has already been read */
+  if (strcmp(newfile, "-") == 0)
+    {
+      free(command);
+      return NULL;
+    }
 
   if ((diff_cmd = getenv("TP_DIFF_CMD")) == NULL)
     {
       diff_cmd = DIFF_CMD;
     }
 
-  /*
-   * diffs_stream is only set if still reading from
-   * diff process, so need to finish the old diffs.
-   */
-  if (diffs_stream != NULL) end_diffs();
+  if (diffs_revision != NULL)
+    {
+      *old_version_file = write_old_version(newfile);
+      sprintf(command, "%s %s %s", diff_cmd, *old_version_file, newfile);
+    }
+  else
+    {
+      /*
+       * Check to see if diffs_string is a valid prefix or
+       * a filename...
+       */
+      sprintf(command,"%s%s",diffs_string,newfile);
 
-  /*
-   * Check to see if diffs_string is a valid prefix or
-   * a filename...
-   */
-  sprintf(command,"%s%s",diffs_string,newfile);
+      if (stat(command,&dummy) == 0)
+	{
+	  sprintf(command,"%s %s%s %s", diff_cmd,diffs_string,newfile,newfile);
+
+	}
+      else if (stat(diffs_string,&dummy) == 0)
+	{
+	  sprintf(command, "%s %s %s", diff_cmd, diffs_string, newfile);
+	}
+    }
+
+  dm('d',3,"diffs command: %s\n",command);
+
+  return command;
+}
+
+/*
+ * Function:
+ *	run_diffs
+ *
+ * Runs diff for each file, a few at a time, each writing to its own
+ * temporary file, and reads each one's output as soon as it finishes.
+ */
+static void
+run_diffs(char *files[])
+
+{
+  diff_job	*jobs = xmalloc(no_of_diffs * sizeof(diff_job));
+  unsigned int	next_to_start = 0;
+  unsigned int	running = 0;
+  unsigned int	workers = 1;
+  unsigned int	job_index;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (processors > 1) workers = (processors < 256) ? (unsigned int)processors : 256;
+  }
+#endif
+  dm('d',2,"diffs.c:run_diffs() Running diff on %u files, %u at a time\n", no_of_diffs, workers);
 
-  if (stat(command,&dummy) == 0)
+  /* Don't let each child flush what is still buffered */
+  fflush(NULL);
+
+  while ((next_to_start < no_of_diffs) || (running > 0))
     {
-      sprintf(command,"%s %s%s %s", diff_cmd,diffs_string,newfile,newfile);
+      int	status;
+      pid_t	pid;
+
+      while ((running < workers) && (next_to_start < no_of_diffs))
+	{
+	  diff_job	*job = &jobs[next_to_start];
+	  char		*command = diff_command(files[next_to_start], &job->old_version_file);
+
+	  next_to_start++;
+	  job->pid = 0;
+	  if (command == NULL) continue;
+
+	  if ((job->output = tmpfile()) == NULL)
+	    {
+	      perror(CMD_NAME ": cannot create temporary file for diffs");
+	      exit(2);
+	    }
+
+	  if ((job->pid = fork()) == -1)
+	    {
+	      perror(CMD_NAME ": Cannot fork");
+	      exit(2);
+	    }
+
+	  if (job->pid == 0)
+	    {
+	      if (dup2(fileno(job->output), 1) == -1)
+		{
+		  fprintf(stderr, gettext(CMD_NAME ": cannot redirect write for child, %s\n"), strerror(errno));
+		  exit(2);
+		}
+	      if (system(command) < 0)
+		{
+		  perror(CMD_NAME ": Cannot start pipe");
+		  exit(2);
+		}
+	      exit(0);
+	    }
+
+	  free(command);
+	  running++;
+	}
+
+      if (running == 0) continue;
 
+      if ((pid = wait(&status)) == -1)
+	{
+	  if (errno == EINTR) continue;
+	  perror(CMD_NAME ": cannot wait for diff");
+	  exit(2);
+	}
+
+      for (job_index = 0; job_index < next_to_start; job_index++)
+	if (jobs[job_index].pid == pid) break;
+      if (job_index == next_to_start) continue;
+
+      running--;
+      jobs[job_index].pid = 0;
+      rewind(jobs[job_index].output);
+      read_hunks(jobs[job_index].output, &all_diffs[job_index]);
+      fclose(jobs[job_index].output);
+
+      /* diff has finished with the old version */
+      if (jobs[job_index].old_version_file != NULL)
+	{
+	  unlink(jobs[job_index].old_version_file);
+	  free(jobs[job_index].old_version_file);
+	}
+
+      dm('d',3,"diffs: %ld hunks for %s\n", all_diffs[job_index].no_of_hunks, files[job_index]);
     }
-  else if (stat(diffs_string,&dummy) == 0)
+
+  free(jobs);
+}
+
+/*
+ * Function:
+ *	write_old_version
+ *
+ * Copies the version of newfile at diffs_revision into a temporary
+ * file, and returns its name.  A file that wasn't there at that
+ * revision is compared with an empty file, so that all of it shows
+ * as added.
+ */
+static char *
+write_old_version(char newfile[])
+
+{
+  char		*contents;
+  size_t	size;
+  int		fd;
+  const char	*tmp_dir;
+  char		*old_version_file;
+
+  if (!git_old_version(diffs_revision, newfile, &contents, &size))
     {
-      sprintf(command, "%s %s %s", diff_cmd, diffs_string, newfile);
+      contents = NULL;
+      size = 0;
     }
 
-  dm('d',3,"diffs command: %s\n",command);
+  if ((tmp_dir = getenv("TMPDIR")) == NULL) tmp_dir = "/tmp";
+  old_version_file = xmalloc(strlen(tmp_dir) + sizeof("/trueprintXXXXXX"));
+  sprintf(old_version_file, "%s/trueprintXXXXXX", tmp_dir);
 
-  if ((diffs_stream = fopenpipe(command, "r")) == NULL)
-    abort;
+  if (((fd = mkstemp(old_version_file)) == -1)
+      || ((size > 0) && (write(fd, contents, size) != (int)size))
+      || (close(fd) == -1))
+    {
+      perror(CMD_NAME ": cannot write old version for diff");
+      exit(1);
+    }
+  free(contents);
 
-  parse_line();
+  dm('d',3,"diffs: %s at %s is in %s\n", newfile, diffs_revision, old_version_file);
+  return old_version_file;
 }
+#endif
 
 /*
  * Function:
@@ -223,97 +514,277 @@ read_long(FILE *stream, long *value)
 
 /*
  * Function:
- *	parse_line
+ *	skip_line
  *
- * Reads a line from the diff stream, reading start and end line numbers
- * for both the old and new files and the change type (d, a or c).
+ * Skips to the start of the next line, and past any "\ No newline at
+ * end of file" that follows.  Returns FALSE at the end of the stream.
  */
-void
-parse_line(void)
+static boolean
+skip_line(FILE *stream)
 
 {
-  long delete_start;
-  long delete_end;
-  int	diff_type;
+  int next_char;
 
-  /*
-   * Read the first two values - if there aren't any then we've
-   * reached the end of the file.  These values refer to the
-   * first file so we're only interested in them for deleting lines.
-   */
-  if (read_values(diffs_stream, &delete_start, &delete_end) == 0)
+  do
     {
-      end_diffs();
-      diffs_on = FALSE;
-      return;
+      while (((next_char = getc(stream)) != '\n') && (next_char != EOF))
+	;
+      if (next_char == EOF) return FALSE;
+      next_char = getc(stream);
+      if (next_char != EOF) ungetc(next_char, stream);
     }
+  while (next_char == '\\');
 
-  /*
-   * Calculate the number of lines deleted.
-   * If delete start and delete end are the same then 1 line has been
-   * deleted... i.e. one more than the difference.
-   */
-  lines_deleted = delete_end - delete_start + 1;
+  return TRUE;
+}
+
+/*
+ * Function:
+ *	keep_line
+ *
+ * Adds the rest of the line to *text, which holds *used characters
+ * and has room for *size, and skips any "\ No newline at end of file".
+ */
+static void
+keep_line(FILE *stream, char **text, size_t *used, size_t *size)
 
-  diff_type = getc(diffs_stream);	/* a=add, d=del, c=change */
+{
+  int next_char;
 
-  switch (diff_type)
+  do
     {
-    case 'a':
-    case 'd':
-    case 'c':
-      break;
-    default:
-      fprintf(stderr, gettext(CMD_NAME ": warning, bad diffs stream format char %c!\n"), diff_type);
-      end_diffs();
-      diffs_on = FALSE;
-      return;
+      if ((next_char = getc(stream)) == EOF) next_char = '\n';
+      if (*used == *size)
+	{
+	  *size = (*size == 0) ? 1024 : *size * 2;
+	  *text = xrealloc(*text, *size);
+	}
+      (*text)[(*used)++] = (char)next_char;
     }
-	  
-  /* Same as before, only for new version of file */
-  if (read_values(diffs_stream, &diff_start_line, &diff_end_line) == 0)
+  while (next_char != '\n');
+
+  next_char = getc(stream);
+  if (next_char == '\\')
+    skip_line(stream);
+  else if (next_char != EOF)
+    ungetc(next_char, stream);
+}
+
+/*
+ * Function:
+ *	take_line
+ *
+ * Returns the line *text points at and moves *text on to the next one,
+ * or returns NULL if there are no lines left before end.
+ */
+static char *
+take_line(char **text, char *end)
+
+{
+  char *line = *text;
+  char *newline;
+
+  if ((line == NULL) || (line >= end)) return NULL;
+
+  newline = memchr(line, '\n', (size_t)(end - line));
+  *text = (newline != NULL) ? newline + 1 : end;
+  return line;
+}
+
+/*
+ * Function:
+ *	read_hunks
+ *
+ * Reads the output of diff into a table of hunks, each with the start
+ * and end line numbers in the new file and the numbers of lines
+ * deleted and added, and keeps the text of the deleted lines, and of
+ * the added lines for --word-diff.
+ */
+static void
+read_hunks(FILE *stream, file_diffs *diffs)
+
+{
+  size_t	hunks_size = 0;
+  size_t	deleted_text_size = 0;
+  size_t	added_text_size = 0;
+
+  for (;;)
     {
-      fprintf(stderr, gettext(CMD_NAME ": warning, bad diffs stream format!\n"));
-      end_diffs();
+      long	delete_start;
+      long	delete_end;
+      long	line;
+      int	diff_type;
+      diff_hunk	hunk;
+
+      /*
+       * Read the first two values - if there aren't any then we've
+       * reached the end of the file.  These values refer to the
+       * first file so we're only interested in them for deleting lines.
+       */
+      if (read_values(stream, &delete_start, &delete_end) == 0) break;
+
+      /*
+       * Calculate the number of lines deleted.
+       * If delete start and delete end are the same then 1 line has been
+       * deleted... i.e. one more than the difference.
+       */
+      hunk.lines_deleted = delete_end - delete_start + 1;
+
+      diff_type = getc(stream);	/* a=add, d=del, c=change */
+
+      switch (diff_type)
+	{
+	case 'a':
+	case 'd':
+	case 'c':
+	  break;
+	default:
+	  fprintf(stderr, gettext(CMD_NAME ": warning, bad diffs stream format char %c!\n"), diff_type);
+	  return;
+	}
+
+      /* Same as before, only for new version of file */
+      if (read_values(stream, &hunk.start_line, &hunk.end_line) == 0)
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": warning, bad diffs stream format!\n"));
+	  return;
+	}
+      hunk.lines_added = hunk.end_line - hunk.start_line + 1;
+
+      if (diff_type == 'a') hunk.lines_deleted = 0;
+      if (diff_type == 'd')
+	{
+	  hunk.lines_added = 0;
+	  /*
+	   * deleted lines are actually *after* the specified line,
+	   * so we need to pretend they're one line later...
+	   */
+	  hunk.start_line += 1;
+	  hunk.end_line += 1;
+	}
+      /* Skip to the end of the line */
+      if (!skip_line(stream)) break;
+
+      /*
+       * Keep the deleted lines, without their "< "
+       */
+      hunk.deleted_offset = diffs->deleted_size;
+      for (line = 0; line < hunk.lines_deleted; line++)
+	{
+	  if ((getc(stream) != '<') || (getc(stream) != ' '))
+	    {
+	      fprintf(stderr, gettext(CMD_NAME ": diffs stream in unexpected format\n"));
+	      exit(2);
+	    }
+	  keep_line(stream, &diffs->deleted_text, &diffs->deleted_size, &deleted_text_size);
+	}
+
+      /* Skip over the line of ---- and the added lines */
+      if ((hunk.lines_deleted > 0) && (hunk.lines_added > 0)) skip_line(stream);
+      hunk.added_offset = diffs->added_size;
+      for (line = 0; line < hunk.lines_added; line++)
+	{
+	  /* Only a change has lines to pair up */
+	  if (word_diff && (hunk.lines_deleted > 0))
+	    {
+	      /*
+	       * Keep every line, so that they stay in step with the
+	       * deleted ones, even if the "> " is cut short
+	       */
+	      int next_char = getc(stream);
+
+	      if (next_char == '>')
+		next_char = getc(stream);
+	      if ((next_char != ' ') && (next_char != EOF))
+		ungetc(next_char, stream);
+	      keep_line(stream, &diffs->added_text, &diffs->added_size, &added_text_size);
+	    }
+	  else
+	    skip_line(stream);
+	}
+
+      if ((size_t)diffs->no_of_hunks == hunks_size)
+	{
+	  hunks_size = (hunks_size == 0) ? 16 : hunks_size * 2;
+	  diffs->hunks = xrealloc(diffs->hunks, hunks_size * sizeof(diff_hunk));
+	}
+      diffs->hunks[diffs->no_of_hunks++] = hunk;
+    }
+}
+
+/*
+ * Function:
+ *	init_diffs
+ *
+ * Starts on the differences for the file with number file, if there
+ * are any.
+ */
+void
+init_diffs(unsigned int file)
+
+{
+  if ((all_diffs == NULL) || (file >= no_of_diffs))
+    {
+      /* turn off diffs and return */
       diffs_on = FALSE;
       return;
     }
-  lines_added = diff_end_line - diff_start_line + 1;
 
-  if (diff_type == 'a') lines_deleted = 0;
-  if (diff_type == 'd')
+  current_diffs = &all_diffs[file];
+  next_hunk = 0;
+  next_deleted_char = current_diffs->deleted_text;
+  diffs_on = TRUE;
+
+  parse_line();
+}
+
+/*
+ * Function:
+ *	parse_line
+ *
+ * Moves on to the next hunk, with its start and end line numbers
+ * in the new file and the numbers of lines deleted and added.
+ */
+void
+parse_line(void)
+
+{
+  diff_hunk *hunk;
+
+  if (next_hunk == current_diffs->no_of_hunks)
     {
-      lines_added = 0;
-      /*
-       * deleted lines are actually *after* the specified line,
-       * so we need to pretend they're one line later...
-       */
-      diff_start_line += 1;
-      diff_end_line += 1;
+      diffs_on = FALSE;
+      return;
     }
-  /* Skip to the end of the line */
-  while (getc(diffs_stream) != '\n')
-    ;
+
+  hunk = &current_diffs->hunks[next_hunk++];
+  current_hunk = hunk;
+  pair_deleted = (current_diffs->deleted_text != NULL)
+    ? current_diffs->deleted_text + hunk->deleted_offset : NULL;
+  pair_added = (current_diffs->added_text != NULL)
+    ? current_diffs->added_text + hunk->added_offset : NULL;
+  diff_start_line = hunk->start_line;
+  diff_end_line = hunk->end_line;
+  lines_deleted = hunk->lines_deleted;
+  lines_added = hunk->lines_added;
 }
 
 /*
  * Function:
  *	end_diffs
  *
- * Finish off the diffs system:
- * - close the diffs stream (i.e. kill off the diff process);
+ * Finish off the diffs for the current file.  The table is kept for
+ * the next pass.
  */
 
 void
 end_diffs(void)
 
 {
-  if (!diffs_on) return;
-
   dm('d',3,"diffs: closing diffs\n");
 
-  fclosepipe(diffs_stream);
-  diffs_stream = NULL;
+  diffs_on = FALSE;
+  current_diffs = NULL;
 }
 
 /*
@@ -329,7 +800,7 @@ get_diff_char(char *input_char, char_status *status)
 
 {
   *status = CHAR_NORMAL;
-  *input_char = (char)getc(diffs_stream);
+  *input_char = *next_deleted_char++;
   return(STREAM_OK);
 }
 
@@ -358,33 +829,30 @@ getdelline(long current_line, char *input_line, char_status input_status[])
     return(FALSE);
 
   /*
-   * First skip the first two characters of the line -
-   * they should be "< "
+   * The deleted line pairs up with the added line in the same place,
+   * if there is one
    */
-  if ((getc(diffs_stream)!='<') || (getc(diffs_stream)!=' '))
+  pair_line = NULL;
+  if (word_diff && (current_hunk->lines_deleted - lines_deleted < lines_added))
     {
-      fprintf(stderr, gettext(CMD_NAME ": diffs stream in unexpected format\n"));
-      exit(2);
+      pair_line = take_line(&pair_added, current_diffs->added_text + current_diffs->added_size);
+      pair_is_old = FALSE;
     }
-  /* Read in the next line from diff stream */
+
+  /* Read in the next deleted line */
   getnextline(get_diff_char,&blank_line,input_line,input_status);
 
   lines_deleted -= 1;
-  if (lines_deleted == 0)
-    {
-      /*
-       * If there are lines added then this is a "change" and
-       * the added lines will be dealt with by line_inserted().
-       * Otherwise we need to find the next difference with
-       * parse_line().
-       */
-      if (lines_added == 0)
-	parse_line();
-      else
-	/* else skip over line of ---- */
-	while (getc(diffs_stream) != '\n')
-	  ;
-    }
+
+  /*
+   * If there are lines added then this is a "change" and
+   * the added lines will be dealt with by line_inserted().
+   * Otherwise we need to find the next difference with
+   * parse_line().
+   */
+  if ((lines_deleted == 0) && (lines_added == 0))
+    parse_line();
+
   return(TRUE);
 }
 
@@ -402,18 +870,254 @@ line_inserted(long current_line)
 
 {
   boolean	retval = FALSE;
+  pair_line = NULL;
   if (!diffs_on) return(FALSE);
   if ((current_line >= diff_start_line)
       && (current_line <= diff_end_line))
     {
-      /* skip over line */
-      while (getc(diffs_stream) != '\n')
-	;
       retval = TRUE;
+      if (word_diff && (current_line - diff_start_line < current_hunk->lines_deleted))
+	{
+	  pair_line = take_line(&pair_deleted, current_diffs->deleted_text + current_diffs->deleted_size);
+	  pair_is_old = TRUE;
+	}
     }
   /* If reached the end of the insertion... */
   if (current_line >= diff_end_line) parse_line();
   return(retval);
 }
 
-#endif
+/*
+ * Function:
+ *	diffs_wanted
+ *
+ * Returns TRUE if diffs have been asked for, even if there turn out to
+ * be none for a particular file.
+ */
+
+boolean
+diffs_wanted(void)
+
+{
+  return ((diffs_string != NULL) || (patch_filename != NULL) || (diffs_revision != NULL));
+}
+
+/*
+ * Function:
+ *	get_pair_char
+ *
+ * Like get_diff_char(), for the line paired with the current one.
+ */
+stream_status
+get_pair_char(char *input_char, char_status *status)
+
+{
+  *status = CHAR_NORMAL;
+  *input_char = *next_pair_char++;
+  return(STREAM_OK);
+}
+
+/*
+ * Function:
+ *	split_words
+ *
+ * Splits a line into words: each run of letters, digits and
+ * underscores, each run of white space, and each other character
+ * on its own.  Returns the number of words.
+ */
+static int
+split_words(const char *line, word words[])
+
+{
+  int		no_of_words = 0;
+  const char	*next = line;
+
+  while (*next != '\0')
+    {
+      const char *start = next;
+
+      if (isalnum((unsigned char)*next) || (*next == '_'))
+	while (isalnum((unsigned char)*next) || (*next == '_')) next++;
+      else if (isspace((unsigned char)*next))
+	while ((*next != '\0') && isspace((unsigned char)*next)) next++;
+      else
+	next++;
+
+      words[no_of_words].start = start;
+      words[no_of_words].length = (int)(next - start);
+      no_of_words++;
+    }
+
+  return no_of_words;
+}
+
+/*
+ * Function:
+ *	diff_words
+ *
+ * Finds the shortest set of words to delete from old_words and add
+ * from new_words, with Myers' greedy algorithm, and marks their
+ * characters in old_changed[] and new_changed[].  furthest[d] holds,
+ * for each diagonal k, the furthest x reached with d edits, which is
+ * what is needed to trace the edits back.  Returns FALSE if it
+ * takes more than MAX_WORD_EDITS edits.
+ */
+#define SAME_WORD(x, y) \
+  ((old_words[x].length == new_words[y].length) \
+   && (memcmp(old_words[x].start, new_words[y].start, (size_t)old_words[x].length) == 0))
+
+static boolean
+diff_words(const word *old_words, int no_of_old,
+	   const word *new_words, int no_of_new,
+	   boolean old_changed[], boolean new_changed[])
+
+{
+  static int	furthest[MAX_WORD_EDITS + 1][2 * MAX_WORD_EDITS + 3];
+  int		edits;
+  int		x = 0, y = 0;
+
+  for (edits = 0; edits <= MAX_WORD_EDITS; edits++)
+    {
+      int diagonal;
+
+      for (diagonal = -edits; diagonal <= edits; diagonal += 2)
+	{
+	  int *previous = furthest[(edits > 0) ? edits - 1 : 0] + MAX_WORD_EDITS + 1;
+
+	  /*
+	   * Step down (add a word) or right (delete a word) from
+	   * whichever neighbouring diagonal has got further
+	   */
+	  if (edits == 0)
+	    x = 0;
+	  else if ((diagonal == -edits)
+		   || ((diagonal != edits) && (previous[diagonal - 1] < previous[diagonal + 1])))
+	    x = previous[diagonal + 1];
+	  else
+	    x = previous[diagonal - 1] + 1;
+	  y = x - diagonal;
+
+	  while ((x < no_of_old) && (y < no_of_new) && SAME_WORD(x, y))
+	    {
+	      x++;
+	      y++;
+	    }
+	  furthest[edits][diagonal + MAX_WORD_EDITS + 1] = x;
+
+	  if ((x >= no_of_old) && (y >= no_of_new)) break;
+	}
+      if ((x >= no_of_old) && (y >= no_of_new)) break;
+    }
+
+  if (edits > MAX_WORD_EDITS) return FALSE;
+
+  /*
+   * Trace the edits back from the end
+   */
+  x = no_of_old;
+  y = no_of_new;
+  for (; edits > 0; edits--)
+    {
+      int *previous = furthest[edits - 1] + MAX_WORD_EDITS + 1;
+      int diagonal = x - y;
+      int character;
+
+      if ((diagonal == -edits)
+	  || ((diagonal != edits) && (previous[diagonal - 1] < previous[diagonal + 1])))
+	{
+	  x = previous[diagonal + 1];
+	  y = x - (diagonal + 1);
+	  for (character = 0; character < new_words[y].length; character++)
+	    new_changed[new_words[y].start - new_words[0].start + character] = TRUE;
+	}
+      else
+	{
+	  x = previous[diagonal - 1];
+	  y = x - (diagonal - 1);
+	  for (character = 0; character < old_words[x].length; character++)
+	    old_changed[old_words[x].start - old_words[0].start + character] = TRUE;
+	}
+    }
+
+  return TRUE;
+}
+
+/*
+ * Function:
+ *	changed_words
+ *
+ * For --word-diff, marks in changed[] the characters of input_line,
+ * the deleted or added line about to be printed, that are in words that
+ * differ from the line it is paired with.  Returns FALSE if the whole
+ * line should be marked, because it isn't paired with another line or
+ * less than half of the two lines, not counting white space, is the
+ * same.  White space between two changed words is marked as well.
+ */
+boolean
+changed_words(char input_line[], boolean changed[])
+
+{
+  static char		pair_text[MAXLINELENGTH];
+  static char_status	pair_status[MAXLINELENGTH];
+  static word		input_words[MAXLINELENGTH];
+  static word		pair_words[MAXLINELENGTH];
+  static boolean	pair_changed[MAXLINELENGTH];
+  int			no_of_input_words;
+  int			no_of_pair_words;
+  boolean		blank_line;
+  boolean		same;
+  int			same_chars = 0;
+  int			all_chars = 0;
+  int			index;
+
+  if (pair_line == NULL) return FALSE;
+
+  next_pair_char = pair_line;
+  getnextline(get_pair_char, &blank_line, pair_text, pair_status);
+
+  no_of_input_words = split_words(input_line, input_words);
+  no_of_pair_words = split_words(pair_text, pair_words);
+  memset(changed, 0, (strlen(input_line) + 1) * sizeof(boolean));
+  memset(pair_changed, 0, (strlen(pair_text) + 1) * sizeof(boolean));
+
+  if ((no_of_input_words == 0) || (no_of_pair_words == 0)) return FALSE;
+
+  if (pair_is_old)
+    same = diff_words(pair_words, no_of_pair_words, input_words, no_of_input_words,
+		      pair_changed, changed);
+  else
+    same = diff_words(input_words, no_of_input_words, pair_words, no_of_pair_words,
+		      changed, pair_changed);
+  if (!same) return FALSE;
+
+  for (index = 0; input_line[index] != '\0'; index++)
+    if (!isspace((unsigned char)input_line[index]))
+      {
+	all_chars++;
+	if (!changed[index]) same_chars++;
+      }
+  for (index = 0; pair_text[index] != '\0'; index++)
+    if (!isspace((unsigned char)pair_text[index]))
+      {
+	all_chars++;
+	if (!pair_changed[index]) same_chars++;
+      }
+  if (same_chars * 2 < all_chars) return FALSE;
+
+  for (index = 1; index < no_of_input_words - 1; index++)
+    {
+      int offset = (int)(input_words[index].start - input_line);
+
+      if (isspace((unsigned char)*input_words[index].start)
+	  && changed[offset - 1]
+	  && changed[offset + input_words[index].length])
+	{
+	  int character;
+
+	  for (character = 0; character < input_words[index].length; character++)
+	    changed[offset + character] = TRUE;
+	}
+    }
+
+  return TRUE;
+}
@@ -4,7 +4,10 @@
  */
 
 extern void	setup_diffs(void);
-extern void	init_diffs(char newfile[]);
+extern void	compute_diffs(char *files[]);
+extern void	init_diffs(unsigned int file);
 extern void	end_diffs(void);
 extern boolean	getdelline(long current_line, char *input_line, char_status input_status[]);
 extern boolean	line_inserted(long current_line);
+extern boolean	diffs_wanted(void);
+extern boolean	changed_words(char input_line[], boolean changed[]);
@@ -0,0 +1,249 @@
+/*
+ * Source file:
+ *	encode.c
+ *
+ * Encoders for compressed postscript output: LZW compression as
+ * understood by the level 2 LZWDecode filter, and ASCII base-85 so
+ * that the result can be sent as plain text.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trueprint.h"
+#include "utils.h"
+#include "debug.h"
+
+#include "encode.h"
+
+/*
+ * Private part
+ */
+#define LZW_CLEAR	256
+#define LZW_EOD		257
+#define LZW_FIRST_CODE	258
+#define LZW_MAX_BITS	12
+#define LZW_TABLE_FULL	4094	/* clear before the table reaches 4096 codes */
+#define LZW_HASH_SIZE	5003	/* prime, comfortably more than 4096 */
+
+#define A85_LINE_LEN	72
+
+typedef struct {
+  unsigned char	*data;
+  size_t	size;
+  size_t	used;
+  unsigned long	bits;
+  int		no_of_bits;
+} bit_buffer;
+
+static void put_code(bit_buffer *, unsigned int code, int width);
+static void flush_bits(bit_buffer *);
+
+/*****************************************************************************
+ * Function:
+ *	put_code
+ *
+ * Appends a code to the output, most significant bit first.
+ */
+static void
+put_code(bit_buffer *out, unsigned int code, int width)
+
+{
+  out->bits = (out->bits << width) | code;
+  out->no_of_bits += width;
+
+  while (out->no_of_bits >= 8)
+    {
+      if (out->used == out->size)
+	{
+	  out->size = (out->size == 0) ? 4096 : out->size * 2;
+	  out->data = xrealloc(out->data, out->size);
+	}
+      out->no_of_bits -= 8;
+      out->data[out->used++] = (unsigned char)(out->bits >> out->no_of_bits);
+    }
+  out->bits &= (1UL << out->no_of_bits) - 1;
+}
+
+/*****************************************************************************
+ * Function:
+ *	flush_bits
+ *
+ * Pads out the last byte with zeros.
+ */
+static void
+flush_bits(bit_buffer *out)
+
+{
+  if (out->no_of_bits > 0)
+    put_code(out, 0, 8 - out->no_of_bits);
+}
+
+/*****************************************************************************
+ * Function:
+ *	lzw_encode
+ *
+ * Compresses length bytes of data into a buffer allocated with xmalloc,
+ * returning its length in *encoded_length.  The codes follow the
+ * LZWDecode filter with its default EarlyChange of 1: they start at 9
+ * bits and widen as soon as the table has an entry that needs the
+ * extra bit.
+ *
+ * The string table is an open hash table keyed on (prefix code, next
+ * character).
+ */
+unsigned char *
+lzw_encode(const unsigned char *data, size_t length, size_t *encoded_length)
+
+{
+  static long		hash_keys[LZW_HASH_SIZE];
+  static unsigned short	hash_codes[LZW_HASH_SIZE];
+  bit_buffer	out;
+  unsigned int	next_code = LZW_FIRST_CODE;
+  int		width = 9;
+  unsigned int	prefix;
+  size_t	data_index;
+
+  out.data = NULL;
+  out.size = 0;
+  out.used = 0;
+  out.bits = 0;
+  out.no_of_bits = 0;
+
+  memset(hash_keys, -1, sizeof(hash_keys));
+
+  put_code(&out, LZW_CLEAR, width);
+
+  if (length > 0)
+    {
+      prefix = data[0];
+
+      for (data_index = 1; data_index < length; data_index++)
+	{
+	  unsigned int	character = data[data_index];
+	  long		key = ((long)prefix << 8) | character;
+	  size_t	slot = (size_t)key % LZW_HASH_SIZE;
+
+	  while ((hash_keys[slot] != -1) && (hash_keys[slot] != key))
+	    slot = (slot + 1) % LZW_HASH_SIZE;
+
+	  if (hash_keys[slot] == key)
+	    {
+	      prefix = hash_codes[slot];
+	      continue;
+	    }
+
+	  put_code(&out, prefix, width);
+
+	  hash_keys[slot] = key;
+	  hash_codes[slot] = next_code++;
+
+	  if (next_code == LZW_TABLE_FULL)
+	    {
+	      put_code(&out, LZW_CLEAR, width);
+	      memset(hash_keys, -1, sizeof(hash_keys));
+	      next_code = LZW_FIRST_CODE;
+	      width = 9;
+	    }
+	  else if ((next_code >= (1U << width)) && (width < LZW_MAX_BITS))
+	    width++;
+
+	  prefix = character;
+	}
+
+      put_code(&out, prefix, width);
+
+      /*
+       * The decoder adds a table entry after this last code as well, so
+       * it may widen the code for EOD
+       */
+      next_code++;
+      if (next_code == LZW_TABLE_FULL)
+	{
+	  put_code(&out, LZW_CLEAR, width);
+	  width = 9;
+	}
+      else if ((next_code >= (1U << width)) && (width < LZW_MAX_BITS))
+	width++;
+    }
+
+  put_code(&out, LZW_EOD, width);
+  flush_bits(&out);
+
+  dm('O',3,"encode.c:lzw_encode() %lu bytes to %lu bytes\n",
+     (unsigned long)length, (unsigned long)out.used);
+
+  *encoded_length = out.used;
+  return out.data;
+}
+
+/*****************************************************************************
+ * Function:
+ *	ascii85_write
+ *
+ * Writes data to stream in ASCII base-85, followed by the ~> end of
+ * data marker.  Lines never start with a %, so that nothing in the data
+ * can be mistaken for a document structuring comment.
+ */
+void
+ascii85_write(FILE *stream, const unsigned char *data, size_t length)
+
+{
+  size_t	data_index = 0;
+  int		line_length = 0;
+
+  while (data_index < length)
+    {
+      char		group[5];
+      int		group_length;
+      int		group_index;
+      size_t		bytes = length - data_index;
+      unsigned long	value = 0;
+
+      if (bytes > 4) bytes = 4;
+
+      for (group_index = 0; group_index < 4; group_index++)
+	{
+	  value <<= 8;
+	  if ((size_t)group_index < bytes)
+	    value |= data[data_index + group_index];
+	}
+      data_index += bytes;
+
+      if ((value == 0) && (bytes == 4))
+	{
+	  group[0] = 'z';
+	  group_length = 1;
+	}
+      else
+	{
+	  for (group_index = 4; group_index >= 0; group_index--)
+	    {
+	      group[group_index] = (char)('!' + (value % 85));
+	      value /= 85;
+	    }
+	  group_length = (int)bytes + 1;
+	}
+
+      for (group_index = 0; group_index < group_length; group_index++)
+	{
+	  if (line_length >= A85_LINE_LEN)
+	    {
+	      putc('\n', stream);
+	      line_length = 0;
+	    }
+	  if ((line_length == 0) && (group[group_index] == '%'))
+	    {
+	      putc(' ', stream);
+	      line_length++;
+	    }
+	  putc(group[group_index], stream);
+	  line_length++;
+	}
+    }
+
+  fputs("~>\n", stream);
+}
@@ -0,0 +1,7 @@
+/*
+ * Include file:
+ *	encode.h
+ */
+
+extern unsigned char *lzw_encode(const unsigned char *data, size_t length, size_t *encoded_length);
+extern void ascii85_write(FILE *stream, const unsigned char *data, size_t length);
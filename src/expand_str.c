@@ -32,58 +32,253 @@
 /*
  * Private part
  */
+
+/*
+ * A template is compiled into a list of fields.  Each field is either a
+ * literal string or one of the escapes that changes from page to page;
+ * escapes that can't change during a run, such as the date or the login
+ * name, are folded into the literals when the template is compiled.
+ */
+#define MAX_TEMPLATES	16
+
+typedef struct {
+  char		escape;		/* '\0' for a literal */
+  size_t	literal_start;
+  size_t	literal_length;
+} template_field;
+
+typedef struct {
+  char		*original;	/* the string this was compiled from */
+  char		*source;	/* a copy, to check that it hasn't changed */
+  char		*literals;
+  size_t	literals_size;
+  template_field *fields;
+  unsigned int	no_of_fields;
+  char		*buffer;	/* the last expansion */
+  size_t	buffer_size;
+} template;
+
+static template	templates[MAX_TEMPLATES];
+static unsigned int no_of_templates = 0;
+static unsigned int next_template = 0;
+
 static char *expand_character(char,boolean);
-static void add_string(char **, char *, size_t *);
-static void add_character(char **, char, size_t *);
+static template *compile_template(char *);
+static void add_literal(template *, char *);
+static boolean dynamic_escape(char);
 
 /*****************************************************************************
  * Function:
  *	expand_string
+ *
+ * Returns original_string with all the %-escapes expanded.  The result
+ * stays valid until the same string is next expanded.
  */
 char *
 expand_string(char *original_string, boolean index_page)
 
 {
-  static char *output_buffer=NULL;
-  static size_t buffer_size = 100;
-  char *current_char;
+  static char	empty_string[] = "";
+  template	*current;
+  size_t	length = 0;
+  unsigned int	field;
 
-  if (original_string)
-    dm('h', 5, "expand_string.c:expand_string() Expanding string %s\n", original_string);
-  else
-    dm('h', 5, "expand_string.c:expand_string() Expanding null string\n");
+  if (original_string == NULL)
+    {
+      dm('h', 5, "expand_string.c:expand_string() Expanding null string\n");
+      return empty_string;
+    }
+
+  dm('h', 5, "expand_string.c:expand_string() Expanding string %s\n", original_string);
 
   /*
-   * Initialize output buffer
+   * Nothing to expand
    */
-  if (output_buffer == NULL)
-    output_buffer = xmalloc(100);
+  if (strchr(original_string, '%') == NULL)
+    return original_string;
 
-  *output_buffer = '\0';
+  current = compile_template(original_string);
 
-  if (original_string)
+  /*
+   * Work out how much room is needed...
+   */
+  for (field = 0; field < current->no_of_fields; field++)
     {
-      /*
-       * Run through input string, expanding characters as necessary
-       */
-      for (current_char = original_string; *current_char; current_char++)
+      if (current->fields[field].escape == '\0')
+	length += current->fields[field].literal_length;
+      else
+	length += strlen(expand_character(current->fields[field].escape, index_page));
+    }
+
+  if (length + 1 > current->buffer_size)
+    {
+      current->buffer_size = length + 1;
+      current->buffer = xrealloc(current->buffer, current->buffer_size);
+    }
+
+  /*
+   * ...and fill in the fields
+   */
+  length = 0;
+  for (field = 0; field < current->no_of_fields; field++)
+    {
+      char	*field_string;
+      size_t	field_length;
+
+      if (current->fields[field].escape == '\0')
 	{
-	  if (*current_char != '%')
-	    {
-	      add_character(&output_buffer, *current_char, &buffer_size);
-	      continue;
-	    }
-	  add_string(&output_buffer, expand_character(*++current_char,index_page), &buffer_size);
+	  field_string = current->literals + current->fields[field].literal_start;
+	  field_length = current->fields[field].literal_length;
 	}
+      else
+	{
+	  field_string = expand_character(current->fields[field].escape, index_page);
+	  field_length = strlen(field_string);
+	}
+      memcpy(current->buffer + length, field_string, field_length);
+      length += field_length;
+    }
+  current->buffer[length] = '\0';
+
+  dm('h', 5, "expand_string.c:expand_string Returning string %s\n", current->buffer);
+
+  return current->buffer;
+}
+
+/*****************************************************************************
+ * Function:
+ *	compile_template
+ *
+ * Finds the compiled form of a string, compiling it if it hasn't been
+ * seen before.  Only a handful of different strings are ever expanded,
+ * so the oldest one is reused if the table is full.
+ */
+static template *
+compile_template(char *original_string)
+
+{
+  template	*current;
+  char		*current_char;
+  unsigned int	template_index;
+
+  for (template_index = 0; template_index < no_of_templates; template_index++)
+    {
+      current = &templates[template_index];
+      if ((current->original == original_string)
+	  && (strcmp(current->source, original_string) == 0))
+	return current;
+    }
+
+  if (no_of_templates < MAX_TEMPLATES)
+    {
+      current = &templates[no_of_templates++];
+      current->buffer = NULL;
+      current->buffer_size = 0;
     }
   else
     {
-      *output_buffer = '\0';
+      current = &templates[next_template];
+      next_template = (next_template + 1) % MAX_TEMPLATES;
+      free(current->source);
+      free(current->literals);
+      free(current->fields);
     }
 
-  dm('h', 5, "expand_string.c:expand_string Returning string %s\n", output_buffer);
+  dm('h', 4, "expand_string.c:compile_template() Compiling %s\n", original_string);
+
+  current->original = original_string;
+  current->source = strdup(original_string);
+  current->literals = NULL;
+  current->literals_size = 0;
+  current->no_of_fields = 0;
+
+  /* There can't be more fields than characters */
+  current->fields = xmalloc((strlen(original_string) + 1) * sizeof(template_field));
+
+  for (current_char = original_string; *current_char; current_char++)
+    {
+      char	escape;
+
+      if (*current_char != '%')
+	{
+	  char	literal[2];
+
+	  literal[0] = *current_char;
+	  literal[1] = '\0';
+	  add_literal(current, literal);
+	  continue;
+	}
 
-  return output_buffer;
+      escape = *++current_char;
+
+      if (dynamic_escape(escape))
+	{
+	  current->fields[current->no_of_fields].escape = escape;
+	  current->no_of_fields += 1;
+	}
+      else
+	add_literal(current, expand_character(escape, FALSE));
+
+      /* A trailing % expands to ? and ends the string */
+      if (escape == '\0') break;
+    }
+
+  return current;
+}
+
+/*****************************************************************************
+ * Function:
+ *	add_literal
+ *
+ * Adds a literal string to a template, running it on from the previous
+ * field if that was a literal too.
+ */
+static void
+add_literal(template *current, char *string)
+
+{
+  size_t	length = strlen(string);
+  template_field *last_field;
+
+  if (length == 0) return;
+
+  current->literals = xrealloc(current->literals, current->literals_size + length);
+  memcpy(current->literals + current->literals_size, string, length);
+
+  if ((current->no_of_fields > 0)
+      && (current->fields[current->no_of_fields-1].escape == '\0'))
+    {
+      last_field = &current->fields[current->no_of_fields-1];
+      last_field->literal_length += length;
+    }
+  else
+    {
+      last_field = &current->fields[current->no_of_fields++];
+      last_field->escape = '\0';
+      last_field->literal_start = current->literals_size;
+      last_field->literal_length = length;
+    }
+
+  current->literals_size += length;
+}
+
+/*****************************************************************************
+ * Function:
+ *	dynamic_escape
+ *
+ * Is this an escape whose expansion can change from page to page?
+ */
+static boolean
+dynamic_escape(char character)
+
+{
+  switch (character)
+    {
+    case 'p': case 'P': case 'f': case 'c': case 'C': case 'F': case 'n': case 'N':
+      return TRUE;
+    default:
+      return FALSE;
+    }
 }
 
 /*****************************************************************************
@@ -107,17 +302,23 @@ expand_character(char character, boolean index_page)
    */
   if (t == NULL)
     {
+      /*
+       * Take a copy - localtime() is also used for file modified times
+       * and would overwrite it.
+       */
+      static struct tm now_tm;
       time_t now;
       if (!use_environment)
 	{
 	  now = 387774000;
-	  t = gmtime(&now);
+	  now_tm = *gmtime(&now);
 	}
       else
 	{
 	  now = time((time_t *)NULL);
-	  t = localtime(&now);
+	  now_tm = *localtime(&now);
 	}
+      t = &now_tm;
     }
 
   /*
@@ -225,38 +426,3 @@ expand_character(char character, boolean index_page)
       return "?";
     }
 }
-
-static void
-add_string(char **buffer_ptr, char *string, size_t *bufflen_ptr)
-
-{
-  size_t required_length;
-
-  required_length = strlen(*buffer_ptr)+strlen(string)+1;
-
-  if (required_length > *bufflen_ptr)
-    {
-      *buffer_ptr = xrealloc(*buffer_ptr, required_length);
-      *bufflen_ptr = required_length;
-    }
-  strcat(*buffer_ptr, string);
-  return;
-}
-
-static void
-add_character(char **buffer_ptr, char character, size_t *bufflen_ptr)
-
-{
-  size_t required_length;
-
-  required_length = strlen(*buffer_ptr)+2;
-
-  if (required_length > *bufflen_ptr)
-    {
-      *buffer_ptr = xrealloc(*buffer_ptr, required_length);
-      *bufflen_ptr = required_length;
-    }
-  (*buffer_ptr)[required_length-1] = '\0';
-  (*buffer_ptr)[required_length-2] = character;
-  return;
-}
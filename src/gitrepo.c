@@ -0,0 +1,1210 @@
+/*
+ * Source file:
+ *	gitrepo.c
+ *
+ * Reads the version of a file at a given revision straight from the
+ * object database of the git repository the file is in, so that
+ * --diff-revision doesn't need a second checkout.  Both loose objects
+ * and packs, including deltas, are read; inflate.c decompresses them.
+ *
+ * A revision is a full or abbreviated object name, HEAD, or the name
+ * of a branch or tag, optionally followed by ~<n> or ^<n> to go back
+ * through the first or <n>th parents.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#ifndef MSWIN
+# include <sys/mman.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int close(int fildes);
+extern int read(int fildes, void *buf, size_t nbyte);
+#endif
+
+#ifndef O_RDONLY
+# define O_RDONLY 0
+#endif
+
+#include "trueprint.h"
+#include "utils.h"
+#include "debug.h"
+#include "inflate.h"
+
+#include "gitrepo.h"
+
+/*
+ * Private part
+ */
+#define SHA_LENGTH	20
+#define HEX_LENGTH	40
+#define MAX_REF_DEPTH	8
+#define MAX_DELTA_DEPTH	10000
+#define MAX_LINE	1024
+
+typedef enum {
+  OBJ_NONE = 0,
+  OBJ_COMMIT = 1,
+  OBJ_TREE = 2,
+  OBJ_BLOB = 3,
+  OBJ_TAG = 4,
+  OBJ_OFS_DELTA = 6,
+  OBJ_REF_DELTA = 7
+} object_type;
+
+typedef struct pack_file {
+  unsigned char		*index;
+  size_t		index_size;
+  unsigned char		*pack;
+  size_t		pack_size;
+  unsigned long		no_of_objects;
+  int			index_version;
+  struct pack_file	*next;
+} pack_file;
+
+/*
+ * Trees are looked at once for every file printed from them, so they
+ * are kept.
+ */
+typedef struct tree_entry {
+  unsigned char		sha[SHA_LENGTH];
+  unsigned char		*data;
+  size_t		size;
+  struct tree_entry	*next;
+} tree_entry;
+
+typedef struct {
+  char		*work_tree;	/* absolute, without a trailing / */
+  char		*git_dir;	/* HEAD lives here */
+  char		*common_dir;	/* objects and refs live here */
+  pack_file	*packs;
+  boolean	packs_read;
+  tree_entry	*trees;
+  unsigned char	root_tree[SHA_LENGTH];
+  boolean	have_root_tree;
+} repository;
+
+static repository	*repositories;
+static size_t		no_of_repositories;
+
+static char *absolute_path(const char *filename);
+static char *read_small_file(const char *filename);
+static repository *find_repository(const char *path);
+static void map_file(const char *filename, unsigned char **data, size_t *size);
+static void read_packs(repository *repo);
+static unsigned long get_be32(const unsigned char *bytes);
+static boolean find_in_pack(pack_file *pack, const unsigned char *sha, size_t *offset);
+static boolean read_packed_object(repository *repo, pack_file *pack, size_t offset, int depth,
+				  object_type *type, unsigned char **data, size_t *size);
+static boolean apply_delta(const unsigned char *base, size_t base_size,
+			   const unsigned char *delta, size_t delta_size,
+			   unsigned char **result, size_t *result_size);
+static boolean read_loose_object(repository *repo, const unsigned char *sha,
+				 object_type *type, unsigned char **data, size_t *size);
+static boolean read_object(repository *repo, const unsigned char *sha, int depth,
+			   object_type *type, unsigned char **data, size_t *size);
+static boolean hex_to_sha(const char *hex, unsigned char *sha);
+static void sha_to_hex(const unsigned char *sha, char *hex);
+static boolean find_abbreviated(repository *repo, const char *hex, unsigned char *sha);
+static boolean resolve_ref(repository *repo, const char *name, int depth, unsigned char *sha);
+static boolean resolve_name(repository *repo, const char *name, unsigned char *sha);
+static boolean commit_field(repository *repo, const unsigned char *sha, const char *field,
+			    int which, unsigned char *result);
+static void resolve_revision(repository *repo, const char *revision);
+static tree_entry *read_tree(repository *repo, const unsigned char *sha);
+
+/******************************************************************************
+ * Function:
+ *	absolute_path
+ *
+ * Makes filename absolute and takes out any . and .. components, so
+ * that it can be compared with the top of a work tree.
+ */
+static char *
+absolute_path(const char *filename)
+{
+  char		*cwd;
+  char		*path;
+  char		*component;
+  char		*end;
+  char		*out;
+
+  if (filename[0] == '/')
+    cwd = NULL;
+  else if ((cwd = current_directory()) == NULL)
+    {
+      perror(CMD_NAME ": cannot find current directory");
+      exit(1);
+    }
+
+  path = xmalloc((cwd ? strlen(cwd) : 0) + strlen(filename) + 2);
+  sprintf(path, "%s/%s", cwd ? cwd : "", filename);
+  free(cwd);
+
+  /*
+   * Copy a component at a time, dropping . and backing up over ..
+   */
+  out = path;
+  for (component = path; *component != '\0'; component = end)
+    {
+      size_t length;
+
+      while (*component == '/') component++;
+      for (end = component; (*end != '\0') && (*end != '/'); end++)
+	;
+      length = end - component;
+
+      if ((length == 0) || ((length == 1) && (component[0] == '.')))
+	continue;
+      if ((length == 2) && (component[0] == '.') && (component[1] == '.'))
+	{
+	  while ((out > path) && (*--out != '/'))
+	    ;
+	  continue;
+	}
+      *out++ = '/';
+      memmove(out, component, length);
+      out += length;
+    }
+  if (out == path) *out++ = '/';
+  *out = '\0';
+
+  return path;
+}
+
+/******************************************************************************
+ * Function:
+ *	read_small_file
+ *
+ * Returns the first line of a file such as HEAD or a loose ref, without
+ * its newline, or NULL if there isn't one.
+ */
+static char *
+read_small_file(const char *filename)
+{
+  FILE	*stream;
+  char	line[MAX_LINE];
+
+  if ((stream = fopen(filename, "r")) == NULL) return NULL;
+  if (fgets(line, sizeof(line), stream) == NULL)
+    {
+      fclose(stream);
+      return NULL;
+    }
+  fclose(stream);
+
+  line[strcspn(line, "\r\n")] = '\0';
+  return strdup(line);
+}
+
+/******************************************************************************
+ * Function:
+ *	find_repository
+ *
+ * Finds the repository for the file with absolute name path, by looking
+ * for .git in the directories above it.  .git may be a file pointing at
+ * the real directory, as in a linked work tree.
+ */
+static repository *
+find_repository(const char *path)
+{
+  char		*directory = strdup(path);
+  char		*slash;
+  char		*dot_git;
+  char		*git_dir = NULL;
+  char		*common_dir;
+  char		*common;
+  struct stat	stat_buffer;
+  size_t	repo_index;
+  repository	*repo;
+
+  while ((slash = strrchr(directory, '/')) != NULL)
+    {
+      *slash = '\0';
+      dot_git = xmalloc(strlen(directory) + 6);
+      sprintf(dot_git, "%s/.git", directory);
+
+      if (stat(dot_git, &stat_buffer) == 0)
+	{
+	  if (S_ISDIR(stat_buffer.st_mode))
+	    {
+	      git_dir = dot_git;
+	      break;
+	    }
+	  else
+	    {
+	      char *line = read_small_file(dot_git);
+
+	      if ((line != NULL) && (strncmp(line, "gitdir: ", 8) == 0))
+		{
+		  if (line[8] == '/')
+		    git_dir = strdup(line + 8);
+		  else
+		    {
+		      git_dir = xmalloc(strlen(directory) + strlen(line) + 2);
+		      sprintf(git_dir, "%s/%s", directory, line + 8);
+		    }
+		  free(line);
+		  free(dot_git);
+		  break;
+		}
+	      free(line);
+	    }
+	}
+      free(dot_git);
+    }
+
+  if (git_dir == NULL)
+    {
+      free(directory);
+      return NULL;
+    }
+  if (*directory == '\0') strcpy(directory, "/");
+
+  for (repo_index = 0; repo_index < no_of_repositories; repo_index++)
+    if (strcmp(repositories[repo_index].git_dir, git_dir) == 0)
+      {
+	free(git_dir);
+	free(directory);
+	return &repositories[repo_index];
+      }
+
+  /*
+   * A linked work tree keeps its objects and refs in the main
+   * repository
+   */
+  common_dir = xmalloc(strlen(git_dir) + 12);
+  sprintf(common_dir, "%s/commondir", git_dir);
+  if ((common = read_small_file(common_dir)) != NULL)
+    {
+      free(common_dir);
+      if (common[0] == '/')
+	common_dir = common;
+      else
+	{
+	  common_dir = xmalloc(strlen(git_dir) + strlen(common) + 2);
+	  sprintf(common_dir, "%s/%s", git_dir, common);
+	  free(common);
+	}
+    }
+  else
+    strcpy(common_dir, git_dir);
+
+  repositories = xrealloc(repositories, (no_of_repositories + 1) * sizeof(repository));
+  repo = &repositories[no_of_repositories++];
+  memset(repo, 0, sizeof(repository));
+  repo->work_tree = directory;
+  repo->git_dir = git_dir;
+  repo->common_dir = common_dir;
+
+  dm('d',2,"gitrepo.c:find_repository() Work tree %s, objects in %s\n", directory, common_dir);
+
+  return repo;
+}
+
+/******************************************************************************
+ * Function:
+ *	map_file
+ */
+static void
+map_file(const char *filename, unsigned char **data, size_t *size)
+{
+  struct stat	stat_buffer;
+  int		fd;
+
+  if (((fd = open(filename, O_RDONLY)) == -1)
+      || (fstat(fd, &stat_buffer) == -1))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot read %s, %s\n"), filename, strerror(errno));
+      exit(1);
+    }
+
+  *size = (size_t)stat_buffer.st_size;
+#ifndef MSWIN
+  if ((*data = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot map %s, %s\n"), filename, strerror(errno));
+      exit(1);
+    }
+#else
+  *data = xmalloc(*size);
+  if (read(fd, *data, *size) != (int)*size)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot read %s, %s\n"), filename, strerror(errno));
+      exit(1);
+    }
+#endif
+  close(fd);
+}
+
+/******************************************************************************
+ * Function:
+ *	get_be32
+ */
+static unsigned long
+get_be32(const unsigned char *bytes)
+{
+  return ((unsigned long)bytes[0] << 24) | ((unsigned long)bytes[1] << 16)
+    | ((unsigned long)bytes[2] << 8) | (unsigned long)bytes[3];
+}
+
+/******************************************************************************
+ * Function:
+ *	read_packs
+ *
+ * Maps the index and data of every pack in the repository.
+ */
+static void
+read_packs(repository *repo)
+{
+  char		*pack_dir;
+  DIR		*directory;
+  struct dirent	*entry;
+
+  repo->packs_read = TRUE;
+
+  pack_dir = xmalloc(strlen(repo->common_dir) + 14);
+  sprintf(pack_dir, "%s/objects/pack", repo->common_dir);
+  if ((directory = opendir(pack_dir)) == NULL)
+    {
+      free(pack_dir);
+      return;
+    }
+
+  while ((entry = readdir(directory)) != NULL)
+    {
+      size_t	length = strlen(entry->d_name);
+      char	*filename;
+      pack_file	*pack;
+
+      if ((length < 5) || (strcmp(entry->d_name + length - 4, ".idx") != 0))
+	continue;
+
+      filename = xmalloc(strlen(pack_dir) + length + 3);
+      sprintf(filename, "%s/%s", pack_dir, entry->d_name);
+
+      pack = xmalloc(sizeof(pack_file));
+      map_file(filename, &pack->index, &pack->index_size);
+
+      /*
+       * Version 2 indexes start with a magic number; version 1 indexes
+       * start straight away with the fan-out table
+       */
+      if ((pack->index_size >= 8 + 256*4) && (memcmp(pack->index, "\377tOc", 4) == 0))
+	{
+	  pack->index_version = (int)get_be32(pack->index + 4);
+	  pack->no_of_objects = get_be32(pack->index + 8 + 255*4);
+	}
+      else if (pack->index_size >= 256*4)
+	{
+	  pack->index_version = 1;
+	  pack->no_of_objects = get_be32(pack->index + 255*4);
+	}
+      else
+	pack->index_version = 0;
+
+      if ((pack->index_version != 1) && (pack->index_version != 2))
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": warning: ignoring pack index %s\n"), filename);
+	  free(pack);
+	  free(filename);
+	  continue;
+	}
+
+      strcpy(filename + strlen(filename) - 4, ".pack");
+      map_file(filename, &pack->pack, &pack->pack_size);
+      if ((pack->pack_size < 12 + SHA_LENGTH) || (memcmp(pack->pack, "PACK", 4) != 0))
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": %s is not a pack\n"), filename);
+	  exit(1);
+	}
+
+      dm('d',3,"gitrepo.c:read_packs() %s has %lu objects\n", filename, pack->no_of_objects);
+
+      pack->next = repo->packs;
+      repo->packs = pack;
+      free(filename);
+    }
+
+  closedir(directory);
+  free(pack_dir);
+}
+
+/******************************************************************************
+ * Function:
+ *	find_in_pack
+ *
+ * Looks sha up in the pack's index, which is sorted and has a fan-out
+ * table giving the range for each first byte.
+ */
+static boolean
+find_in_pack(pack_file *pack, const unsigned char *sha, size_t *offset)
+{
+  const unsigned char	*fan_out = pack->index + ((pack->index_version == 2) ? 8 : 0);
+  size_t		entry_size = (pack->index_version == 2) ? SHA_LENGTH : 4 + SHA_LENGTH;
+  const unsigned char	*names = fan_out + 256*4 + ((pack->index_version == 2) ? 0 : 4);
+  unsigned long		low = (sha[0] == 0) ? 0 : get_be32(fan_out + (sha[0] - 1) * 4);
+  unsigned long		high = get_be32(fan_out + sha[0] * 4);
+
+  while (low < high)
+    {
+      unsigned long	middle = low + (high - low) / 2;
+      int		compare = memcmp(names + middle * entry_size, sha, SHA_LENGTH);
+
+      if (compare < 0)
+	low = middle + 1;
+      else if (compare > 0)
+	high = middle;
+      else if (pack->index_version == 1)
+	{
+	  *offset = get_be32(names + middle * entry_size - 4);
+	  return TRUE;
+	}
+      else
+	{
+	  const unsigned char *offsets = names + pack->no_of_objects * (SHA_LENGTH + 4);
+	  unsigned long small_offset = get_be32(offsets + middle * 4);
+
+	  if (small_offset & 0x80000000UL)
+	    {
+	      const unsigned char *large = offsets + pack->no_of_objects * 4
+		+ (small_offset & 0x7fffffffUL) * 8;
+
+	      *offset = (size_t)((((unsigned long long)get_be32(large)) << 32) | get_be32(large + 4));
+	    }
+	  else
+	    *offset = small_offset;
+	  return TRUE;
+	}
+    }
+
+  return FALSE;
+}
+
+/******************************************************************************
+ * Function:
+ *	apply_delta
+ *
+ * Builds an object from its base and a delta, which is the sizes of the
+ * base and the result followed by instructions to copy from the base or
+ * insert new bytes.
+ */
+static boolean
+apply_delta(const unsigned char *base, size_t base_size,
+	    const unsigned char *delta, size_t delta_size,
+	    unsigned char **result, size_t *result_size)
+{
+  const unsigned char	*end = delta + delta_size;
+  size_t		sizes[2];
+  int			size_index;
+  unsigned char		*out;
+  size_t		used = 0;
+
+  for (size_index = 0; size_index < 2; size_index++)
+    {
+      int shift = 0;
+
+      sizes[size_index] = 0;
+      do
+	{
+	  if (delta == end) return FALSE;
+	  sizes[size_index] |= (size_t)(*delta & 0x7f) << shift;
+	  shift += 7;
+	}
+      while (*delta++ & 0x80);
+    }
+  if (sizes[0] != base_size) return FALSE;
+
+  out = xmalloc(sizes[1] + 1);
+
+  while (delta < end)
+    {
+      unsigned char op = *delta++;
+
+      if (op & 0x80)
+	{
+	  size_t	copy_offset = 0;
+	  size_t	copy_size = 0;
+	  int		bit;
+
+	  for (bit = 0; bit < 4; bit++)
+	    if (op & (1 << bit))
+	      {
+		if (delta == end) break;
+		copy_offset |= (size_t)*delta++ << (8 * bit);
+	      }
+	  for (bit = 0; bit < 3; bit++)
+	    if (op & (0x10 << bit))
+	      {
+		if (delta == end) break;
+		copy_size |= (size_t)*delta++ << (8 * bit);
+	      }
+	  if (copy_size == 0) copy_size = 0x10000;
+
+	  if ((copy_offset + copy_size > base_size) || (used + copy_size > sizes[1]))
+	    break;
+	  memcpy(out + used, base + copy_offset, copy_size);
+	  used += copy_size;
+	}
+      else if ((op != 0) && (delta + op <= end) && (used + op <= sizes[1]))
+	{
+	  memcpy(out + used, delta, op);
+	  delta += op;
+	  used += op;
+	}
+      else
+	break;
+    }
+
+  if ((delta != end) || (used != sizes[1]))
+    {
+      free(out);
+      return FALSE;
+    }
+
+  *result = out;
+  *result_size = used;
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	read_packed_object
+ *
+ * Reads the object at offset in a pack.  Deltas are resolved against
+ * their base, which may itself be a delta.
+ */
+static boolean
+read_packed_object(repository *repo, pack_file *pack, size_t offset, int depth,
+		   object_type *type, unsigned char **data, size_t *size)
+{
+  size_t		limit = pack->pack_size - SHA_LENGTH;
+  size_t		position = offset;
+  size_t		object_size;
+  int			shift = 4;
+  unsigned char		byte;
+  unsigned char		*base = NULL;
+  size_t		base_size = 0;
+  object_type		base_type = OBJ_NONE;
+  unsigned char		*inflated;
+  size_t		inflated_size;
+
+  if ((position >= limit) || (depth > MAX_DELTA_DEPTH)) return FALSE;
+
+  byte = pack->pack[position++];
+  *type = (object_type)((byte >> 4) & 7);
+  object_size = byte & 0x0f;
+  while (byte & 0x80)
+    {
+      if (position >= limit) return FALSE;
+      byte = pack->pack[position++];
+      object_size |= (size_t)(byte & 0x7f) << shift;
+      shift += 7;
+    }
+
+  if (*type == OBJ_OFS_DELTA)
+    {
+      size_t back;
+
+      if (position >= limit) return FALSE;
+      byte = pack->pack[position++];
+      back = byte & 0x7f;
+      while (byte & 0x80)
+	{
+	  if (position >= limit) return FALSE;
+	  byte = pack->pack[position++];
+	  back = ((back + 1) << 7) | (byte & 0x7f);
+	}
+      if ((back == 0) || (back > offset)
+	  || !read_packed_object(repo, pack, offset - back, depth + 1, &base_type, &base, &base_size))
+	return FALSE;
+    }
+  else if (*type == OBJ_REF_DELTA)
+    {
+      if ((position + SHA_LENGTH > limit)
+	  || !read_object(repo, pack->pack + position, depth + 1, &base_type, &base, &base_size))
+	return FALSE;
+      position += SHA_LENGTH;
+    }
+  else if ((*type < OBJ_COMMIT) || (*type > OBJ_TAG))
+    return FALSE;
+
+  if (!inflate_zlib(pack->pack + position, limit - position, object_size, &inflated, &inflated_size)
+      || (inflated_size != object_size))
+    {
+      free(base);
+      return FALSE;
+    }
+
+  if (base == NULL)
+    {
+      *data = inflated;
+      *size = inflated_size;
+      return TRUE;
+    }
+
+  *type = base_type;
+  if (!apply_delta(base, base_size, inflated, inflated_size, data, size))
+    {
+      free(base);
+      free(inflated);
+      return FALSE;
+    }
+  free(base);
+  free(inflated);
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	read_loose_object
+ *
+ * Reads objects/xx/yyyy..., which is a header of the type name and size
+ * followed by the contents, all compressed.
+ */
+static boolean
+read_loose_object(repository *repo, const unsigned char *sha,
+		  object_type *type, unsigned char **data, size_t *size)
+{
+  char		hex[HEX_LENGTH + 1];
+  char		*filename;
+  struct stat	stat_buffer;
+  unsigned char	*compressed;
+  unsigned char	*inflated;
+  size_t	inflated_size;
+  size_t	header_length;
+  int		fd;
+  boolean	good;
+
+  sha_to_hex(sha, hex);
+  filename = xmalloc(strlen(repo->common_dir) + HEX_LENGTH + 12);
+  sprintf(filename, "%s/objects/%.2s/%s", repo->common_dir, hex, hex + 2);
+
+  if ((fd = open(filename, O_RDONLY)) == -1)
+    {
+      free(filename);
+      return FALSE;
+    }
+  if (fstat(fd, &stat_buffer) == -1)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot read %s, %s\n"), filename, strerror(errno));
+      exit(1);
+    }
+  compressed = xmalloc((size_t)stat_buffer.st_size + 1);
+  if (read(fd, compressed, (size_t)stat_buffer.st_size) != (int)stat_buffer.st_size)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot read %s, %s\n"), filename, strerror(errno));
+      exit(1);
+    }
+  close(fd);
+
+  good = inflate_zlib(compressed, (size_t)stat_buffer.st_size, 0, &inflated, &inflated_size);
+  free(compressed);
+  if (!good)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": object %s is corrupt\n"), filename);
+      exit(1);
+    }
+  free(filename);
+
+  header_length = strnlen((char *)inflated, inflated_size);
+  if (header_length == inflated_size)
+    {
+      free(inflated);
+      return FALSE;
+    }
+
+  if (strncmp((char *)inflated, "commit ", 7) == 0) *type = OBJ_COMMIT;
+  else if (strncmp((char *)inflated, "tree ", 5) == 0) *type = OBJ_TREE;
+  else if (strncmp((char *)inflated, "blob ", 5) == 0) *type = OBJ_BLOB;
+  else if (strncmp((char *)inflated, "tag ", 4) == 0) *type = OBJ_TAG;
+  else
+    {
+      free(inflated);
+      return FALSE;
+    }
+
+  *size = inflated_size - header_length - 1;
+  memmove(inflated, inflated + header_length + 1, *size);
+  *data = inflated;
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	read_object
+ *
+ * Reads an object, loose or packed.  The data is always followed by a
+ * spare byte, so that text can be terminated.
+ */
+static boolean
+read_object(repository *repo, const unsigned char *sha, int depth,
+	    object_type *type, unsigned char **data, size_t *size)
+{
+  pack_file *pack;
+
+  if (read_loose_object(repo, sha, type, data, size)) return TRUE;
+
+  if (!repo->packs_read) read_packs(repo);
+  for (pack = repo->packs; pack != NULL; pack = pack->next)
+    {
+      size_t offset;
+
+      if (find_in_pack(pack, sha, &offset))
+	{
+	  if (read_packed_object(repo, pack, offset, depth, type, data, size))
+	    return TRUE;
+	  fprintf(stderr, gettext(CMD_NAME ": object at offset %lu of a pack is corrupt\n"),
+		  (unsigned long)offset);
+	  exit(1);
+	}
+    }
+
+  return FALSE;
+}
+
+/******************************************************************************
+ * Function:
+ *	hex_to_sha
+ */
+static boolean
+hex_to_sha(const char *hex, unsigned char *sha)
+{
+  int index;
+
+  for (index = 0; index < HEX_LENGTH; index++)
+    {
+      int digit;
+
+      if (isdigit((unsigned char)hex[index])) digit = hex[index] - '0';
+      else if ((hex[index] >= 'a') && (hex[index] <= 'f')) digit = hex[index] - 'a' + 10;
+      else return FALSE;
+
+      if (index & 1)
+	sha[index / 2] |= (unsigned char)digit;
+      else
+	sha[index / 2] = (unsigned char)(digit << 4);
+    }
+
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	sha_to_hex
+ */
+static void
+sha_to_hex(const unsigned char *sha, char *hex)
+{
+  int index;
+
+  for (index = 0; index < SHA_LENGTH; index++)
+    sprintf(hex + index * 2, "%02x", sha[index]);
+}
+
+/******************************************************************************
+ * Function:
+ *	find_abbreviated
+ *
+ * Finds the one object whose name starts with hex, looking through the
+ * loose objects directory for its first two digits and every pack.
+ */
+static boolean
+find_abbreviated(repository *repo, const char *hex, unsigned char *sha)
+{
+  size_t	length = strlen(hex);
+  int		matches = 0;
+  char		full[HEX_LENGTH + 1];
+  char		*dir_name;
+  DIR		*directory;
+  struct dirent	*entry;
+  pack_file	*pack;
+
+  if ((length < 4) || (length > HEX_LENGTH) || (strspn(hex, "0123456789abcdef") != length))
+    return FALSE;
+
+  dir_name = xmalloc(strlen(repo->common_dir) + 12);
+  sprintf(dir_name, "%s/objects/%.2s", repo->common_dir, hex);
+  if ((directory = opendir(dir_name)) != NULL)
+    {
+      while ((entry = readdir(directory)) != NULL)
+	if ((strlen(entry->d_name) == HEX_LENGTH - 2)
+	    && (strncmp(entry->d_name, hex + 2, length - 2) == 0))
+	  {
+	    sprintf(full, "%.2s%.38s", hex, entry->d_name);
+	    if (hex_to_sha(full, sha)) matches++;
+	  }
+      closedir(directory);
+    }
+  free(dir_name);
+
+  if (!repo->packs_read) read_packs(repo);
+  for (pack = repo->packs; pack != NULL; pack = pack->next)
+    {
+      const unsigned char	*fan_out = pack->index + ((pack->index_version == 2) ? 8 : 0);
+      size_t			entry_size = (pack->index_version == 2) ? SHA_LENGTH : 4 + SHA_LENGTH;
+      const unsigned char	*names = fan_out + 256*4 + ((pack->index_version == 2) ? 0 : 4);
+      unsigned int		first_byte;
+      unsigned long		object;
+
+      sscanf(hex, "%2x", &first_byte);
+      object = (first_byte == 0) ? 0 : get_be32(fan_out + (first_byte - 1) * 4);
+      for (; object < get_be32(fan_out + first_byte * 4); object++)
+	{
+	  sha_to_hex(names + object * entry_size, full);
+	  if ((strncmp(full, hex, length) == 0)
+	      && ((matches == 0) || (memcmp(sha, names + object * entry_size, SHA_LENGTH) != 0)))
+	    {
+	      memcpy(sha, names + object * entry_size, SHA_LENGTH);
+	      matches++;
+	    }
+	}
+    }
+
+  if (matches > 1)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": object name %s is ambiguous\n"), hex);
+      exit(1);
+    }
+
+  return (matches == 1);
+}
+
+/******************************************************************************
+ * Function:
+ *	resolve_ref
+ *
+ * Finds what a ref, such as HEAD or refs/tags/v1.0, points at, as a
+ * loose ref or in packed-refs.  Symbolic refs are followed.
+ */
+static boolean
+resolve_ref(repository *repo, const char *name, int depth, unsigned char *sha)
+{
+  char		*filename;
+  char		*line;
+  FILE		*packed;
+  boolean	found = FALSE;
+
+  if (depth > MAX_REF_DEPTH) return FALSE;
+
+  filename = xmalloc(strlen(repo->common_dir) + strlen(name) + 2);
+  sprintf(filename, "%s/%s",
+	  (strchr(name, '/') == NULL) ? repo->git_dir : repo->common_dir, name);
+  line = read_small_file(filename);
+  free(filename);
+
+  if (line != NULL)
+    {
+      if (strncmp(line, "ref: ", 5) == 0)
+	found = resolve_ref(repo, line + 5, depth + 1, sha);
+      else
+	found = (strlen(line) == HEX_LENGTH) && hex_to_sha(line, sha);
+      free(line);
+      return found;
+    }
+
+  filename = xmalloc(strlen(repo->common_dir) + 13);
+  sprintf(filename, "%s/packed-refs", repo->common_dir);
+  if ((packed = fopen(filename, "r")) != NULL)
+    {
+      char buffer[MAX_LINE + HEX_LENGTH + 2];
+
+      while (!found && (fgets(buffer, sizeof(buffer), packed) != NULL))
+	{
+	  buffer[strcspn(buffer, "\r\n")] = '\0';
+	  if ((buffer[HEX_LENGTH] == ' ')
+	      && (strcmp(buffer + HEX_LENGTH + 1, name) == 0))
+	    found = hex_to_sha(buffer, sha);
+	}
+      fclose(packed);
+    }
+  free(filename);
+
+  return found;
+}
+
+/******************************************************************************
+ * Function:
+ *	resolve_name
+ *
+ * Turns the name part of a revision into an object, trying the same
+ * places as git does.
+ */
+static boolean
+resolve_name(repository *repo, const char *name, unsigned char *sha)
+{
+  static const char	*patterns[] = {
+    "%s", "refs/%s", "refs/tags/%s", "refs/heads/%s", "refs/remotes/%s", "refs/remotes/%s/HEAD", NULL
+  };
+  const char		**pattern;
+  char			*ref;
+  boolean		found = FALSE;
+
+  if ((strlen(name) == HEX_LENGTH) && hex_to_sha(name, sha)) return TRUE;
+
+  ref = xmalloc(strlen(name) + 24);
+  for (pattern = patterns; !found && (*pattern != NULL); pattern++)
+    {
+      sprintf(ref, *pattern, name);
+      found = resolve_ref(repo, ref, 0, sha);
+    }
+  free(ref);
+
+  return found || find_abbreviated(repo, name, sha);
+}
+
+/******************************************************************************
+ * Function:
+ *	commit_field
+ *
+ * Gets the which'th field called field (tree or parent) from a commit,
+ * first looking through any tags.
+ */
+static boolean
+commit_field(repository *repo, const unsigned char *sha, const char *field,
+	     int which, unsigned char *result)
+{
+  unsigned char	object[SHA_LENGTH];
+  object_type	type;
+  unsigned char	*data;
+  size_t	size;
+  int		depth;
+
+  memcpy(object, sha, SHA_LENGTH);
+
+  for (depth = 0; depth < MAX_REF_DEPTH; depth++)
+    {
+      char	*line;
+      size_t	field_length = strlen(field);
+      boolean	found = FALSE;
+
+      if (!read_object(repo, object, 0, &type, &data, &size)) return FALSE;
+      data[size] = '\0';
+
+      if ((type != OBJ_COMMIT) && (type != OBJ_TAG))
+	{
+	  free(data);
+	  return FALSE;
+	}
+
+      /*
+       * The fields come before the first blank line
+       */
+      for (line = (char *)data; (*line != '\0') && (*line != '\n'); line = strchr(line, '\n') + 1)
+	{
+	  const char *wanted = (type == OBJ_TAG) ? "object" : field;
+
+	  field_length = strlen(wanted);
+	  if ((strncmp(line, wanted, field_length) == 0)
+	      && (line[field_length] == ' ')
+	      && (--which == 0))
+	    {
+	      found = hex_to_sha(line + field_length + 1, (type == OBJ_TAG) ? object : result);
+	      break;
+	    }
+	  if (strchr(line, '\n') == NULL) break;
+	}
+      free(data);
+
+      if (!found) return FALSE;
+      if (type == OBJ_COMMIT) return TRUE;
+      which = 1;
+    }
+
+  return FALSE;
+}
+
+/******************************************************************************
+ * Function:
+ *	resolve_revision
+ *
+ * Finds the root tree for the revision, following any ~<n> and ^<n>.
+ */
+static void
+resolve_revision(repository *repo, const char *revision)
+{
+  char		*name = strdup(revision);
+  char		*suffix = name + strcspn(name, "~^");
+  unsigned char	commit[SHA_LENGTH];
+  char		operator;
+
+  operator = *suffix;
+  *suffix = '\0';
+
+  if (!resolve_name(repo, (*name == '\0') ? "HEAD" : name, commit))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": unknown revision %s in %s\n"), revision, repo->work_tree);
+      exit(1);
+    }
+
+  while (operator != '\0')
+    {
+      char	*end;
+      long	count;
+
+      suffix++;
+      count = isdigit((unsigned char)*suffix) ? strtol(suffix, &end, 10) : 1;
+      if (!isdigit((unsigned char)*suffix)) end = suffix;
+
+      if (operator == '~')
+	{
+	  while (count-- > 0)
+	    if (!commit_field(repo, commit, "parent", 1, commit))
+	      {
+		fprintf(stderr, gettext(CMD_NAME ": revision %s goes back too far\n"), revision);
+		exit(1);
+	      }
+	}
+      else if ((count > 0) && !commit_field(repo, commit, "parent", (int)count, commit))
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": revision %s goes back too far\n"), revision);
+	  exit(1);
+	}
+
+      if ((*end != '\0') && (*end != '~') && (*end != '^'))
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": cannot understand revision %s\n"), revision);
+	  exit(1);
+	}
+      operator = *end;
+      suffix = end;
+    }
+
+  if (!commit_field(repo, commit, "tree", 1, repo->root_tree))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": revision %s is not a commit\n"), revision);
+      exit(1);
+    }
+  repo->have_root_tree = TRUE;
+
+  dm('d',2,"gitrepo.c:resolve_revision() Resolved %s in %s\n", revision, repo->work_tree);
+  free(name);
+}
+
+/******************************************************************************
+ * Function:
+ *	read_tree
+ */
+static tree_entry *
+read_tree(repository *repo, const unsigned char *sha)
+{
+  tree_entry	*tree;
+  object_type	type;
+
+  for (tree = repo->trees; tree != NULL; tree = tree->next)
+    if (memcmp(tree->sha, sha, SHA_LENGTH) == 0) return tree;
+
+  tree = xmalloc(sizeof(tree_entry));
+  if (!read_object(repo, sha, 0, &type, &tree->data, &tree->size) || (type != OBJ_TREE))
+    {
+      char hex[HEX_LENGTH + 1];
+
+      sha_to_hex(sha, hex);
+      fprintf(stderr, gettext(CMD_NAME ": cannot read tree %s\n"), hex);
+      exit(1);
+    }
+  memcpy(tree->sha, sha, SHA_LENGTH);
+  tree->next = repo->trees;
+  repo->trees = tree;
+
+  return tree;
+}
+
+/******************************************************************************
+ * Function:
+ *	git_old_version
+ *
+ * Gets the contents of filename at revision in the repository that
+ * filename is in.  Returns FALSE if the file isn't in that revision,
+ * e.g. because it has been added since.  *contents is for the caller
+ * to free.
+ */
+boolean
+git_old_version(const char *revision, const char *filename,
+		char **contents, size_t *size)
+{
+  char		*path = absolute_path(filename);
+  repository	*repo;
+  char		*relative;
+  unsigned char	object[SHA_LENGTH];
+  object_type	type;
+
+  if ((repo = find_repository(path)) == NULL)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": %s is not in a git repository\n"), filename);
+      exit(1);
+    }
+  if (!repo->have_root_tree) resolve_revision(repo, revision);
+
+  memcpy(object, repo->root_tree, SHA_LENGTH);
+  relative = path + strlen(repo->work_tree);
+  while (*relative == '/') relative++;
+
+  /*
+   * Go down through the trees a directory at a time
+   */
+  while (*relative != '\0')
+    {
+      tree_entry	*tree = read_tree(repo, object);
+      size_t		name_length = strcspn(relative, "/");
+      boolean		directory = (relative[name_length] == '/');
+      unsigned char	*entry = tree->data;
+      unsigned char	*end = tree->data + tree->size;
+      boolean		found = FALSE;
+
+      while (entry < end)
+	{
+	  unsigned char	*name = memchr(entry, ' ', end - entry);
+	  unsigned char	*name_end;
+
+	  if ((name == NULL) || ((name_end = memchr(name, '\0', end - name)) == NULL)
+	      || (name_end + 1 + SHA_LENGTH > end))
+	    break;
+	  name++;
+
+	  if (((size_t)(name_end - name) == name_length)
+	      && (memcmp(name, relative, name_length) == 0)
+	      && ((entry[0] == '4') == directory))
+	    {
+	      memcpy(object, name_end + 1, SHA_LENGTH);
+	      found = TRUE;
+	      break;
+	    }
+	  entry = name_end + 1 + SHA_LENGTH;
+	}
+
+      if (!found)
+	{
+	  dm('d',2,"gitrepo.c:git_old_version() %s is not in %s\n", filename, revision);
+	  free(path);
+	  return FALSE;
+	}
+
+      relative += name_length;
+      while (*relative == '/') relative++;
+    }
+
+  free(path);
+
+  if (!read_object(repo, object, 0, &type, (unsigned char **)contents, size) || (type != OBJ_BLOB))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot read %s at %s\n"), filename, revision);
+      exit(1);
+    }
+
+  dm('d',2,"gitrepo.c:git_old_version() %s at %s is %lu bytes\n", filename, revision, (unsigned long)*size);
+  return TRUE;
+}
@@ -0,0 +1,7 @@
+/*
+ * Include file:
+ *	gitrepo.h
+ */
+
+extern boolean git_old_version(const char *revision, const char *filename,
+			       char **contents, size_t *size);
@@ -24,6 +24,7 @@
 #include "postscript.h"
 #include "debug.h"
 #include "utils.h"
+#include "print_prompt.h"
 
 #include "index.h"
 
@@ -37,15 +38,23 @@
 #define LINE		0
 #define INPUT_END	1
 #define BLOCK_SIZE 1000
+#define NAME_BLOCK_SIZE	16384
+#define NAME_TABLE_SIZE	1024
+#define SMALL_SORT	12
 
+/*
+ * Function and file names are interned in names[], so each distinct
+ * name is stored once and entries refer to it by offset.  Equal
+ * offsets mean equal names.
+ */
 typedef struct {
-  char	name[SYMBOL_LEN];
+  size_t	name;
+  size_t	filename;
   long	name_start_char;
   long	name_end_char;
   long	page_number;
   long	end_page;
   boolean changed;
-  char	*filename;
 } function_entry;
 
 typedef struct {
@@ -61,23 +70,38 @@ typedef struct {
 
 static void dot_fill(char string[]);
 static int compare(const void *, const void *);
+static void multikey_sort(size_t *list, size_t list_size, size_t depth);
+static void small_sort(size_t *list, size_t list_size, size_t depth);
+static size_t hash_name(const char *name);
+static size_t intern_name(char *name);
 static short print_index_line(int print_bold);
+static void build_page_map(void);
+static size_t page_function(long page);
+static size_t next_indexed_function(size_t function_idx);
 
 static size_t	max_function_name_length = 0;
 static size_t	max_file_name_length = 0;
 
-static unsigned short	no_of_functions=0;
-static unsigned int	function_list_size = 0;
-static unsigned int	file_list_size = 0;
-static unsigned int	page_list_size = 0;
+static size_t		no_of_functions=0;
+static size_t		function_list_size = 0;
+static size_t		file_list_size = 0;
+static size_t		page_list_size = 0;
 static function_entry	*functions = NULL;
-static function_entry	*sorted_functions = NULL;
+static size_t		*sorted_functions = NULL;
+static size_t		*page_functions = NULL;
+static size_t		page_map_size = 0;
+static char		*names = NULL;
+static size_t		names_size = 0;
+static size_t		names_used = 0;
+static size_t		*name_table = NULL;
+static size_t		name_table_size = 0;
+static size_t		no_of_names = 0;
 static file_entry	*files = NULL;
 static page_entry	*pages = NULL;
 
 static boolean		current_function_changed = FALSE;
 
-static void grow_array(void *list_ptr_ptr, unsigned int *, size_t);
+static void grow_array(void *list_ptr_ptr, size_t *, size_t);
 
 /*****************************************************************************
  * Function:
@@ -95,6 +119,14 @@ setup_index(void)
   page_list_size = 0;
   functions = NULL;
   sorted_functions = NULL;
+  page_functions = NULL;
+  page_map_size = 0;
+  names = NULL;
+  names_size = 0;
+  names_used = 0;
+  name_table = NULL;
+  name_table_size = 0;
+  no_of_names = 0;
   files = NULL;
   pages = NULL;
 
@@ -104,23 +136,128 @@ setup_index(void)
 /*****************************************************************************
  * Function:
  *	grow_array
+ *
+ * Grows the array geometrically so that filling it costs linear time.
+ * The new entries are cleared.
  */
 static void
-grow_array(void *list_ptr_ptr, unsigned int *list_size_ptr, size_t list_entry_size)
+grow_array(void *list_ptr_ptr, size_t *list_size_ptr, size_t list_entry_size)
 
 {
   size_t	size_needed;
+  size_t	old_size = *list_size_ptr * list_entry_size;
 
-  *list_size_ptr += BLOCK_SIZE;
+  if (*list_size_ptr < BLOCK_SIZE)
+    *list_size_ptr += BLOCK_SIZE;
+  else
+    *list_size_ptr *= 2;
 
   size_needed = *list_size_ptr * list_entry_size;
 
-  dm('i',3,"index.c:grow_array() Growing array by %d bytes\n", size_needed);
+  dm('i',3,"index.c:grow_array() Growing array to %lu bytes\n", (unsigned long)size_needed);
 
   if (*(void **)list_ptr_ptr == NULL)
     *(void **)list_ptr_ptr = xmalloc(size_needed);
   else
     *(void **)list_ptr_ptr = xrealloc(*(void **)list_ptr_ptr, size_needed);
+
+  memset((char *)*(void **)list_ptr_ptr + old_size, 0, size_needed - old_size);
+}
+
+/*****************************************************************************
+ * Function:
+ *	hash_name
+ */
+static size_t
+hash_name(const char *name)
+
+{
+  size_t	hash = 5381;
+
+  while (*name)
+    hash = (hash * 33) ^ (unsigned char)*name++;
+
+  return hash;
+}
+
+/*****************************************************************************
+ * Function:
+ *	intern_name
+ *
+ * Returns the offset of name in names[], adding it if this is the
+ * first time it has been seen.  name_table[] is an open hash table of
+ * offsets plus one, zero meaning an empty slot.
+ */
+static size_t
+intern_name(char *name)
+
+{
+  size_t	length = strlen(name);
+  size_t	hash = hash_name(name);
+  size_t	slot;
+  size_t	offset;
+
+  if (name_table != NULL)
+    {
+      for (slot = hash & (name_table_size - 1);
+	   name_table[slot] != 0;
+	   slot = (slot + 1) & (name_table_size - 1))
+	{
+	  if (strcmp(names + name_table[slot] - 1, name) == 0)
+	    return name_table[slot] - 1;
+	}
+    }
+
+  /*
+   * Not seen before, so add it to the end of names[]...
+   */
+  if (names_used + length + 1 > names_size)
+    {
+      while (names_used + length + 1 > names_size)
+	names_size = (names_size == 0) ? NAME_BLOCK_SIZE : names_size * 2;
+      dm('i',3,"index.c:intern_name() Growing names to %lu bytes\n", (unsigned long)names_size);
+      names = (names == NULL) ? xmalloc(names_size) : xrealloc(names, names_size);
+    }
+
+  offset = names_used;
+  strcpy(names + offset, name);
+  names_used += length + 1;
+
+  /*
+   * ...and to the hash table, keeping it at most half full
+   */
+  if ((no_of_names + 1) * 2 > name_table_size)
+    {
+      size_t	*old_table = name_table;
+      size_t	old_table_size = name_table_size;
+      size_t	old_slot;
+
+      name_table_size = (name_table_size == 0) ? NAME_TABLE_SIZE : name_table_size * 2;
+      name_table = xmalloc(name_table_size * sizeof(size_t));
+      memset(name_table, 0, name_table_size * sizeof(size_t));
+
+      for (old_slot = 0; old_slot < old_table_size; old_slot++)
+	{
+	  if (old_table[old_slot] == 0) continue;
+
+	  for (slot = hash_name(names + old_table[old_slot] - 1) & (name_table_size - 1);
+	       name_table[slot] != 0;
+	       slot = (slot + 1) & (name_table_size - 1))
+	    ;
+	  name_table[slot] = old_table[old_slot];
+	}
+
+      if (old_table != NULL) free(old_table);
+    }
+
+  for (slot = hash & (name_table_size - 1);
+       name_table[slot] != 0;
+       slot = (slot + 1) & (name_table_size - 1))
+    ;
+  name_table[slot] = offset + 1;
+  no_of_names += 1;
+
+  return offset;
 }
 
 /*****************************************************************************
@@ -135,7 +272,7 @@ page_has_changed(long this_page_number)
 {
   if (pass == 1) return;
 
-  while (this_page_number >= page_list_size)
+  while ((size_t)this_page_number >= page_list_size)
     grow_array(&pages, &page_list_size, sizeof(page_entry));
 
   current_function_changed = TRUE;
@@ -254,11 +391,11 @@ add_function(char *name, long start, long end, long page, char *filename)
   if (no_of_functions == function_list_size)
     grow_array(&functions, &function_list_size, sizeof(function_entry));
 
-  strcpy(functions[no_of_functions].name, name);
+  functions[no_of_functions].name = intern_name(name);
   functions[no_of_functions].name_start_char = start;
   functions[no_of_functions].name_end_char = end;
   functions[no_of_functions].page_number = page;
-  functions[no_of_functions].filename = filename;
+  functions[no_of_functions].filename = intern_name(filename);
   if (length > max_function_name_length)
     max_function_name_length = length;
   current_function_changed = FALSE;
@@ -283,6 +420,38 @@ end_function(long page)
   functions[no_of_functions++].end_page = page;
 }
 
+/*****************************************************************************
+ * Function:
+ *	no_of_indexed_functions
+ *
+ * Returns how many functions have been indexed so far.
+ */
+size_t
+no_of_indexed_functions(void)
+
+{
+  return no_of_functions;
+}
+
+/*****************************************************************************
+ * Function:
+ *	get_indexed_function
+ *
+ * Gets what add_function() and end_function() were told about a
+ * function, so that it can be added again later without reading the
+ * file it came from.
+ */
+void
+get_indexed_function(size_t function, char **name, long *start, long *end, long *page, long *end_page)
+
+{
+  *name = names + functions[function].name;
+  *start = functions[function].name_start_char;
+  *end = functions[function].name_end_char;
+  *page = functions[function].page_number;
+  *end_page = functions[function].end_page;
+}
+
 /*****************************************************************************
  * Function:
  *	get_function_name_posn
@@ -294,12 +463,17 @@ char_status
 get_function_name_posn(long current_char, char_status current_status)
 
 {
-  static unsigned short	current_function=0;
+  static size_t	current_function=0;
 
   if (pass==0) return(current_status);
 
-  /* If there were no functions simply return CHAR */
-  if (no_of_functions == 0) return (current_status);
+  /* Skip any function names that are already behind us */
+  while ((current_function < no_of_functions)
+	 && (current_char > functions[current_function].name_end_char))
+    current_function += 1;
+
+  /* If there are no more functions simply return CHAR */
+  if (current_function >= no_of_functions) return (current_status);
 
   if ((current_char >= functions[current_function].name_start_char)
       && (current_char <= functions[current_function].name_end_char))
@@ -313,6 +487,75 @@ get_function_name_posn(long current_char, char_status current_status)
   return(current_status);
 }
 
+/*****************************************************************************
+ * Function:
+ *	build_page_map
+ *
+ * Works out which function each page belongs to, i.e. the first function
+ * that ends on or after the page, provided it has started by then.  Both
+ * page_number and end_page only ever go up through functions[], so one
+ * pass over pages and functions together does it.  page_functions[]
+ * holds the function index plus one, zero meaning no function.
+ */
+static void
+build_page_map(void)
+
+{
+  size_t	current_function = 0;
+  long		page;
+  long		last_page = 0;
+
+  if (no_of_functions == 0) return;
+
+  for (current_function = 0; current_function < no_of_functions; current_function++)
+    {
+      if (functions[current_function].page_number > last_page)
+	last_page = functions[current_function].page_number;
+      if (functions[current_function].end_page > last_page)
+	last_page = functions[current_function].end_page;
+    }
+
+  page_map_size = last_page + 1;
+  page_functions = xmalloc(page_map_size * sizeof(size_t));
+
+  current_function = 0;
+  for (page = 0; page <= last_page; page++)
+    {
+      while ((current_function < no_of_functions)
+	     && (page >= functions[current_function].page_number)
+	     && (page > functions[current_function].end_page))
+	current_function += 1;
+
+      if ((current_function < no_of_functions)
+	  && (page >= functions[current_function].page_number))
+	page_functions[page] = current_function + 1;
+      else
+	page_functions[page] = 0;
+    }
+
+  dm('i',2,"index.c:build_page_map() Mapped %ld pages\n", last_page + 1);
+}
+
+/*****************************************************************************
+ * Function:
+ *	page_function
+ *
+ * Returns the index plus one of the function for the specified page,
+ * or zero if there isn't one.
+ */
+static size_t
+page_function(long page)
+
+{
+  if ((pass==0) || (no_of_functions == 0)) return 0;
+
+  if (page_functions == NULL) build_page_map();
+
+  if ((page < 0) || ((size_t)page >= page_map_size)) return 0;
+
+  return page_functions[page];
+}
+
 /*****************************************************************************
  * Function:
  *	get_function_name
@@ -323,26 +566,16 @@ char *
 get_function_name(long page)
 
 {
-  unsigned short	current_function=0;
+  size_t	current_function;
   static char	dummy_return[] = "";
 
   dm('i',4,"Index: Searching for function name for page %ld\n",page);
 
-  if ((pass==0) || (no_of_functions == 0)) return(dummy_return);
+  if ((current_function = page_function(page)) == 0) return(dummy_return);
 
-  for (;;)
-    {
-      if (page < functions[current_function].page_number)
-	return(dummy_return);
-      if (page <= functions[current_function].end_page)
-	{
-	  dm('i',4,"Index: Function name for page %ld = %s\n",page,functions[current_function].name);
-	  return(functions[current_function].name);
-	}
-      if (current_function >= no_of_functions-1)
-	return(dummy_return);
-      current_function += 1;
-    }
+  dm('i',4,"Index: Function name for page %ld = %s\n",page,names + functions[current_function-1].name);
+
+  return(names + functions[current_function-1].name);
 }	
 
 /*****************************************************************************
@@ -369,34 +602,25 @@ boolean
 function_changed(long page)
 
 {
-  static unsigned short	current_function=0;
+  size_t	current_function;
 
-  if (pass==0) return(FALSE);
-  if (no_of_functions == 0) return(FALSE);
-  for (;;)
-    {
-      if (page < functions[current_function].page_number)
-	return(FALSE);
-      if (page <= functions[current_function].end_page)
-	return(functions[current_function].changed);
-      if (current_function >= no_of_functions-1)
-	return(FALSE);
-      current_function += 1;
-    }
+  if ((current_function = page_function(page)) == 0) return(FALSE);
+
+  return(functions[current_function-1].changed);
 }	
 
 /*****************************************************************************
  * Function:
  *	page_changed
  *
- * Has the current page changed?
+ * Has the current page changed?  In pass 0 the answer is only complete
+ * once the whole page has been read.
  */
 boolean
 page_changed(long page)
 
 {
-  if (pass == 0) return FALSE;
-  if (page > page_list_size) return FALSE;
+  if ((page < 0) || ((size_t)page >= page_list_size)) return FALSE;
 
   return pages[page].changed;
 }	
@@ -426,50 +650,214 @@ dot_fill(char string[])
  * Function:
  *	compare
  *
- * Compares two function entries, used by qsort().
- * Looks at name first, then start char.
+ * Compares two indexes into functions[], used by qsort().
+ * Looks at name first, then start char, then the original order.
  */
 int
 compare(const void *p1, const void *p2)
 
 {
+  function_entry *f1 = &functions[*(const size_t *)p1];
+  function_entry *f2 = &functions[*(const size_t *)p2];
   int r;
-  r = strcmp(((function_entry *)p1)->name,((function_entry *)p2)->name);
+
+  if (f1->name == f2->name)
+    r = 0;
+  else
+    r = strcmp(names + f1->name, names + f2->name);
   if (r == 0)
     {
-      if (((function_entry *)p1)->name_start_char > ((function_entry *)p2)->name_start_char)
+      if (f1->name_start_char > f2->name_start_char)
 	r = 1;
       else
-	if (((function_entry *)p1)->name_start_char < ((function_entry *)p2)->name_start_char)
+	if (f1->name_start_char < f2->name_start_char)
 	  r = -1;
 	else
-	  r = 0;
+	  r = (f1 > f2) - (f1 < f2);
     }
   return r;
 }
 
+/*****************************************************************************
+ * Function:
+ *	small_sort
+ *
+ * Insertion sort for short lists of function indexes whose names are
+ * already known to match in the first depth characters.
+ */
+static void
+small_sort(size_t *list, size_t list_size, size_t depth)
+
+{
+  size_t	i, j;
+  size_t	entry;
+
+  for (i = 1; i < list_size; i++)
+    {
+      entry = list[i];
+      for (j = i; j > 0; j--)
+	{
+	  int r = strcmp(names + functions[list[j-1]].name + depth,
+			 names + functions[entry].name + depth);
+	  if (r < 0) break;
+	  if ((r == 0) && (compare(&list[j-1], &entry) <= 0)) break;
+	  list[j] = list[j-1];
+	}
+      list[j] = entry;
+    }
+}
+
+/*****************************************************************************
+ * Function:
+ *	multikey_sort
+ *
+ * Sorts a list of function indexes by name using multikey quicksort
+ * (Bentley and Sedgewick): the list is split three ways on the character
+ * at position depth, and only the middle part moves on to the next
+ * character.  All the names in the list match in the first depth
+ * characters.  Functions with identical names are sorted with compare(),
+ * i.e. by position.  The largest part is handled by looping rather than
+ * recursing, to keep the stack shallow.
+ */
+static void
+multikey_sort(size_t *list, size_t list_size, size_t depth)
+
+{
+#define KEY(n)	((unsigned char)names[functions[list[n]].name + depth])
+#define SWAP(a,b)	{ size_t tmp = list[a]; list[a] = list[b]; list[b] = tmp; }
+
+  while (list_size > 1)
+    {
+      size_t	lt, gt, i;
+      int	pivot, key;
+      size_t	less_size, equal_size, more_size;
+
+      if (list_size < SMALL_SORT)
+	{
+	  small_sort(list, list_size, depth);
+	  return;
+	}
+
+      /* Median of three as the pivot, moved to the front */
+      {
+	size_t	a = 0, b = list_size / 2, c = list_size - 1;
+	size_t	m;
+
+	if (KEY(a) < KEY(b))
+	  m = (KEY(b) < KEY(c)) ? b : ((KEY(a) < KEY(c)) ? c : a);
+	else
+	  m = (KEY(a) < KEY(c)) ? a : ((KEY(b) < KEY(c)) ? c : b);
+	SWAP(0, m);
+      }
+      pivot = KEY(0);
+
+      lt = 0;
+      gt = list_size;
+      i = 1;
+      while (i < gt)
+	{
+	  key = KEY(i);
+	  if (key < pivot)
+	    {
+	      SWAP(lt, i);
+	      lt++; i++;
+	    }
+	  else if (key > pivot)
+	    {
+	      gt--;
+	      SWAP(i, gt);
+	    }
+	  else
+	    i++;
+	}
+
+      less_size = lt;
+      equal_size = gt - lt;
+      more_size = list_size - gt;
+
+      /* Names that have all ended here are identical */
+      if (pivot == 0)
+	{
+	  if (equal_size > 1)
+	    qsort((char *)(list + lt), equal_size, sizeof(size_t), compare);
+	  equal_size = 0;
+	}
+
+      if ((equal_size >= less_size) && (equal_size >= more_size))
+	{
+	  multikey_sort(list, less_size, depth);
+	  multikey_sort(list + gt, more_size, depth);
+	  list += lt;
+	  list_size = equal_size;
+	  depth++;
+	}
+      else if (less_size >= more_size)
+	{
+	  if (equal_size > 1) multikey_sort(list + lt, equal_size, depth + 1);
+	  multikey_sort(list + gt, more_size, depth);
+	  list_size = less_size;
+	}
+      else
+	{
+	  multikey_sort(list, less_size, depth);
+	  if (equal_size > 1) multikey_sort(list + lt, equal_size, depth + 1);
+	  list += gt;
+	  list_size = more_size;
+	}
+    }
+
+#undef KEY
+#undef SWAP
+}
+
 /*****************************************************************************
  * Function:
  *	sort_function_names
  *
- * Sort the array of function records into alphabetical order into the
- * array sorted_functions[].
+ * Sort the function records into alphabetical order.  The records
+ * themselves stay where they are - sorted_functions[] holds their
+ * indexes in functions[].
  */
 void
 sort_function_names(void)
 
 {
-  unsigned short every_function;
-
-  size_t size_needed = function_list_size * sizeof(function_entry);
+  size_t every_function;
 
-  if (function_list_size == 0) return;
+  if (no_of_functions == 0) return;
 
-  sorted_functions = xmalloc(size_needed);
+  sorted_functions = xmalloc(no_of_functions * sizeof(size_t));
 
   for (every_function=0;every_function<no_of_functions;every_function++)
-    sorted_functions[every_function] = functions[every_function];
-  qsort((char *)sorted_functions,(int)no_of_functions,sizeof(function_entry),compare);
+    sorted_functions[every_function] = every_function;
+  multikey_sort(sorted_functions, no_of_functions, 0);
+
+  dm('i',1,"index.c:sort_function_names() %lu functions, %lu distinct names, %lu bytes of index\n",
+     (unsigned long)no_of_functions, (unsigned long)no_of_names,
+     (unsigned long)(function_list_size * sizeof(function_entry)
+		     + no_of_functions * sizeof(size_t)
+		     + names_size
+		     + name_table_size * sizeof(size_t)));
+}
+
+/*****************************************************************************
+ * Function:
+ *	next_indexed_function
+ *
+ * Returns the first entry in sorted_functions, from function_idx on,
+ * that belongs in the function index.  With --changed-pages-only that
+ * is only the functions that have changed.
+ */
+static size_t
+next_indexed_function(size_t function_idx)
+
+{
+  if (changed_pages_only)
+    while ((function_idx < no_of_functions)
+	   && !functions[sorted_functions[function_idx]].changed)
+      function_idx += 1;
+
+  return function_idx;
 }
 
 /*****************************************************************************
@@ -482,15 +870,16 @@ void
 print_index(void)
 
 {
-  unsigned short function_idx=0;
+  size_t function_idx=0;
   long index_page_number=0;
   short output_line_number;
+  long index_line_number=0;
   boolean reached_end_of_sheet;
 
   /*
    * If there is nothing to print, then print nothing...
    */
-  if (no_of_functions == 0) return;
+  if ((function_idx = next_indexed_function(0)) == no_of_functions) return;
 
   /*
    * For every page...
@@ -518,25 +907,26 @@ print_index(void)
 	  /*
 	   * Every second line has dots in it...
 	   */
-	  if ((function_idx & 1) == 1)
+	  if ((index_line_number & 1) == 1)
 	    {
 	      sprintf(output_line,"          %-24s %4ld  (%s)",
-			    sorted_functions[function_idx].name,
-			    sorted_functions[function_idx].page_number,
-			    sorted_functions[function_idx].filename);
+			    names + functions[sorted_functions[function_idx]].name,
+			    functions[sorted_functions[function_idx]].page_number,
+			    names + functions[sorted_functions[function_idx]].filename);
 	      dot_fill(output_line); 
 	      printf("Lpt(%s) show Nl\n",output_line);
 	    }
 	  else
 	    {
 	      sprintf(output_line,"          %-24s %4ld  (%s)\n",
-			    sorted_functions[function_idx].name,
-			    sorted_functions[function_idx].page_number,
-			    sorted_functions[function_idx].filename);
+			    names + functions[sorted_functions[function_idx]].name,
+			    functions[sorted_functions[function_idx]].page_number,
+			    names + functions[sorted_functions[function_idx]].filename);
 	      printf("Lpt(%s) show Nl\n",output_line);
 	    }
 	  output_line_number += 1;
-	  function_idx += 1;
+	  index_line_number += 1;
+	  function_idx = next_indexed_function(function_idx + 1);
 	}
 	
       /*
@@ -570,8 +960,9 @@ print_index_line(int print_bold)
 
 {
   static unsigned int	current_file = 0;
-  static unsigned short	function_idx = 0;
+  static size_t		function_idx = 0;
   static boolean          first_call = TRUE;
+  static size_t		current_file_name;
 
   /*
    * If we haven't started printing out functions for a file
@@ -584,6 +975,7 @@ print_index_line(int print_bold)
       printf("Lpt(    %-24s %5ld) BF setfont show CF setfont Nl\n",
 		   files[current_file].name,
 		   files[current_file].starting_page);
+      current_file_name = intern_name(files[current_file].name);
       first_call = FALSE;
       return(LINE);
     }
@@ -595,7 +987,7 @@ print_index_line(int print_bold)
    */
   while (function_idx != no_of_functions)
     {
-      if (strcmp(files[current_file].name, sorted_functions[function_idx].filename) != 0)
+      if (current_file_name != functions[sorted_functions[function_idx]].filename)
 	{
 	  /* if no match and not reached end continue with the next function name */
 	  function_idx += 1;
@@ -619,6 +1011,7 @@ print_index_line(int print_bold)
       printf("Lpt(    %-24s %5ld) BF setfont show CF setfont Nl\n",
 		   files[current_file].name,
 		   files[current_file].starting_page);
+      current_file_name = intern_name(files[current_file].name);
       function_idx = 0;
       return(LINE);
     }
@@ -632,8 +1025,8 @@ print_index_line(int print_bold)
       char	string[INPUT_LINE_LEN];
 
       sprintf(string,"          %-24s %4ld",
-		    sorted_functions[function_idx].name,
-		    sorted_functions[function_idx].page_number);
+		    names + functions[sorted_functions[function_idx]].name,
+		    functions[sorted_functions[function_idx]].page_number);
       dot_fill(string);
 
       printf("Lpt(%s) show Nl\n",string);
@@ -641,8 +1034,8 @@ print_index_line(int print_bold)
   else
     {
       printf("Lpt(          %-24s %4ld) show Nl\n",
-		   sorted_functions[function_idx].name,
-		   sorted_functions[function_idx].page_number);
+		   names + functions[sorted_functions[function_idx]].name,
+		   functions[sorted_functions[function_idx]].page_number);
     }
   function_idx += 1;
   return(LINE);
@@ -8,6 +8,8 @@ extern void add_file(char *filename, unsigned int this_file_number, long this_fi
 extern void end_file(unsigned int this_file_number, long this_file_page_number);
 extern void add_function(char *name, long start, long end, long page, char *filename);
 extern void end_function(long page);
+extern size_t no_of_indexed_functions(void);
+extern void get_indexed_function(size_t function, char **name, long *start, long *end, long *page, long *end_page);
 extern char_status get_function_name_posn(long current_char, char_status status);
 extern char *get_function_name(long page);
 extern char *file_name(int file_number);
@@ -0,0 +1,478 @@
+/*
+ * Source file:
+ *	inflate.c
+ *
+ * A decoder for the deflate format (RFC 1951) inside a zlib wrapper
+ * (RFC 1950), which is how git stores its objects.  It's the decoding
+ * counterpart of encode.c: small and self-contained, so that reading a
+ * git repository doesn't need zlib.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trueprint.h"
+#include "utils.h"
+#include "debug.h"
+
+#include "inflate.h"
+
+/*
+ * Private part
+ */
+#define MAX_BITS	15
+#define MAX_LIT_CODES	288
+#define MAX_DIST_CODES	30
+#define FIXED_LIT_CODES	288
+#define FIXED_DIST_CODES 30
+
+/*
+ * A canonical Huffman code, as counts of codes of each length and the
+ * symbols in code order.
+ */
+typedef struct {
+  short	count[MAX_BITS+1];
+  short	symbol[MAX_LIT_CODES];
+} huffman;
+
+typedef struct {
+  const unsigned char	*in;
+  size_t		in_size;
+  size_t		in_used;
+  unsigned long		bits;
+  int			no_of_bits;
+  unsigned char		*out;
+  size_t		out_size;
+  size_t		out_used;
+  boolean		failed;
+} inflate_state;
+
+static const short length_base[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const short length_extra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const short dist_base[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577 };
+static const short dist_extra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/* The order code length code lengths are sent in */
+static const short length_order[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static unsigned int get_bits(inflate_state *s, int need);
+static void put_byte(inflate_state *s, unsigned char byte);
+static boolean build_huffman(huffman *h, const short *lengths, int no_of_symbols);
+static int decode(inflate_state *s, const huffman *h);
+static void stored_block(inflate_state *s);
+static void compressed_block(inflate_state *s, const huffman *lit, const huffman *dist);
+static void fixed_block(inflate_state *s);
+static void dynamic_block(inflate_state *s);
+
+/*****************************************************************************
+ * Function:
+ *	get_bits
+ *
+ * Returns the next need bits, least significant first.  Running out of
+ * input marks the stream as failed.
+ */
+static unsigned int
+get_bits(inflate_state *s, int need)
+{
+  unsigned long value = s->bits;
+
+  while (s->no_of_bits < need)
+    {
+      if (s->in_used == s->in_size)
+	{
+	  s->failed = TRUE;
+	  return 0;
+	}
+      value |= (unsigned long)s->in[s->in_used++] << s->no_of_bits;
+      s->no_of_bits += 8;
+    }
+
+  s->bits = value >> need;
+  s->no_of_bits -= need;
+  return (unsigned int)(value & ((1UL << need) - 1));
+}
+
+/*****************************************************************************
+ * Function:
+ *	put_byte
+ */
+static void
+put_byte(inflate_state *s, unsigned char byte)
+{
+  if (s->out_used == s->out_size)
+    {
+      s->out_size = (s->out_size < 1024) ? 1024 : s->out_size * 2;
+      s->out = xrealloc(s->out, s->out_size);
+    }
+  s->out[s->out_used++] = byte;
+}
+
+/*****************************************************************************
+ * Function:
+ *	build_huffman
+ *
+ * Builds the code from a list of code lengths.  Returns FALSE if the
+ * lengths ask for more codes than there are.
+ */
+static boolean
+build_huffman(huffman *h, const short *lengths, int no_of_symbols)
+{
+  short	offsets[MAX_BITS+1];
+  int	symbol;
+  int	length;
+  int	left = 1;
+
+  memset(h->count, 0, sizeof(h->count));
+  for (symbol = 0; symbol < no_of_symbols; symbol++)
+    h->count[lengths[symbol]]++;
+
+  for (length = 1; length <= MAX_BITS; length++)
+    {
+      left = (left << 1) - h->count[length];
+      if (left < 0) return FALSE;
+    }
+
+  offsets[1] = 0;
+  for (length = 1; length < MAX_BITS; length++)
+    offsets[length + 1] = offsets[length] + h->count[length];
+
+  for (symbol = 0; symbol < no_of_symbols; symbol++)
+    if (lengths[symbol] != 0)
+      h->symbol[offsets[lengths[symbol]]++] = (short)symbol;
+
+  return TRUE;
+}
+
+/*****************************************************************************
+ * Function:
+ *	decode
+ *
+ * Reads one symbol.  Canonical codes of each length are consecutive, so
+ * the code read so far can be checked against the range for its length
+ * a bit at a time.
+ */
+static int
+decode(inflate_state *s, const huffman *h)
+{
+  int	code = 0;
+  int	first = 0;
+  int	index = 0;
+  int	length;
+
+  for (length = 1; length <= MAX_BITS; length++)
+    {
+      int count = h->count[length];
+
+      code |= (int)get_bits(s, 1);
+      if (s->failed) return -1;
+      if (code - count < first)
+	return h->symbol[index + (code - first)];
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+
+  s->failed = TRUE;
+  return -1;
+}
+
+/*****************************************************************************
+ * Function:
+ *	stored_block
+ */
+static void
+stored_block(inflate_state *s)
+{
+  size_t length;
+
+  /* Stored blocks start on a byte boundary */
+  s->bits = 0;
+  s->no_of_bits = 0;
+
+  if (s->in_used + 4 > s->in_size)
+    {
+      s->failed = TRUE;
+      return;
+    }
+  length = s->in[s->in_used] | (s->in[s->in_used+1] << 8);
+  if ((length ^ 0xffff) != (size_t)(s->in[s->in_used+2] | (s->in[s->in_used+3] << 8)))
+    {
+      s->failed = TRUE;
+      return;
+    }
+  s->in_used += 4;
+
+  if (s->in_used + length > s->in_size)
+    {
+      s->failed = TRUE;
+      return;
+    }
+  while (s->out_used + length > s->out_size)
+    {
+      s->out_size = (s->out_size < 1024) ? 1024 : s->out_size * 2;
+      s->out = xrealloc(s->out, s->out_size);
+    }
+  memcpy(s->out + s->out_used, s->in + s->in_used, length);
+  s->out_used += length;
+  s->in_used += length;
+}
+
+/*****************************************************************************
+ * Function:
+ *	compressed_block
+ *
+ * Decodes literals and length/distance pairs until the end of block
+ * code.
+ */
+static void
+compressed_block(inflate_state *s, const huffman *lit, const huffman *dist)
+{
+  for (;;)
+    {
+      int	symbol = decode(s, lit);
+      size_t	length;
+      size_t	distance;
+
+      if (s->failed) return;
+
+      if (symbol < 256)
+	{
+	  put_byte(s, (unsigned char)symbol);
+	  continue;
+	}
+      if (symbol == 256) return;
+
+      symbol -= 257;
+      if (symbol >= 29)
+	{
+	  s->failed = TRUE;
+	  return;
+	}
+      length = length_base[symbol] + get_bits(s, length_extra[symbol]);
+
+      symbol = decode(s, dist);
+      if (s->failed || (symbol >= 30))
+	{
+	  s->failed = TRUE;
+	  return;
+	}
+      distance = dist_base[symbol] + get_bits(s, dist_extra[symbol]);
+      if (s->failed || (distance > s->out_used))
+	{
+	  s->failed = TRUE;
+	  return;
+	}
+
+      /* The copy may overlap what it is writing, so go a byte at a time */
+      while (length-- > 0)
+	put_byte(s, s->out[s->out_used - distance]);
+    }
+}
+
+/*****************************************************************************
+ * Function:
+ *	fixed_block
+ */
+static void
+fixed_block(inflate_state *s)
+{
+  static huffman	lit, dist;
+  static boolean	built = FALSE;
+
+  if (!built)
+    {
+      short	lengths[FIXED_LIT_CODES];
+      int	symbol;
+
+      for (symbol = 0; symbol < 144; symbol++) lengths[symbol] = 8;
+      for (; symbol < 256; symbol++) lengths[symbol] = 9;
+      for (; symbol < 280; symbol++) lengths[symbol] = 7;
+      for (; symbol < FIXED_LIT_CODES; symbol++) lengths[symbol] = 8;
+      build_huffman(&lit, lengths, FIXED_LIT_CODES);
+
+      for (symbol = 0; symbol < FIXED_DIST_CODES; symbol++) lengths[symbol] = 5;
+      build_huffman(&dist, lengths, FIXED_DIST_CODES);
+
+      built = TRUE;
+    }
+
+  compressed_block(s, &lit, &dist);
+}
+
+/*****************************************************************************
+ * Function:
+ *	dynamic_block
+ *
+ * Reads the codes for the block, themselves Huffman coded, and then
+ * the block.
+ */
+static void
+dynamic_block(inflate_state *s)
+{
+  short		lengths[MAX_LIT_CODES + MAX_DIST_CODES];
+  huffman	lit, dist;
+  int		no_of_lit, no_of_dist, no_of_lengths;
+  int		index;
+
+  no_of_lit = (int)get_bits(s, 5) + 257;
+  no_of_dist = (int)get_bits(s, 5) + 1;
+  no_of_lengths = (int)get_bits(s, 4) + 4;
+  if (s->failed || (no_of_lit > 286) || (no_of_dist > MAX_DIST_CODES))
+    {
+      s->failed = TRUE;
+      return;
+    }
+
+  for (index = 0; index < 19; index++)
+    lengths[length_order[index]] = (index < no_of_lengths) ? (short)get_bits(s, 3) : 0;
+  if (s->failed || !build_huffman(&lit, lengths, 19))
+    {
+      s->failed = TRUE;
+      return;
+    }
+
+  index = 0;
+  while (index < no_of_lit + no_of_dist)
+    {
+      int	symbol = decode(s, &lit);
+      short	repeat_length = 0;
+      int	repeat;
+
+      if (s->failed) return;
+
+      if (symbol < 16)
+	{
+	  lengths[index++] = (short)symbol;
+	  continue;
+	}
+
+      if (symbol == 16)
+	{
+	  if (index == 0)
+	    {
+	      s->failed = TRUE;
+	      return;
+	    }
+	  repeat_length = lengths[index - 1];
+	  repeat = 3 + (int)get_bits(s, 2);
+	}
+      else if (symbol == 17)
+	repeat = 3 + (int)get_bits(s, 3);
+      else
+	repeat = 11 + (int)get_bits(s, 7);
+
+      if (s->failed || (index + repeat > no_of_lit + no_of_dist))
+	{
+	  s->failed = TRUE;
+	  return;
+	}
+      while (repeat-- > 0)
+	lengths[index++] = repeat_length;
+    }
+
+  if ((lengths[256] == 0)
+      || !build_huffman(&lit, lengths, no_of_lit)
+      || !build_huffman(&dist, lengths + no_of_lit, no_of_dist))
+    {
+      s->failed = TRUE;
+      return;
+    }
+
+  compressed_block(s, &lit, &dist);
+}
+
+/*****************************************************************************
+ * Function:
+ *	inflate_zlib
+ *
+ * Decompresses a zlib stream of in_size bytes or fewer.  expected_size
+ * is a hint for the size of the result, or 0.  On success returns TRUE
+ * with the result in *out, which the caller frees, and its length in
+ * *out_size, with a spare byte after it.  The Adler-32 checksum at the
+ * end is checked.
+ */
+boolean
+inflate_zlib(const unsigned char *in, size_t in_size, size_t expected_size,
+	     unsigned char **out, size_t *out_size)
+{
+  inflate_state	s;
+  boolean	last_block;
+  unsigned long	adler_a = 1, adler_b = 0, checksum;
+  size_t	position;
+
+  /*
+   * Deflate compression, no preset dictionary, and a header that is a
+   * multiple of 31
+   */
+  if ((in_size < 6)
+      || ((in[0] & 0x0f) != 8)
+      || (in[1] & 0x20)
+      || ((((unsigned int)in[0] << 8) | in[1]) % 31 != 0))
+    return FALSE;
+
+  s.in = in;
+  s.in_size = in_size;
+  s.in_used = 2;
+  s.bits = 0;
+  s.no_of_bits = 0;
+  s.out_size = expected_size + 1;
+  s.out = xmalloc(s.out_size);
+  s.out_used = 0;
+  s.failed = FALSE;
+
+  do
+    {
+      last_block = (boolean)get_bits(&s, 1);
+      switch (get_bits(&s, 2))
+	{
+	case 0: stored_block(&s); break;
+	case 1: fixed_block(&s); break;
+	case 2: dynamic_block(&s); break;
+	default: s.failed = TRUE;
+	}
+    }
+  while (!last_block && !s.failed);
+
+  if (s.failed || (s.in_used + 4 > in_size))
+    {
+      dm('d',2,"inflate.c:inflate_zlib() Bad compressed data\n");
+      free(s.out);
+      return FALSE;
+    }
+
+  /* The checksum starts on the next byte boundary */
+  for (position = 0; position < s.out_used; position++)
+    {
+      adler_a = (adler_a + s.out[position]) % 65521;
+      adler_b = (adler_b + adler_a) % 65521;
+    }
+  checksum = ((unsigned long)in[s.in_used] << 24) | ((unsigned long)in[s.in_used+1] << 16)
+    | ((unsigned long)in[s.in_used+2] << 8) | in[s.in_used+3];
+  if (checksum != ((adler_b << 16) | adler_a))
+    {
+      dm('d',2,"inflate.c:inflate_zlib() Checksum doesn't match\n");
+      free(s.out);
+      return FALSE;
+    }
+
+  /* Leave room for the caller to terminate text */
+  if (s.out_used == s.out_size)
+    s.out = xrealloc(s.out, s.out_size + 1);
+
+  *out = s.out;
+  *out_size = s.out_used;
+  return TRUE;
+}
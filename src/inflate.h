@@ -0,0 +1,7 @@
+/*
+ * Include file:
+ *	inflate.h
+ */
+
+extern boolean inflate_zlib(const unsigned char *in, size_t in_size, size_t expected_size,
+			    unsigned char **out, size_t *out_size);
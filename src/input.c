@@ -30,6 +30,7 @@ int read(int fildes, void *buf, unsigned int nbyte);
  * Public part
  */
 long	char_number;
+long	input_bytes;	/* read so far in this pass */
 int	got_some_input;
 
 /*
@@ -45,6 +46,9 @@ static char *unget_charstackbase;
 static char *unget_statstackbase;
 static unsigned short unget_stackdepth;
 static int	input_stream;
+static char	input_buffer[BUFFER_SIZE];
+static short	buffer_pointer = 0;
+static int	buffer_size = 0;
 
 /* My private version of getchar */
 static stream_status buffered_read(char *input_char);
@@ -105,6 +109,7 @@ init_input(void)
 
 {
   char_number = -1;
+  input_bytes = 0;
 }
 
 /*
@@ -119,10 +124,6 @@ stream_status
 buffered_read(char *input_char)
 
 {
-  static char	input_buffer[BUFFER_SIZE];
-  static short	buffer_pointer = 0;
-  static int	buffer_size=0;
-
   /*
    * If there's nothing in the buffer, read it in - this will
    * happen the first time this function is called and at the
@@ -141,6 +142,7 @@ buffered_read(char *input_char)
       /* Set the global flag to indicate that there is at least some input */
       got_some_input = 1;
       buffer_pointer = 0;
+      input_bytes += buffer_size;
     }
 
   *input_char = input_buffer[buffer_pointer++];
@@ -162,6 +164,7 @@ buffered_read(char *input_char)
        * Reset the buffer
        */
       buffer_pointer = 0;
+      input_bytes += buffer_size;
     }
 
   /*
@@ -178,6 +181,27 @@ buffered_read(char *input_char)
 
 }
 
+/*
+ * Function:
+ *	input_prefix
+ *
+ * Points prefix at the start of the current file as it has already been
+ * read into the input buffer, and returns the number of bytes available.
+ * Only meaningful straight after set_input_stream(), before any of the
+ * file has been consumed - used to sniff the language of a file without
+ * reading it again.
+ */
+size_t
+input_prefix(char **prefix)
+
+{
+  *prefix = input_buffer;
+
+  if (buffer_size <= 0) return 0;
+
+  return (size_t)buffer_size;
+}
+
 /*
  * Function:
  *	ungetnextchar
@@ -4,6 +4,7 @@
  */
 
 extern long		char_number;
+extern long		input_bytes;
 extern int		got_some_input;
 
 extern boolean set_input_stream(int);
@@ -11,3 +12,4 @@ extern stream_status	getnextchar(char *);
 extern void ungetnextchar(char, stream_status);
 extern void setup_input(void);
 extern void init_input(void);
+extern size_t input_prefix(char **);
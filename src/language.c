@@ -5,12 +5,26 @@
 
 #include "config.h"
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifndef O_RDONLY
+# define O_RDONLY 0
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
 #include "trueprint.h"
 #include "main.h"
+#include "debug.h"
+#include "input.h"
 #include "lang_c.h"
 #include "lang_cxx.h"
 #include "lang_report.h"
@@ -63,13 +77,59 @@ typedef enum {
   VERILOG
 } languages;
 
+/*
+ * Only this much of the start of a file is looked at when the filename
+ * doesn't give the language away.
+ */
+#define SNIFF_LENGTH	512
+
+/*
+ * Names used for languages in #! lines and in emacs or vi modelines.
+ */
+static struct {
+  char		*name;
+  languages	language;
+} language_names[] = {
+  { "c",		C },
+  { "c++",		CXX },
+  { "cpp",		CXX },
+  { "cxx",		CXX },
+  { "java",		JAVA },
+  { "pascal",		PASCAL },
+  { "perl",		PERL },
+  { "cperl",		PERL },
+  { "pike",		PIKE },
+  { "verilog",		VERILOG },
+  { "sh",		SHELL },
+  { "shell-script",	SHELL },
+  { "bash",		SHELL },
+  { "ksh",		SHELL },
+  { "zsh",		SHELL },
+  { "dash",		SHELL },
+  { "ash",		SHELL },
+  { "csh",		SHELL },
+  { "tcsh",		SHELL },
+  { NULL,		NO_LANGUAGE }
+};
+
 get_char_fn 	get_char;
 
 static languages language;
 
+/*
+ * The language of each file, indexed by file number, so that each
+ * file is only classified once per run.
+ */
+static languages *file_languages;
+
 static void set_language_opt(const char *prefix, const char *option, char *value);
 static void set_language_default(char *value);
 static languages filename_to_language(char *);
+static languages file_language(char *filename, unsigned int this_file_number, boolean input_ready);
+static languages sniff_language(char *prefix, size_t length);
+static languages interpreter_language(char *line, char *line_end);
+static languages modeline_language(char *line, char *line_end);
+static languages name_to_language(char *name, size_t length, boolean allow_version);
 
 /******************************************************************************
  * Function: 
@@ -79,6 +139,7 @@ void
 setup_language(void)
 {
   language = NO_LANGUAGE;
+  file_languages = NULL;
 
   string_option("t", "language", NULL, NULL, &set_language_opt, &set_language_default,
 		OPT_MISC,
@@ -134,7 +195,7 @@ filename_to_language(char *filename)
   dm('l',2,"Finding language for filename %s\n",filename);
   if ((suffix = strrchr(filename,'.')) == (char *)0)
     {
-      retval = TEXT;
+      retval = NO_LANGUAGE;
     }
   else
     {
@@ -160,7 +221,7 @@ filename_to_language(char *filename)
       else if (strcmp(suffix,".pike") == 0) retval = PIKE;
       else if (strcmp(suffix,".java") == 0) retval = JAVA;
       else if (strcmp(suffix,".lst") == 0) retval = LIST;
-      else retval = TEXT;
+      else retval = NO_LANGUAGE;
     }
 
   dm('l',2,"Language is %d\n",retval);
@@ -168,9 +229,259 @@ filename_to_language(char *filename)
   return retval;
 }
 
+/******************************************************************************
+ * Function:
+ *	file_language
+ * Works out the language of a file from its suffix or, failing that, from
+ * the first few hundred bytes of the file.  The answer is remembered so
+ * that each file is only classified once, however many times it is asked
+ * for.
+ * input_ready says that the file is the current input stream, so its
+ * start is already sitting in the input buffer; otherwise the start of
+ * the file is read directly.  Stdin can only be looked at once it is
+ * the current input stream.
+ */
+languages
+file_language(char *filename, unsigned int this_file_number, boolean input_ready)
+
+{
+  languages retval;
+  char buffer[SNIFF_LENGTH];
+  char *prefix = buffer;
+  size_t length = 0;
+  unsigned int file_index;
+
+  if (file_languages == NULL)
+    {
+      file_languages = xmalloc(no_of_files * sizeof(languages));
+      for (file_index = 0; file_index < no_of_files; file_index++)
+	file_languages[file_index] = NO_LANGUAGE;
+    }
+
+  if (file_languages[this_file_number] != NO_LANGUAGE)
+    return file_languages[this_file_number];
+
+  if ((retval = filename_to_language(filename)) == NO_LANGUAGE)
+    {
+      if (input_ready)
+	{
+	  length = input_prefix(&prefix);
+	  if (length > SNIFF_LENGTH) length = SNIFF_LENGTH;
+	}
+      else if (strcmp(filename, "-") == 0)
+	{
+	  dm('l',2,"Cannot look at stdin yet, assuming text\n");
+	  return TEXT;
+	}
+      else
+	{
+	  int stream;
+
+	  if ((stream = open(filename, O_RDONLY)) != -1)
+	    {
+	      ssize_t got = read(stream, buffer, SNIFF_LENGTH);
+	      if (got > 0) length = (size_t)got;
+	      close(stream);
+	    }
+	}
+
+      if ((retval = sniff_language(prefix, length)) == NO_LANGUAGE)
+	retval = TEXT;
+    }
+
+  dm('l',2,"Language for file %d (%s) is %d\n", this_file_number, filename, retval);
+
+  file_languages[this_file_number] = retval;
+
+  return retval;
+}
+
+/******************************************************************************
+ * Function:
+ *	sniff_language
+ * Looks for a #! line or an emacs or vi modeline in the first few lines
+ * of a file.  Returns NO_LANGUAGE if nothing gives the language away.
+ */
+languages
+sniff_language(char *prefix, size_t length)
+
+{
+  char *line = prefix;
+  char *prefix_end = prefix + length;
+  char *line_end;
+  languages retval;
+
+  if (length == 0) return NO_LANGUAGE;
+
+  while (line < prefix_end)
+    {
+      line_end = memchr(line, '\n', (size_t)(prefix_end - line));
+      if (line_end == NULL) line_end = prefix_end;
+
+      if ((line == prefix) && (line_end - line > 2)
+	  && (line[0] == '#') && (line[1] == '!'))
+	{
+	  if ((retval = interpreter_language(line + 2, line_end)) != NO_LANGUAGE)
+	    {
+	      dm('l',2,"Language from #! line is %d\n", retval);
+	      return retval;
+	    }
+	}
+
+      if ((retval = modeline_language(line, line_end)) != NO_LANGUAGE)
+	{
+	  dm('l',2,"Language from modeline is %d\n", retval);
+	  return retval;
+	}
+
+      line = line_end + 1;
+    }
+
+  return NO_LANGUAGE;
+}
+
+/******************************************************************************
+ * Function:
+ *	interpreter_language
+ * Finds the language for the interpreter named in a #! line, looking
+ * through /usr/bin/env.
+ */
+languages
+interpreter_language(char *line, char *line_end)
+
+{
+  char *word;
+  char *base;
+  languages retval = NO_LANGUAGE;
+
+  while (line < line_end)
+    {
+      while ((line < line_end) && isspace((unsigned char)*line)) line++;
+
+      word = line;
+      while ((line < line_end) && !isspace((unsigned char)*line)) line++;
+      if (line == word) break;
+
+      /* Skip over interpreter options, e.g. #!/usr/bin/env -S perl -w */
+      if (*word == '-') continue;
+
+      for (base = line; (base > word) && (base[-1] != '/'); base--)
+	;
+
+      if ((line - base == 3) && (strncmp(base, "env", 3) == 0))
+	continue;
+
+      retval = name_to_language(base, (size_t)(line - base), TRUE);
+      break;
+    }
+
+  return retval;
+}
+
+/******************************************************************************
+ * Function:
+ *	modeline_language
+ * Finds the language given by an emacs modeline, e.g. -*- mode: c++ -*-
+ * or -*- C++ -*-, or by a vi modeline, e.g. vim: set ft=perl:
+ */
+languages
+modeline_language(char *line, char *line_end)
+
+{
+  char *start;
+  char *end;
+  char *s;
+
+  /*
+   * Emacs modeline
+   */
+  for (s = line; s + 3 <= line_end; s++)
+    {
+      if (strncmp(s, "-*-", 3) != 0) continue;
+
+      start = s + 3;
+      for (end = start; (end + 3 <= line_end) && (strncmp(end, "-*-", 3) != 0); end++)
+	;
+      if (end + 3 > line_end) break;
+
+      /* Look for a mode: variable, otherwise the whole thing is the mode */
+      for (s = start; s + 5 <= end; s++)
+	if (strncasecmp(s, "mode:", 5) == 0)
+	  {
+	    start = s + 5;
+	    break;
+	  }
+
+      while ((start < end) && isspace((unsigned char)*start)) start++;
+      for (s = start; (s < end) && (*s != ';') && !isspace((unsigned char)*s); s++)
+	;
+
+      return name_to_language(start, (size_t)(s - start), FALSE);
+    }
+
+  /*
+   * vi modeline
+   */
+  for (s = line; s + 3 <= line_end; s++)
+    {
+      if ((strncmp(s, "vi:", 3) != 0)
+	  && ((s + 4 > line_end) || ((strncmp(s, "vim:", 4) != 0) && (strncmp(s, "ex:", 3) != 0))))
+	continue;
+
+      for (; s < line_end; s++)
+	{
+	  if ((s + 3 <= line_end) && (strncmp(s, "ft=", 3) == 0))
+	    start = s + 3;
+	  else if ((s + 9 <= line_end) && (strncmp(s, "filetype=", 9) == 0))
+	    start = s + 9;
+	  else if ((s + 7 <= line_end) && (strncmp(s, "syntax=", 7) == 0))
+	    start = s + 7;
+	  else
+	    continue;
+
+	  for (end = start; (end < line_end) && (isalnum((unsigned char)*end) || (*end == '+')); end++)
+	    ;
+	  return name_to_language(start, (size_t)(end - start), FALSE);
+	}
+      break;
+    }
+
+  return NO_LANGUAGE;
+}
+
+/******************************************************************************
+ * Function:
+ *	name_to_language
+ * Looks up a language name from language_names[], ignoring case.  If
+ * allow_version is set then a trailing version number is ignored, so
+ * that perl5 is recognised as perl.
+ */
+languages
+name_to_language(char *name, size_t length, boolean allow_version)
+
+{
+  unsigned short name_index;
+
+  if (allow_version)
+    while ((length > 0) && (isdigit((unsigned char)name[length-1]) || (name[length-1] == '.')))
+      length--;
+
+  if (length == 0) return NO_LANGUAGE;
+
+  for (name_index = 0; language_names[name_index].name; name_index++)
+    {
+      if ((strlen(language_names[name_index].name) == length)
+	  && (strncasecmp(language_names[name_index].name, name, length) == 0))
+	return language_names[name_index].language;
+    }
+
+  return NO_LANGUAGE;
+}
+
 /******************************************************************************
  * Function: 
  *	language_defaults
+ * Returns the default options for the language of the first file.
  */
 char *
 language_defaults(char *filename)
@@ -178,7 +489,7 @@ language_defaults(char *filename)
 {
   char *retval;
 
-  switch((language!=NO_LANGUAGE) ? language : filename_to_language(filename))
+  switch((language!=NO_LANGUAGE) ? language : file_language(filename, 0, FALSE))
     {
     case C: 		retval = lang_c_defaults;	break;
     case VERILOG:	retval = lang_verilog_defaults;	break;
@@ -199,6 +510,30 @@ language_defaults(char *filename)
   return retval;
 }
 
+/******************************************************************************
+ * Function:
+ *	compile_language_defaults
+ * Compiles the default options for every language, for a server or a
+ * batch that doesn't yet know which languages its jobs will need.
+ */
+void
+compile_language_defaults(void)
+
+{
+  compile_string_options(lang_c_defaults);
+  compile_string_options(lang_verilog_defaults);
+  compile_string_options(lang_cxx_defaults);
+  compile_string_options(lang_pc_defaults);
+  compile_string_options(lang_report_defaults);
+  compile_string_options(lang_sh_defaults);
+  compile_string_options(lang_pascal_defaults);
+  compile_string_options(lang_perl_defaults);
+  compile_string_options(lang_pike_defaults);
+  compile_string_options(lang_java_defaults);
+  compile_string_options(lang_text_defaults);
+  compile_string_options(lang_list_defaults);
+}
+
 /******************************************************************************
  * Function: 
  *	set_get_char
@@ -216,7 +551,7 @@ set_get_char(char *filename)
    */
   restart_language = TRUE;
 
-  switch((language!=NO_LANGUAGE) ? language : filename_to_language(filename))
+  switch((language!=NO_LANGUAGE) ? language : file_language(filename, file_number, TRUE))
     {
     case C:		get_char = get_c_char;		break;
     case VERILOG:	get_char = get_verilog_char;	break;
@@ -12,4 +12,5 @@ extern char *language_list;
 
 extern void setup_language(void);
 extern char *language_defaults(char *);
+extern void compile_language_defaults(void);
 extern void set_get_char(char *);
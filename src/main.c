@@ -58,8 +58,14 @@ int dup(int fildes);
 #include "openpipe.h"
 #include "printers_fl.h"
 #include "print_prompt.h"
+#include "reprint.h"
 #include "input.h"
 #include "headers.h"
+#include "batch.h"
+#include "server.h"
+#include "archive.h"
+#include "progress.h"
+#include "prefetch.h"
 #include "utils.h"
 
 #include "main.h"
@@ -91,6 +97,9 @@ static short	no_of_copies;
 static char	**file_names;
 static char     *output_filename;
 static boolean	redirect_output;
+static char	*server_socket;
+static char	*batch_file;
+static short	batch_workers;
 
 /*
  * Functions
@@ -102,6 +111,8 @@ static void set_dest(const char *p, const char *o, char *value);
 static void set_dest_default(char *value);
 static void print_help(const char *p, const char *o, char *value);
 static void print_version(const char *p, const char *o);
+static void prepare_jobs(void);
+static boolean can_send_job(int argc, char **argv);
 
 #ifdef LOGTOOL
 static void write_log(void);
@@ -128,6 +139,18 @@ int main(int argc, char **argv)
 #ifdef MSWIN
   FILE			*pipe_fhandle = NULL;
 #endif
+  char			*tp_server = getenv("TP_SERVER");
+
+  /*
+   * If a server is running then let it do the job.  If it can't be
+   * reached then carry on and do the job here.
+   */
+  if ((tp_server != NULL) && (*tp_server != '\0') && can_send_job(argc, argv))
+    {
+      int exit_code = send_job(tp_server, argc, argv);
+
+      if (exit_code != -1) return exit_code;
+    }
 
   /*
    * Need to set this here as it is used by setup_printers_fl()
@@ -149,6 +172,10 @@ int main(int argc, char **argv)
   setup_postscript();
   setup_printers_fl();
   setup_print_prompter();
+  setup_reprint();
+  setup_archive();
+  setup_progress();
+  setup_prefetch();
   setup_main();
 
   /*
@@ -167,6 +194,40 @@ int main(int argc, char **argv)
    */
   last_param_used = handle_options(argc, argv);
 
+  /*
+   * In server and batch modes everything so far is done once, and each
+   * job starts from here in a process of its own.  Options given along
+   * with --batch have already been set, so they apply to every job.
+   */
+  if ((server_socket != NULL) && (*server_socket != '\0'))
+    {
+      if (argc != 2)
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": --server cannot be used with other options or files\n"));
+	  exit(1);
+	}
+
+      prepare_jobs();
+      serve(server_socket, &argc, &argv);
+
+      setup_printers_fl();
+      last_param_used = handle_options(argc, argv);
+    }
+  else if ((batch_file != NULL) && (*batch_file != '\0'))
+    {
+      if (last_param_used < (unsigned int)argc)
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": files must be given in the batch file, not with --batch\n"));
+	  exit(1);
+	}
+
+      prepare_jobs();
+      run_batch(batch_file, batch_workers, &argc, &argv);
+
+      setup_printers_fl();
+      last_param_used = handle_options(argc, argv);
+    }
+
   /*
    * Next check $TP_OPTS to see if the user has customised anything...
    */
@@ -230,6 +291,14 @@ int main(int argc, char **argv)
   PS_pagesize(destination, &page_width, &page_length);
   dm('O',1,"Page width is  %d, page length is %d\n", page_width, page_length);
 
+  init_reprint((int)last_param_used, argv, language_defaults(file_names[0]));
+
+  if (changed_pages_only && !diffs_wanted())
+    {
+      fprintf(stderr, gettext(CMD_NAME ": --changed-pages-only needs --diff, --diff-patch or --diff-revision\n"));
+      exit(1);
+    }
+
   /*
    * If redirect_output is set then calculate the output filename.
    * Do it now so we can catch the error condition that redirect-output
@@ -270,6 +339,11 @@ int main(int argc, char **argv)
       dm('O',1,"main.c:main() Redirecting output to %s\n",output_filename);
     }
 
+  /*
+   * Work out the diffs for every file once, for both passes.
+   */
+  compute_diffs(file_names);
+
   /*
    * Perform first pass to get function names and locations.
    */
@@ -278,6 +352,7 @@ int main(int argc, char **argv)
   pass = 0;
 
   init_postscript();
+  start_progress_pass();
 
   print_files();
 
@@ -294,6 +369,7 @@ int main(int argc, char **argv)
   pass = 1;
 
   init_postscript();
+  start_progress_pass();
 
   /*
    * Now set up output stream to print command.  Put the filehandle into
@@ -402,12 +478,14 @@ int main(int argc, char **argv)
     {
 
       print_files();
+      finish_reprint();
     }
 
   /*
    * Finish up the postscript output
    */
   PS_end_output();
+  end_progress();
 
   fflush(stdout);
   close(1);
@@ -420,9 +498,58 @@ int main(int argc, char **argv)
     closepipe(pipe_handle);
 #endif
 
+  /*
+   * The job has been printed, so it can go in the archive
+   */
+  write_archive();
+
   return(0);
 }
 
+/******************************************************************************
+ * Function:
+ *	prepare_jobs
+ * Does the work that every server or batch job would otherwise repeat:
+ * reads the printers file and compiles the option strings that each job
+ * goes through.
+ */
+static void
+prepare_jobs(void)
+
+{
+  read_printers_file();
+
+  compile_string_options(getenv("TP_OPTS"));
+  compile_language_defaults();
+  if (use_environment)
+    compile_string_options(DEFAULT_OPTS);
+}
+
+/******************************************************************************
+ * Function:
+ *	can_send_job
+ *
+ * A job that the server runs starts after the --server and --batch
+ * options have been dealt with, so an invocation that uses either of
+ * them has to be run here.
+ */
+static boolean
+can_send_job(int argc, char **argv)
+
+{
+  int	arg;
+
+  for (arg = 1; arg < argc; arg++)
+    {
+      if (strcmp(argv[arg], "--") == 0) break;
+      if ((strncmp(argv[arg], "--server", 8) == 0)
+	  || (strncmp(argv[arg], "--batch", 7) == 0))
+	return FALSE;
+    }
+
+  return TRUE;
+}
+
 /******************************************************************************
  * Function:
  *	print_files
@@ -439,6 +566,7 @@ print_files(void)
   
   init_input();
   init_output();
+  start_prefetch(file_names);
 
   for (file_number = 0; file_names[file_number]; file_number++)
     {
@@ -446,6 +574,8 @@ print_files(void)
       current_filename = file_names[file_number];
 
       dm('p', 3, "Looking at file %s\n", current_filename);
+      CHECK_PROGRESS();
+      prefetch_file(file_number);
 
       if (strcmp(current_filename, "-") == 0)
 	{
@@ -501,11 +631,15 @@ print_files(void)
        * set_input_stream will return FALSE if there is something wrong
        * with the file, e.g. if it is empty.
        */
-      if (set_input_stream(stream))
+      if (reprint_file(file_number, stream))
+	{
+	  dm('f',3,"Printed %s from the manifest\n",current_filename);
+	}
+      else if (set_input_stream(stream))
 	{
 
 	  dm('d',3,"Init diffs for pass %d, file %s\n", pass, current_filename);
-	  init_diffs(current_filename);
+	  init_diffs(file_number);
 
 	  print_file();
 
@@ -533,10 +667,13 @@ print_files(void)
 	{
 	  dm('i',3,"End file for index module\n");
 	  end_file(file_number, page_number);
+	  reprint_end_file(file_number);
 	}
 
     }
 
+  end_prefetch();
+
   if (pass==1)
     {
       /*
@@ -564,6 +701,9 @@ setup_main(void)
   destination=NULL;
   printer_destination = "";
   no_of_copies = -1;
+  server_socket = NULL;
+  batch_file = NULL;
+  batch_workers = 0;
 
   /*
    * -d and -P have the same meaning - one is from SYSV and the other
@@ -588,6 +728,20 @@ setup_main(void)
 		 OPT_OUTPUT,
 		 "redirect output to .ps file named after first filename",
 		 "don't redirect output");
+
+  string_option(NULL, "server", NULL, &server_socket, NULL, NULL,
+		OPT_OUTPUT,
+		"serve jobs from clients that have $TP_SERVER set to <string>");
+
+  string_option(NULL, "batch", NULL, &batch_file, NULL, NULL,
+		OPT_OUTPUT,
+		"run each line of file <string> as a separate job");
+
+  short_option(NULL, "batch-workers", 0,
+	       NULL, 0,
+	       0, 256, &batch_workers, NULL, NULL,
+	       OPT_OUTPUT,
+	       "run up to <number> batch jobs at once, 0 for one per processor", NULL);
 		 
   short_option("c", "copies", 1,
 	       NULL, 0,
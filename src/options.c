@@ -5,6 +5,7 @@
 
 #include "config.h"
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +33,9 @@ extern int optind;  /* undocumented variable used to reset getopt() */
 /* This must specify a bit outside the range of MAX_OPTIONS */
 #define OPT_FLAG 0x1000
 
+/* Slots in the hash table of long option names - a power of 2 */
+#define LONG_OPTION_TABLE_SIZE (MAX_OPTIONS*4)
+
 #define SHORT_OPTION(opt) (short_options[('A'<=opt&&opt<='Z')?(opt-'A')*2:\
                       ('a'<=opt&&opt<='z')?(opt-'a')*2+1:\
                       ('0'<=opt&&opt<='9')?opt-'0'+52:\
@@ -154,11 +158,36 @@ typedef struct option_type{
   } t;
 } option_type;
 
+/*
+ * A string of options, already split up and looked up, so that it can
+ * be set again for every job without parsing it again.  If the string
+ * can't be handled without getopt_long() then failed is set and the
+ * string goes through handle_options() as before.
+ */
+typedef struct compiled_option {
+  int		option;		/* as passed to set_option() */
+  char		letter[2];	/* for a single-letter option */
+  const char	*long_name;	/* for a long option */
+  char		*value;
+} compiled_option;
+
+typedef struct compiled_options {
+  char		*string;
+  char		**argv;		/* from split_options() */
+  boolean	failed;
+  int		no_of_options;
+  compiled_option *options;
+  struct compiled_options *next;
+} compiled_options;
+
 /******************************************************************************
  * Private functions
  */
 static void set_option(int option, char *prefix, const char *option_name, char *value);
 static void set_option_default(int option);
+static unsigned int hash_option_name(const char *name, size_t length);
+static int find_long_option(const char *name, size_t length);
+static compiled_options *compile_options(char *options);
 
 /******************************************************************************
  * Constant variables and data structures
@@ -172,6 +201,10 @@ static int next_option;
 static int next_long_option;
 static int this_option;
 
+static short long_option_table[LONG_OPTION_TABLE_SIZE];
+static int hashed_long_options;
+static compiled_options *compiled_list;
+
 /******************************************************************************
  * Function:
  *	setup_options
@@ -185,75 +218,327 @@ setup_options(void)
 
 /******************************************************************************
  * Function:
- *	handle_string_options
+ *	split_options
  *
- * This function takes options as a single string, parses them into
- * a char[][], and calls handle_options.
+ * Splits a string of options into an argument list in the same form as
+ * main()'s, with CMD_NAME as the first argument.  Arguments are separated
+ * by spaces or tabs, and double quotes protect spaces and tabs.  The list
+ * and the strings are allocated together, so free_options() frees both.
  */
-void
-handle_string_options(char *options)
-
+char **
+split_options(const char *options, int *argc)
 {
-  int	opt_argc = -1;
-  char	arguments[100][100];
-  char	*opt_argv[100];
-  int	options_index = -1;
-  int	argv_index = 0;
+  size_t	length = strlen(options);
+  char		**argv;
+  char		*next;
   boolean	quoted = FALSE;
-  boolean ended = FALSE;
+  boolean	in_argument = FALSE;
 
-  if (options == (char *)0) return;
-  if (strlen(options) == 0) return;
+  /*
+   * There can't be more than one argument for every two characters,
+   * and the arguments with their nuls take no more room than options.
+   */
+  argv = xmalloc(sizeof(char *) * (length / 2 + 3) + length + 1);
+  next = (char *)(argv + length / 2 + 3);
 
-  while (ended == FALSE)
+  argv[0] = CMD_NAME;
+  *argc = 1;
+
+  for (; *options; options++)
     {
-      switch (options[++options_index])
+      switch (*options)
 	{
+	case '"':
+	  quoted = !quoted;
+	  continue;
+
 	case ' ':
 	case '	':
-	  if (quoted)
+	  if (!quoted)
 	    {
-	      if (argv_index == 0) opt_argc += 1;
-	      arguments[opt_argc][argv_index++] = options[options_index];
+	      if (in_argument) *next++ = '\0';
+	      in_argument = FALSE;
 	      continue;
 	    }
-	  if (argv_index > 0)
+	  break;
+
+	default:
+	  break;
+	}
+
+      if (!in_argument)
+	{
+	  argv[(*argc)++] = next;
+	  in_argument = TRUE;
+	}
+      *next++ = *options;
+    }
+
+  if (in_argument) *next = '\0';
+  argv[*argc] = NULL;
+
+  return argv;
+}
+
+/******************************************************************************
+ * Function:
+ *	free_options
+ */
+void
+free_options(char **argv)
+{
+  free(argv);
+}
+
+/******************************************************************************
+ * Function:
+ *	hash_option_name
+ */
+static unsigned int
+hash_option_name(const char *name, size_t length)
+{
+  unsigned int hash = 5381;
+
+  while (length-- > 0)
+    hash = (hash * 33) ^ (unsigned char)*name++;
+
+  return hash;
+}
+
+/******************************************************************************
+ * Function:
+ *	find_long_option
+ *
+ * Returns the index in long_options of the option called exactly name,
+ * or -1.  The hash table is built the first time it is needed after any
+ * options have been declared.
+ */
+static int
+find_long_option(const char *name, size_t length)
+{
+  unsigned int	mask = LONG_OPTION_TABLE_SIZE - 1;
+  unsigned int	slot;
+
+  if (hashed_long_options != next_long_option)
+    {
+      int long_option_index;
+
+      memset(long_option_table, 0, sizeof(long_option_table));
+      for (long_option_index = 0; long_option_index < next_long_option; long_option_index++)
+	{
+	  const char *long_name = long_options[long_option_index].name;
+
+	  slot = hash_option_name(long_name, strlen(long_name)) & mask;
+	  while (long_option_table[slot])
+	    slot = (slot + 1) & mask;
+	  long_option_table[slot] = (short)(long_option_index + 1);
+	}
+      hashed_long_options = next_long_option;
+    }
+
+  for (slot = hash_option_name(name, length) & mask;
+       long_option_table[slot];
+       slot = (slot + 1) & mask)
+    {
+      const char *long_name = long_options[long_option_table[slot] - 1].name;
+
+      if ((strncmp(long_name, name, length) == 0) && (long_name[length] == '\0'))
+	return long_option_table[slot] - 1;
+    }
+
+  return -1;
+}
+
+/******************************************************************************
+ * Function:
+ *	compile_options
+ *
+ * Returns the compiled form of a string of options, compiling it if
+ * this string hasn't been seen before.  Only the simple cases are
+ * handled here - exact long option names, and single-letter options
+ * that are declared.  Anything else, such as an abbreviated long
+ * option or a mistake, marks the string as failed so that
+ * getopt_long() deals with it exactly as it always has.
+ */
+static compiled_options *
+compile_options(char *options)
+{
+  compiled_options *compiled;
+  int		argc;
+  int		arg_index;
+  int		options_size = 0;
+
+  for (compiled = compiled_list; compiled; compiled = compiled->next)
+    if (strcmp(compiled->string, options) == 0)
+      {
+	dm('o',3,"Using compiled options %s\n", options);
+	return compiled;
+      }
+
+  dm('o',2,"Compiling options %s\n", options);
+  compiled = xmalloc(sizeof(compiled_options));
+  compiled->string = strdup(options);
+  compiled->argv = split_options(options, &argc);
+  compiled->failed = FALSE;
+  compiled->no_of_options = 0;
+  compiled->options = NULL;
+  compiled->next = compiled_list;
+  compiled_list = compiled;
+
+#define NEW_OPTION(o) \
+  (((compiled->no_of_options == options_size) \
+    ? (options_size = options_size * 2 + 4, \
+       compiled->options = xrealloc(compiled->options, options_size * sizeof(compiled_option))) : 0), \
+   (o) = &compiled->options[compiled->no_of_options++], \
+   (o)->letter[0] = '\0', (o)->long_name = NULL, (o)->value = NULL)
+
+  for (arg_index = 1; (arg_index < argc) && !compiled->failed; arg_index++)
+    {
+      char		*arg = compiled->argv[arg_index];
+      compiled_option	*option;
+
+      if ((arg[0] != '-') || (arg[1] == '\0'))
+	{
+	  /* Not an option - handle_options() would skip it too */
+	}
+      else if (strcmp(arg, "--") == 0)
+	{
+	  break;
+	}
+      else if (arg[1] == '-')
+	{
+	  char	*name = arg + 2;
+	  char	*equals = strchr(name, '=');
+	  size_t length = equals ? (size_t)(equals - name) : strlen(name);
+	  int	long_option_index = find_long_option(name, length);
+
+	  if (long_option_index == -1)
 	    {
-	      arguments[opt_argc][argv_index] = '\0';
-	      argv_index = 0;
+	      compiled->failed = TRUE;
+	      break;
 	    }
-	  break;
 
-	case '\0':
-	  if (argv_index > 0)
+	  NEW_OPTION(option);
+	  option->option = long_options[long_option_index].val;
+	  option->long_name = long_options[long_option_index].name;
+
+	  switch (long_options[long_option_index].has_arg)
 	    {
-	      arguments[opt_argc][argv_index] = '\0';
-	      argv_index = 0;
+	    case 0:
+	      if (equals) compiled->failed = TRUE;
+	      break;
+	    case 1:
+	      if (equals)
+		option->value = equals + 1;
+	      else if (arg_index + 1 < argc)
+		option->value = compiled->argv[++arg_index];
+	      else
+		compiled->failed = TRUE;
+	      break;
+	    default:
+	      if (equals) option->value = equals + 1;
+	      break;
 	    }
-	  ended = TRUE;
-	  break;
+	}
+      else
+	{
+	  char *letters;
 
-	case '"':
-	  if (quoted) quoted = FALSE;
-	  else
-	    quoted = TRUE;
-	  break;
+	  for (letters = arg + 1; *letters; letters++)
+	    {
+	      int option_index;
 
-	default:
-	  if (argv_index == 0) opt_argc += 1;
-	  arguments[opt_argc][argv_index++] = options[options_index];
-	  break;
+	      if (!isalnum((unsigned char)*letters))
+		{
+		  compiled->failed = TRUE;
+		  break;
+		}
+	      option_index = SHORT_OPTION(*letters);
+	      if (option_list[option_index].letter != *letters)
+		{
+		  compiled->failed = TRUE;
+		  break;
+		}
+
+	      NEW_OPTION(option);
+	      option->option = option_index;
+	      option->letter[0] = *letters;
+	      option->letter[1] = '\0';
+
+	      if (option_list[option_index].need_string)
+		{
+		  if (letters[1])
+		    option->value = letters + 1;
+		  else if (arg_index + 1 < argc)
+		    option->value = compiled->argv[++arg_index];
+		  else
+		    compiled->failed = TRUE;
+		  break;
+		}
+	    }
 	}
     }
-  opt_argc += 1;
+#undef NEW_OPTION
 
-  for (argv_index=0; argv_index < opt_argc; argv_index++)
-    opt_argv[argv_index+1] = arguments[argv_index];
+  if (compiled->failed)
+    dm('o',2,"Leaving options %s to getopt_long()\n", options);
 
-  opt_argv[0] = opt_argv[1];
-  opt_argc += 1;
+  return compiled;
+}
+
+/******************************************************************************
+ * Function:
+ *	compile_string_options
+ *
+ * Compiles a string of options ahead of handle_string_options(), so
+ * that a server or a batch can do it once before it starts its jobs.
+ */
+void
+compile_string_options(char *options)
+{
+  if ((options == (char *)0) || (*options == '\0')) return;
+
+  (void)compile_options(options);
+}
+
+/******************************************************************************
+ * Function:
+ *	handle_string_options
+ *
+ * This function takes options as a single string, compiles them (or
+ * finds them already compiled) and sets each one.  If they can't be
+ * compiled then it parses them into a char[][] and calls handle_options.
+ */
+void
+handle_string_options(char *options)
+
+{
+  compiled_options *compiled;
+  int	opt_argc;
+  char	**opt_argv;
+  int	option_index;
+
+  if (options == (char *)0) return;
+  if (strlen(options) == 0) return;
+
+  compiled = compile_options(options);
+  if (!compiled->failed)
+    {
+      for (option_index = 0; option_index < compiled->no_of_options; option_index++)
+	{
+	  compiled_option *option = &compiled->options[option_index];
+
+	  if (option->long_name)
+	    set_option(option->option, "--", option->long_name, option->value);
+	  else
+	    set_option(option->option, "-", option->letter, option->value);
+	}
+      return;
+    }
 
+  opt_argv = split_options(options, &opt_argc);
   handle_options(opt_argc, opt_argv);
+  free_options(opt_argv);
   return;
 }
 
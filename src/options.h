@@ -18,6 +18,9 @@ typedef enum option_class {
 
 void		setup_options(void);
 void		handle_string_options(char *);
+void		compile_string_options(char *);
+char		**split_options(const char *, int *);
+void		free_options(char **);
 unsigned int	handle_options(int, char **);
 void 		set_option_defaults(void);
 void            print_usage_msgs(option_class);
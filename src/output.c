@@ -22,6 +22,7 @@
 #include "print_prompt.h"
 #include "debug.h"
 #include "options.h"
+#include "reprint.h"
 #include "utils.h"
 
 #include "output.h"
@@ -58,13 +59,24 @@ static boolean	new_sheet_after_file;
 static boolean	no_expand_page_break;
 static long	line_number;
 static boolean	reached_end_of_sheet;
+static boolean	skip_rendering;
 
+/*
+ * The diff state a character is printed in - characters that haven't
+ * changed in a changed line are printed normally with --word-diff
+ */
+#define CHAR_DIFF_STATE(idx) \
+  ((word_diffed && !input_changed[idx]) ? NORMAL : diff_state)
+
+/*
+ * The procedures are defined in PS_header()
+ */
 static char *segment_ends[4][3] = {
-  /*     INSERT               DELETE             NORMAL       */
-  /* NORMAL */    { ") BF setfont show ",   ") CF setfont So show ",   ") CF setfont show " },
-		  /* ITALIC */    { ") IF setfont Bs ",     ") IF setfont So show ",   ") IF setfont show " },
-		  /* BOLD */      { ") BF setfont show ",   ") BF setfont So show ",   ") BF setfont show " },
-		  /* UNDERLINE */ { ") BF setfont Ul show", ") CF setfont So Ul show ",") CF setfont Ul show " },
+  /*              INSERT    DELETE    NORMAL   */
+  /* NORMAL */    { ") Ci ", ") Cd ", ") Cn " },
+  /* ITALIC */    { ") Ii ", ") Id ", ") In " },
+  /* BOLD */      { ") Bi ", ") Bd ", ") Bn " },
+  /* UNDERLINE */ { ") Ui ", ") Ud ", ") Un " },
 };
 
 /******************************************************************************
@@ -76,6 +88,7 @@ init_output(void)
 {
   line_number = 0;
   page_number = 0;
+  reached_end_of_sheet = TRUE;
 }
 
 /******************************************************************************
@@ -308,8 +321,11 @@ printnextline()
   boolean		first_line_segment=FALSE;
   short		count;
   static diff_states	diff_state=NORMAL;
+  static boolean	input_changed[MAXLINELENGTH];
+  static boolean	word_diffed;
   boolean blank_line;
   char_status	last_char_status;
+  diff_states	last_diff_state;
 
   /*
    * See if we need to read in a new line
@@ -394,7 +410,13 @@ printnextline()
        */
       if (diff_state != NORMAL) page_has_changed(page_number);
 
-      if (pass == 1)
+      /*
+       * With --word-diff only the words that have changed are marked
+       */
+      word_diffed = (diff_state != NORMAL) && (pass == 1) && !skip_rendering
+	&& changed_words(input_line, input_changed);
+
+      if ((pass == 1) && !skip_rendering)
 	{
 	  /*
 	   * a new line of source file is about to be printed - so
@@ -406,21 +428,21 @@ printnextline()
 	    {
 	      dm('O',4,"output.c:printnextline() Printing line with diff state DELETE\n");
 	      if ((no_show_line_number == FALSE) || (no_show_indent_level == FALSE))
-		PUTS("Lpt (-          ) CFs setfont show (");
+		PUTS("(-          ) Sn (");
 	      else
-		PUTS("Lpt (-) CFs setfont show (");
+		PUTS("(-) Sn (");
 	    }
 	  else
 	    {
 	      if (diff_state == INSERT)
 		{
 		  dm('O',4,"output.c:printnextline() Printing line with diff state INSERT\n");
-		  PUTS("Lpt BFs setfont (+");
+		  PUTS("(+");
 		}
 	      else
 		{
 		  dm('O',4,"output.c:printnextline() Printing line with diff state NORMAL\n");
-		  PUTS("Lpt CFs setfont ( ");
+		  PUTS("( ");
 		}
 
 	      if (blank_line)
@@ -436,32 +458,24 @@ printnextline()
 		  else
 		    PUTS("    ");
 		}
-	      PUTS(") show (");
+	      PUTS((diff_state == INSERT) ? ") Sb (" : ") Sn (");
 	    }
 	}
     }
   else
     {
-      if (pass == 1)
+      if ((pass == 1) && !skip_rendering)
 	{
 	  if (diff_state == DELETE)
-	    {
-	      dm('O',4,"output.c:printnextline() Printing line with diff state DELETE\n");
-	      PUTS("Lpt CFs setfont ( ");
-	    }
+	    dm('O',4,"output.c:printnextline() Printing line with diff state DELETE\n");
 	  else if (diff_state == INSERT)
-	    {
-	      dm('O',4,"output.c:printnextline() Printing line with diff state INSERT\n");
-	      PUTS("Lpt BFs setfont ( ");
-	    }
+	    dm('O',4,"output.c:printnextline() Printing line with diff state INSERT\n");
 	  else
-	    {
-	      dm('O',4,"output.c:printnextline() Printing line with diff state NORMAL\n");
-	      PUTS("Lpt CFs setfont ( ");
-	    }
+	    dm('O',4,"output.c:printnextline() Printing line with diff state NORMAL\n");
+	  PUTS("( ");
 	  if ((no_show_line_number == FALSE) || (no_show_indent_level == FALSE))
 	    PUTS("          ");
-	  PUTS(") show (");
+	  PUTS((diff_state == INSERT) ? ") Sb (" : ") Sn (");
 	}
     }
 
@@ -470,7 +484,7 @@ printnextline()
    */
   output_line_end = line_end(input_line,last_char_printed);
     
-  if (pass == 1)
+  if ((pass == 1) && !skip_rendering)
     {
       output_char_idx = last_char_printed;
     
@@ -491,6 +505,7 @@ printnextline()
        */
 
       last_char_status = input_status[output_char_idx+1];
+      last_diff_state = CHAR_DIFF_STATE(output_char_idx+1);
 
       while (output_char_idx < output_line_end)
 	{
@@ -501,9 +516,10 @@ printnextline()
 	   * Check to see if anything should be printed
 	   * out before printing the character
 	   */
-	  if (last_char_status != input_status[output_char_idx])
+	  if ((last_char_status != input_status[output_char_idx])
+	      || (last_diff_state != CHAR_DIFF_STATE(output_char_idx)))
 	    {
-	      PUTS(segment_ends[last_char_status][diff_state]);
+	      PUTS(segment_ends[last_char_status][last_diff_state]);
 	      PUTS("(");
 	    }
 
@@ -521,10 +537,11 @@ printnextline()
 	  putchar(input_line[output_char_idx]);
 	
 	  last_char_status = input_status[output_char_idx];
+	  last_diff_state = CHAR_DIFF_STATE(output_char_idx);
 	}
     
-      PUTS(segment_ends[last_char_status][diff_state]);
-      PUTS(" Nl\n");
+      PUTS(segment_ends[last_char_status][last_diff_state]);
+      PUTS("Nl\n");
       output_char_idx++;
     }
   last_char_printed = output_line_end;
@@ -615,17 +632,27 @@ print_page(void)
 
   dm('O',2,"output.c:print_page() Printing file %d page %d, filepage %d, pass %d\n", file_number, page_number, file_page_number, pass);
 
+  /*
+   * With --changed-pages-only a page without changes takes up no room
+   * at all.  In pass 1 that's known before the page is read, so its
+   * lines are read without being rendered.
+   */
+  skip_rendering = (changed_pages_only && (pass == 1) && !page_changed(page_number));
 
   /*
-   * Print a page header
+   * Print a page header.  In pass 0 this only counts the page, and with
+   * --changed-pages-only it waits until the page has been read and
+   * it's known whether the page has changed.
    */
-  print_text_header(page_number, total_pages);
+  if (!changed_pages_only || ((pass == 1) && !skip_rendering))
+    print_text_header(page_number, total_pages);
 
   /*
    * now print out enough lines to fill the page or until we've reached
    * a page break (which is caused by end of input, file, function or
-   * a newpage character).
+   * a newpage character).  The body may also be wanted for --manifest.
    */
+  if ((pass == 1) && !skip_rendering) begin_page_capture();
 
   while (page_line_number < page_length)
     {
@@ -637,10 +664,22 @@ print_page(void)
 	break;
     }
 
+  if ((pass == 1) && !skip_rendering) end_page_capture();
+
   /*
    * And finally end the page
    */
-  reached_end_of_sheet = PS_endpage(print_prompt(PAGE_BODY, file_page_number, file_name(file_number)));
+  if (changed_pages_only && !page_changed(page_number))
+    {
+      dm('O',2,"output.c:print_page() Leaving out unchanged page %d\n", page_number);
+    }
+  else
+    {
+      if (changed_pages_only && (pass == 0))
+	print_text_header(page_number, total_pages);
+      reached_end_of_sheet = PS_endpage(print_prompt(PAGE_BODY, file_page_number, file_name(file_number)));
+    }
+  skip_rendering = FALSE;
 
   dm('O',2,"output.c:print_page() retval %x\n", retval);
   return (!(retval & STREAM_FILE_END));
@@ -678,6 +717,39 @@ print_file(void)
     }
 }
 
+/*
+ * function:
+ *	print_stored_file
+ *
+ * Does what print_file() does for a file whose page bodies are already
+ * known from the last --manifest, so only the headers are new.
+ */
+void
+print_stored_file(long no_of_pages)
+
+{
+  long page;
+
+  file_page_number = 0;
+
+  for (page = 0; page < no_of_pages; page++)
+    {
+      file_page_number += 1;
+      page_number += 1;
+
+      dm('O',2,"output.c:print_stored_file() Printing file %d page %d, filepage %d, pass %d\n", file_number, page_number, file_page_number, pass);
+
+      print_text_header(page_number, total_pages);
+      if (pass == 1) put_stored_page(page);
+      reached_end_of_sheet = PS_endpage(print_prompt(PAGE_BODY, file_page_number, file_name(file_number)));
+    }
+
+  if (new_sheet_after_file)
+    {
+      fill_sheet_with_blank_pages();
+    }
+}
+
 /*
  * Print blank pages until the last page printed was the last page
  * on a physical sheet.
@@ -9,6 +9,7 @@ extern long page_number;
 extern void setup_output(void);
 extern void init_output(void);
 extern void	print_file(void);
+extern void	print_stored_file(long no_of_pages);
 extern boolean	print_page(void);
 extern stream_status	getnextline(stream_status (*get_input_char)(char *,char_status *), boolean *, char input_line[], char_status input_status[]);
 extern void fill_sheet_with_blank_pages(void);
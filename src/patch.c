@@ -0,0 +1,665 @@
+/*
+ * Source file:
+ *	patch.c
+ *
+ * Reads the changes to be marked from an existing unified diff, such as
+ * the output of diff -u or git format-patch, instead of running diff
+ * for each file.  The whole patch is read once, the first time it's
+ * needed, and the changes to each file it mentions are kept.  A patch
+ * series may change the same file more than once, and each later set of
+ * hunks is applied on top of the earlier ones, so what is marked is the
+ * difference between the file before the first patch and after the
+ * last.  A line that one patch deletes and a later one puts back where
+ * it was is unchanged.
+ *
+ * diffs.c only understands the normal diff format, so patch_diffs()
+ * hands over the changes to a file in that format.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trueprint.h"
+#include "utils.h"
+#include "debug.h"
+
+#include "patch.h"
+
+/*
+ * Private part
+ */
+
+/*
+ * One entry for each line of a version of a file, up to the last line
+ * any hunk has reached.  Lines beyond that are unchanged.
+ */
+typedef struct {
+  boolean	inserted;	/* not in the file before the first patch */
+  char		*text;		/* an inserted line's text, for --word-diff */
+  char		*deleted;	/* lines deleted just before this one, each
+				 * ending in a newline, or NULL */
+} patch_line;
+
+typedef struct {
+  char		*name;		/* as in the +++ line, without any timestamp */
+  patch_line	*lines;		/* lines[0] is not used */
+  long		no_of_lines;
+} patched_file;
+
+static patched_file	*patched_files;
+static size_t		no_of_patched_files;
+static boolean		patch_read = FALSE;
+
+/*
+ * What is known about the file whose hunks are being read.  The entries
+ * for the new version go in new_lines, and old_line is the next entry of
+ * the old version still to be copied across.
+ */
+static patched_file	*current_file;
+static patch_line	*new_lines;
+static long		no_of_new_lines;
+static size_t		new_lines_size;
+static long		old_line;
+static char		*pending_deleted;
+
+static void read_patch(const char *patch_filename);
+static char *read_patch_line(FILE *stream, char **line, size_t *line_size);
+static void start_file(const char *name);
+static void finish_file(void);
+static void copy_old_lines(long up_to);
+static void add_new_line(boolean inserted, char *text, char *deleted);
+static boolean restore_deleted_line(const char *text);
+static char *find_deleted_line(char *deleted, const char *text, size_t length);
+static void append_text(char **text, const char *more, size_t length);
+static boolean parse_range(char **string, long *start, long *count);
+static long count_lines(const char *text);
+static patched_file *find_patched_file(const char *filename);
+
+/******************************************************************************
+ * Function:
+ *	read_patch_line
+ *
+ * Reads a whole line, however long, without its newline.  Returns NULL
+ * at the end of the patch.
+ */
+static char *
+read_patch_line(FILE *stream, char **line, size_t *line_size)
+{
+  size_t length = 0;
+
+  do
+    {
+      if (*line_size - length < 2)
+	{
+	  *line_size = (*line_size == 0) ? 256 : *line_size * 2;
+	  *line = xrealloc(*line, *line_size);
+	}
+      if (fgets(*line + length, (int)(*line_size - length), stream) == NULL)
+	break;
+      length += strlen(*line + length);
+    }
+  while ((*line)[length-1] != '\n');
+
+  if (length == 0) return NULL;
+
+  while ((length > 0) && (((*line)[length-1] == '\n') || ((*line)[length-1] == '\r')))
+    (*line)[--length] = '\0';
+
+  return *line;
+}
+
+/******************************************************************************
+ * Function:
+ *	append_text
+ */
+static void
+append_text(char **text, const char *more, size_t length)
+{
+  size_t old_length = (*text == NULL) ? 0 : strlen(*text);
+
+  *text = xrealloc(*text, old_length + length + 1);
+  memcpy(*text + old_length, more, length);
+  (*text)[old_length + length] = '\0';
+}
+
+/******************************************************************************
+ * Function:
+ *	add_new_line
+ *
+ * Adds an entry to the new version of the current file.  Any lines
+ * deleted since the last entry go just before it.
+ */
+static void
+add_new_line(boolean inserted, char *text, char *deleted)
+{
+  if ((size_t)no_of_new_lines + 2 > new_lines_size)
+    {
+      new_lines_size = (new_lines_size == 0) ? 256 : new_lines_size * 2;
+      new_lines = xrealloc(new_lines, new_lines_size * sizeof(patch_line));
+    }
+
+  if (pending_deleted != NULL)
+    {
+      if (deleted != NULL) append_text(&pending_deleted, deleted, strlen(deleted));
+      free(deleted);
+      deleted = pending_deleted;
+      pending_deleted = NULL;
+    }
+
+  no_of_new_lines += 1;
+  new_lines[no_of_new_lines].inserted = inserted;
+  new_lines[no_of_new_lines].text = text;
+  new_lines[no_of_new_lines].deleted = deleted;
+}
+
+/******************************************************************************
+ * Function:
+ *	find_deleted_line
+ *
+ * Finds the first of the lines in deleted that is text, or returns
+ * NULL.
+ */
+static char *
+find_deleted_line(char *deleted, const char *text, size_t length)
+{
+  char *line;
+
+  for (line = deleted; (line != NULL) && (*line != '\0'); line = strchr(line, '\n') + 1)
+    if ((strncmp(line, text, length) == 0) && (line[length] == '\n'))
+      return line;
+
+  return NULL;
+}
+
+/******************************************************************************
+ * Function:
+ *	restore_deleted_line
+ *
+ * Called for each inserted line.  If the line is one of those deleted
+ * at this point in the file, whether by this patch or an earlier one,
+ * then adds it as an unchanged line, with the deleted lines before it
+ * going before it and the rest still pending, and returns TRUE.
+ */
+static boolean
+restore_deleted_line(const char *text)
+{
+  size_t	length = strlen(text);
+  patch_line	*next_old = NULL;
+  char		*line;
+  char		*rest;
+
+  if ((line = find_deleted_line(pending_deleted, text, length)) == NULL)
+    {
+      /*
+       * Lines an earlier patch deleted just before the next old line
+       * are at this point too
+       */
+      if (old_line <= current_file->no_of_lines)
+	next_old = &current_file->lines[old_line];
+      if ((next_old == NULL)
+	  || (find_deleted_line(next_old->deleted, text, length) == NULL))
+	return FALSE;
+
+      append_text(&pending_deleted, next_old->deleted, strlen(next_old->deleted));
+      free(next_old->deleted);
+      next_old->deleted = NULL;
+      line = find_deleted_line(pending_deleted, text, length);
+    }
+
+  rest = NULL;
+  if (line[length + 1] != '\0')
+    append_text(&rest, line + length + 1, strlen(line + length + 1));
+  if (line == pending_deleted)
+    {
+      free(pending_deleted);
+      pending_deleted = NULL;
+    }
+  else
+    *line = '\0';
+
+  add_new_line(FALSE, NULL, NULL);
+  pending_deleted = rest;
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	copy_old_lines
+ *
+ * Copies the unchanged entries of the old version across, up to but
+ * not including line up_to.
+ */
+static void
+copy_old_lines(long up_to)
+{
+  while (old_line < up_to)
+    {
+      if (old_line <= current_file->no_of_lines)
+	add_new_line(current_file->lines[old_line].inserted,
+		     current_file->lines[old_line].text,
+		     current_file->lines[old_line].deleted);
+      else
+	add_new_line(FALSE, NULL, NULL);
+      old_line += 1;
+    }
+}
+
+/******************************************************************************
+ * Function:
+ *	start_file
+ *
+ * Called for each +++ line.  A file that an earlier patch in the series
+ * has already changed starts from the version that patch left.
+ */
+static void
+start_file(const char *name)
+{
+  size_t file_index;
+
+  finish_file();
+
+  if (strcmp(name, "/dev/null") == 0) return;
+
+  for (file_index = 0; file_index < no_of_patched_files; file_index++)
+    if (strcmp(patched_files[file_index].name, name) == 0) break;
+
+  if (file_index == no_of_patched_files)
+    {
+      patched_files = xrealloc(patched_files, (no_of_patched_files + 1) * sizeof(patched_file));
+      patched_files[file_index].name = strdup(name);
+      patched_files[file_index].lines = NULL;
+      patched_files[file_index].no_of_lines = 0;
+      no_of_patched_files += 1;
+    }
+
+  dm('d',3,"patch.c:start_file() Changes to %s\n", name);
+
+  current_file = &patched_files[file_index];
+  new_lines = NULL;
+  no_of_new_lines = 0;
+  new_lines_size = 0;
+  old_line = 1;
+  pending_deleted = NULL;
+}
+
+/******************************************************************************
+ * Function:
+ *	finish_file
+ *
+ * Copies across whatever the hunks didn't reach, and makes the new
+ * version the current one.  Lines deleted at the very end are held by
+ * an entry just past the last line.
+ */
+static void
+finish_file(void)
+{
+  if (current_file == NULL) return;
+
+  copy_old_lines(current_file->no_of_lines + 1);
+  if (pending_deleted != NULL) add_new_line(FALSE, NULL, NULL);
+
+  free(current_file->lines);
+  current_file->lines = new_lines;
+  current_file->no_of_lines = no_of_new_lines;
+  current_file = NULL;
+}
+
+/******************************************************************************
+ * Function:
+ *	parse_range
+ *
+ * Reads <start>[,<count>] from a hunk header.
+ */
+static boolean
+parse_range(char **string, long *start, long *count)
+{
+  char *end;
+
+  *start = strtol(*string, &end, 10);
+  if (end == *string) return FALSE;
+  *count = 1;
+  if (*end == ',')
+    {
+      *string = end + 1;
+      *count = strtol(*string, &end, 10);
+      if (end == *string) return FALSE;
+    }
+  *string = end;
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	read_patch
+ *
+ * Reads the whole patch in a single pass.  Anything outside the hunks,
+ * such as mail headers, commit messages or diff --git lines, is
+ * skipped.
+ */
+static void
+read_patch(const char *patch_filename)
+{
+  FILE		*stream;
+  char		*line = NULL;
+  size_t	line_size = 0;
+  long		line_number = 0;
+  long		old_left = 0;
+  long		new_left = 0;
+  boolean	after_minus_line = FALSE;
+
+  if ((stream = fopen(patch_filename, "r")) == NULL)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot open patch %s, %s\n"),
+	      patch_filename, strerror(errno));
+      exit(1);
+    }
+
+  current_file = NULL;
+
+  while (read_patch_line(stream, &line, &line_size) != NULL)
+    {
+      line_number++;
+
+      if ((old_left > 0) || (new_left > 0))
+	{
+	  /*
+	   * Inside a hunk.  Some tools strip the space from empty
+	   * context lines.
+	   */
+	  switch (line[0])
+	    {
+	    case ' ':
+	    case '\0':
+	      if (current_file != NULL)
+		{
+		  copy_old_lines(old_line + 1);
+		}
+	      old_left--;
+	      new_left--;
+	      break;
+	    case '-':
+	      if (current_file != NULL)
+		{
+		  if (old_line <= current_file->no_of_lines)
+		    {
+		      patch_line *removed = &current_file->lines[old_line];
+
+		      if (removed->deleted != NULL)
+			{
+			  append_text(&pending_deleted, removed->deleted, strlen(removed->deleted));
+			  free(removed->deleted);
+			  removed->deleted = NULL;
+			}
+		      /*
+		       * A line that an earlier patch added and this one
+		       * removes was never in the original
+		       */
+		      if (!removed->inserted)
+			{
+			  append_text(&pending_deleted, line + 1, strlen(line + 1));
+			  append_text(&pending_deleted, "\n", 1);
+			}
+		      free(removed->text);
+		      removed->text = NULL;
+		    }
+		  else
+		    {
+		      append_text(&pending_deleted, line + 1, strlen(line + 1));
+		      append_text(&pending_deleted, "\n", 1);
+		    }
+		  old_line += 1;
+		}
+	      old_left--;
+	      break;
+	    case '+':
+	      if ((current_file != NULL) && !restore_deleted_line(line + 1))
+		add_new_line(TRUE, strdup(line + 1), NULL);
+	      new_left--;
+	      break;
+	    case '\\':
+	      /* \ No newline at end of file */
+	      break;
+	    default:
+	      fprintf(stderr, gettext(CMD_NAME ": %s line %ld: hunk is shorter than its header says\n"),
+		      patch_filename, line_number);
+	      exit(1);
+	    }
+
+	  if ((old_left < 0) || (new_left < 0))
+	    {
+	      fprintf(stderr, gettext(CMD_NAME ": %s line %ld: hunk is longer than its header says\n"),
+		      patch_filename, line_number);
+	      exit(1);
+	    }
+	  continue;
+	}
+
+      if (strncmp(line, "--- ", 4) == 0)
+	{
+	  after_minus_line = TRUE;
+	  continue;
+	}
+
+      if (after_minus_line && (strncmp(line, "+++ ", 4) == 0))
+	{
+	  char	*name = line + 4;
+	  char	*end;
+
+	  if ((end = strchr(name, '\t')) != NULL) *end = '\0';
+	  if ((*name == '"') && ((end = strrchr(name + 1, '"')) != NULL))
+	    {
+	      name++;
+	      *end = '\0';
+	    }
+	  start_file(name);
+	}
+      else if (strncmp(line, "@@ -", 4) == 0)
+	{
+	  char	*position = line + 4;
+	  long	old_start, old_count, new_start, new_count;
+	  boolean good_header = FALSE;
+
+	  if (parse_range(&position, &old_start, &old_count)
+	      && (strncmp(position, " +", 2) == 0))
+	    {
+	      position += 2;
+	      good_header = parse_range(&position, &new_start, &new_count);
+	    }
+	  if (!good_header)
+	    {
+	      fprintf(stderr, gettext(CMD_NAME ": %s line %ld: bad hunk header\n"),
+		      patch_filename, line_number);
+	      exit(1);
+	    }
+
+	  /*
+	   * An empty old range gives the line the new lines follow
+	   */
+	  if (current_file != NULL)
+	    copy_old_lines((old_count == 0) ? old_start + 1 : old_start);
+
+	  old_left = old_count;
+	  new_left = new_count;
+	}
+
+      after_minus_line = FALSE;
+    }
+
+  if (ferror(stream))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot read patch %s, %s\n"),
+	      patch_filename, strerror(errno));
+      exit(1);
+    }
+
+  finish_file();
+  fclose(stream);
+  free(line);
+
+  dm('d',2,"patch.c:read_patch() %lu files changed by %s\n", (unsigned long)no_of_patched_files, patch_filename);
+}
+
+/******************************************************************************
+ * Function:
+ *	find_patched_file
+ *
+ * Finds the changes for filename.  The names in a patch usually have an
+ * extra leading directory, e.g. a/ and b/ from git, and trueprint may
+ * be run from somewhere else again, so leading directories are dropped
+ * from the patch's name until it matches, and the match that needed the
+ * fewest dropped wins.
+ */
+static patched_file *
+find_patched_file(const char *filename)
+{
+  patched_file	*best = NULL;
+  int		best_dropped = 0;
+  size_t	file_index;
+
+  while (strncmp(filename, "./", 2) == 0) filename += 2;
+
+  for (file_index = 0; file_index < no_of_patched_files; file_index++)
+    {
+      const char	*name = patched_files[file_index].name;
+      int		dropped = 0;
+
+      while (name != NULL)
+	{
+	  if ((strcmp(name, filename) == 0)
+	      && ((best == NULL) || (dropped < best_dropped)))
+	    {
+	      best = &patched_files[file_index];
+	      best_dropped = dropped;
+	      break;
+	    }
+	  if ((name = strchr(name, '/')) != NULL) name++;
+	  dropped++;
+	}
+    }
+
+  return best;
+}
+
+/******************************************************************************
+ * Function:
+ *	count_lines
+ */
+static long
+count_lines(const char *text)
+{
+  long lines = 0;
+
+  if (text == NULL) return 0;
+  while ((text = strchr(text, '\n')) != NULL)
+    {
+      lines++;
+      text++;
+    }
+  return lines;
+}
+
+/******************************************************************************
+ * Function:
+ *	patch_diffs
+ *
+ * Returns a stream holding the changes the patch makes to filename in
+ * the normal diff format, or NULL if the patch doesn't change it.  The
+ * inserted lines are only read for --word-diff, to pair them up with
+ * the deleted ones.
+ */
+FILE *
+patch_diffs(const char *patch_filename, const char *filename)
+{
+  patched_file	*file;
+  FILE		*stream;
+  long		old_number = 0;
+  long		line;
+
+  if (!patch_read)
+    {
+      read_patch(patch_filename);
+      patch_read = TRUE;
+    }
+
+  if ((file = find_patched_file(filename)) == NULL)
+    {
+      dm('d',3,"patch.c:patch_diffs() No changes to %s\n", filename);
+      return NULL;
+    }
+
+  if ((stream = tmpfile()) == NULL)
+    {
+      perror(CMD_NAME ": cannot create temporary file for patch");
+      exit(2);
+    }
+
+  line = 1;
+  while (line <= file->no_of_lines)
+    {
+      patch_line	*entry = &file->lines[line];
+      long		deleted = count_lines(entry->deleted);
+      long		inserted = 0;
+      char		*next;
+
+      if (!entry->inserted && (deleted == 0))
+	{
+	  old_number++;
+	  line++;
+	  continue;
+	}
+
+      while ((line + inserted <= file->no_of_lines)
+	     && file->lines[line + inserted].inserted
+	     && ((inserted == 0) || (file->lines[line + inserted].deleted == NULL)))
+	inserted++;
+
+      if (inserted == 0)
+	fprintf(stream, "%ld,%ldd%ld\n", old_number + 1, old_number + deleted, line - 1);
+      else if (deleted == 0)
+	fprintf(stream, "%lda%ld,%ld\n", old_number, line, line + inserted - 1);
+      else
+	fprintf(stream, "%ld,%ldc%ld,%ld\n", old_number + 1, old_number + deleted, line, line + inserted - 1);
+
+      for (next = entry->deleted; (next != NULL) && (*next != '\0'); next = strchr(next, '\n') + 1)
+	{
+	  fputs("< ", stream);
+	  fwrite(next, 1, strcspn(next, "\n") + 1, stream);
+	}
+
+      if ((deleted != 0) && (inserted != 0)) fputs("---\n", stream);
+
+      old_number += deleted;
+      if (inserted == 0)
+	{
+	  old_number++;
+	  line++;
+	}
+      else
+	{
+	  long count;
+
+	  for (count = 0; count < inserted; count++)
+	    {
+	      const char *text = file->lines[line + count].text;
+
+	      fprintf(stream, "> %s\n", (text != NULL) ? text : "");
+	    }
+	  line += inserted;
+	}
+    }
+
+  if (fflush(stream) == EOF)
+    {
+      perror(CMD_NAME ": cannot write temporary file for patch");
+      exit(2);
+    }
+  rewind(stream);
+
+  dm('d',3,"patch.c:patch_diffs() Changes to %s from %s\n", filename, file->name);
+
+  return stream;
+}
@@ -0,0 +1,6 @@
+/*
+ * Include file:
+ *	patch.h
+ */
+
+extern FILE *patch_diffs(const char *patch_filename, const char *filename);
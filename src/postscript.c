@@ -10,15 +10,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern off_t lseek(int fildes, off_t offset, int whence);
+extern int ftruncate(int fildes, off_t length);
+extern int read(int fildes, void *buf, size_t nbyte);
+#endif
 
 #include "trueprint.h"
 #include "main.h"
 #include "expand_str.h"
+#include "encode.h"
 #include "utils.h"
 #include "debug.h"
 #include "options.h"
 #include "index.h"
 #include "printers_fl.h"
+#include "progress.h"
 
 #include "postscript.h"
 
@@ -37,9 +48,35 @@ typedef enum {
   ONE_ON_ONE,
   TWO_ON_ONE,
   THREE_ON_ONE,
-  FOUR_ON_ONE
+  FOUR_ON_ONE,
+  N_ON_ONE
 } page_layouts;
 
+/*
+ * Where a logical page goes on the sheet: the origin of the logical page
+ * and how far it is turned
+ */
+typedef struct {
+  unsigned short	x;
+  unsigned short	y;
+  short			rotation;
+} page_transform;
+
+#define GUTTER		2	/* space on each side of an inner edge */
+#define MAX_N_UP	64
+
+/*
+ * A logical page held back for --booklet until its signature is
+ * complete: where its body is in the spool and whether any of it is to
+ * be printed
+ */
+typedef struct {
+  off_t			offset;
+  off_t			length;
+  unsigned short	label;
+  boolean		printed;
+} spooled_page;
+
 static unsigned short logical_pages_on_physical_page;
 static long physical_page_no;
 static short	greenlines;
@@ -61,15 +98,11 @@ static unsigned short virtual_width;
 static unsigned short virtual_height;
 static unsigned short header_box_height;
 static unsigned short footer_box_height;
-static unsigned short logical_pages_rotated;
+static page_transform *transforms;	/* sheet positions, then the same rotated 180 */
+static char	page_scale[16];		/* "" if logical pages aren't scaled */
+static short	n_up_across;
+static short	n_up_down;
 static unsigned short pos_left;
-static unsigned short pos_centre_left;
-static unsigned short pos_centre_right;
-static unsigned short pos_right;
-static unsigned short pos_bottom;
-static unsigned short pos_centre_bottom;
-static unsigned short pos_centre_top;
-static unsigned short pos_top;
 static unsigned short logical_page_no;
 static unsigned short left_margin;
 static unsigned short right_margin;
@@ -78,6 +111,20 @@ static unsigned short bottom_margin;
 static boolean left_page, right_page;
 static char	no_of_sides;
 static char ps_level;		/* postscript level output ... either 1 or 2 */
+static boolean compress_pages;
+static output_capture page_capture = { "page compression", NULL, -1 };
+static long	pages_output;	/* number of %%Page comments printed */
+static boolean	page_open;	/* inside a physical page's save/restore */
+static boolean	page_offsets;
+static off_t	*page_offset_table;	/* where each %%Page comment starts */
+static size_t	page_offset_table_size;
+static boolean	booklet;
+static short	signature_sheets;	/* 0 for the whole job in one signature */
+/* The bodies of the pages not yet imposed */
+static output_capture booklet_spool = { "booklet", NULL, -1 };
+static spooled_page *spooled_pages;
+static size_t	no_of_spooled_pages;
+static size_t	spooled_pages_size;
 
 static void balance_strings(char *string1, char *string2, char *string3, long page_no, boolean index_page);
 static void set_layout_default(void);
@@ -85,9 +132,22 @@ static void set_layout_1(const char *p, const char *s);
 static void set_layout_2(const char *p, const char *s);
 static void set_layout_3(const char *p, const char *s);
 static void set_layout_4(const char *p, const char *s);
+static void set_layout_n(const char *p, const char *s, char *value);
+static void set_layout_n_default(char *value);
+static unsigned short grid_edge(unsigned short start, unsigned short length, int cells, int cell, boolean far_edge);
+static void build_transforms(int sheet_across, int sheet_down, boolean rotated);
 static boolean PS_side_full(void);
 static void set_no_of_sides(const char *p, const char *s, char value);
 static void set_no_of_sides_default(char value);
+static void record_page(void);
+static void begin_physical_page(long label, long ordinal);
+static void end_physical_page(void);
+static void place_logical_page(page_transform *transform, unsigned short gap);
+static void begin_spooled_page(void);
+static void end_spooled_page(boolean print_page);
+static void copy_spooled_page(spooled_page *page);
+static void print_booklet_side(size_t first, size_t second, size_t no_of_pages, boolean back);
+static void impose_signature(void);
 
 /*
  * Function:
@@ -189,15 +249,41 @@ setup_postscript(void)
 		"generate postscript level 2 code",
 		"generate postscript level 1 code");
 
+  boolean_option(NULL, "compress-pages", "no-compress-pages", FALSE, &compress_pages, NULL, NULL,
+		 OPT_OUTPUT,
+		 "compress the body of each page (postscript level 2 only)",
+		 "don't compress the body of each page");
+
+  page_offsets = FALSE;
+  boolean_option(NULL, "page-offsets", "no-page-offsets", FALSE, &page_offsets, NULL, NULL,
+		 OPT_OUTPUT,
+		 "list the byte offset of each page in the trailer",
+		 "don't list the byte offset of each page");
+
   layout = NO_LAYOUT;
   noparm_option("1", "one-up", TRUE, &set_layout_1, &set_layout_default, OPT_PAGE_FORMAT, "print 1-on-1 (default)");
   noparm_option("2", "two-up", FALSE, &set_layout_2, NULL, OPT_PAGE_FORMAT, "print 2-on-1");
   noparm_option("3", "two-tall-up", FALSE, &set_layout_3, NULL, OPT_PAGE_FORMAT, "print 2-on-1 at 4-on-1 pointsize");
   noparm_option("4", "four-up", FALSE, &set_layout_4, NULL, OPT_PAGE_FORMAT, "print 4-on-1");
+  string_option(NULL, "n-up", NULL, NULL, &set_layout_n, &set_layout_n_default, OPT_PAGE_FORMAT,
+		"print <string> pages on each sheet, either a number or\n"
+		"    <across>x<down>, e.g. 8 or 4x2");
   boolean_option(NULL,"rotate-alternate-sheets","no-rotate-alternate-sheets",FALSE,&rotate_alternate_sheets,NULL,NULL,
 		 OPT_PAGE_FURNITURE,
 		 "rotate every other sheet 180 degrees. Only works in double-sided modes",
 		 "don't rotate every other sheet 180 degrees.");
+
+  boolean_option(NULL, "booklet", "no-booklet", FALSE, &booklet, NULL, NULL,
+		 OPT_PAGE_FORMAT,
+		 "print two-up and double-sided with the pages in order for\n"
+		 "    folding into a booklet",
+		 "print the pages in their usual order");
+
+  short_option(NULL, "signature", 0, NULL, 0, 0, 1000, &signature_sheets, NULL, NULL,
+	       OPT_PAGE_FORMAT,
+	       "fold a booklet in signatures of <number> sheets,\n"
+	       "    or 0 to fold the whole job as one (default 0)",
+	       NULL);
 }
 
 /*
@@ -213,6 +299,258 @@ init_postscript(void)
   logical_page_no = 0;
   right_page = TRUE;
   left_page = FALSE;
+  pages_output = 0;
+  page_open = FALSE;
+  no_of_spooled_pages = 0;
+}
+
+/*
+ * Function:
+ *	record_page()
+ *
+ * Counts a physical page that is about to start and, for --page-offsets,
+ * remembers where in the output its %%Page comment will be.  Offsets
+ * come from the output file itself, so they are right even when page
+ * bodies have been diverted for compression.
+ */
+static void
+record_page(void)
+{
+  if (page_offsets)
+    {
+      if ((size_t)pages_output >= page_offset_table_size)
+	{
+	  page_offset_table_size = (page_offset_table_size == 0) ? 256 : page_offset_table_size * 2;
+	  page_offset_table = xrealloc(page_offset_table, page_offset_table_size * sizeof(off_t));
+	}
+      fflush(stdout);
+      page_offset_table[pages_output] = lseek(1, 0, SEEK_CUR);
+    }
+
+  pages_output++;
+}
+
+/*
+ * Function:
+ *	begin_physical_page()
+ *
+ * Prints the %%Page comment for a new physical page and saves the
+ * state, so that nothing done on the page can leak into the next one.
+ * If the pages are being compressed then everything up to the end of
+ * the page is diverted into page_capture.
+ */
+static void
+begin_physical_page(long label, long ordinal)
+{
+  record_page();
+  printf("%%%%Page: %ld %ld\n", label, ordinal);
+  printf("/Pg save def\n");
+  page_open = TRUE;
+
+  if (!compress_pages || (ps_level != '2')) return;
+
+  begin_capture(&page_capture, FALSE);
+}
+
+/*
+ * Function:
+ *	end_physical_page()
+ *
+ * If the body of the page has been diverted, then puts the output back
+ * and prints the body LZW compressed and ASCII85 encoded, to be run
+ * through the matching level 2 filters.  The showpage stays outside the
+ * compressed body so that the page structure is still visible.
+ */
+static void
+end_physical_page(void)
+{
+  unsigned char	*page_buffer;
+  unsigned char	*encoded;
+  off_t		page_length;
+  size_t	encoded_length;
+
+  if ((page_buffer = (unsigned char *)end_capture(&page_capture, &page_length)) == NULL)
+    return;
+
+  encoded = lzw_encode(page_buffer, (size_t)page_length, &encoded_length);
+
+  printf("currentfile /ASCII85Decode filter /LZWDecode filter cvx exec\n");
+  ascii85_write(stdout, encoded, encoded_length);
+
+  free(encoded);
+}
+
+/*
+ * Function:
+ *	place_logical_page()
+ *
+ * Moves to a logical page's place on the sheet, as worked out by
+ * PS_pagesize().
+ */
+static void
+place_logical_page(page_transform *transform, unsigned short gap)
+{
+  printf("%d %d translate", transform->x+gap, transform->y);
+  if (page_scale[0] != '\0')
+    printf(" %s %s scale", page_scale, page_scale);
+  if (transform->rotation != 0)
+    printf(" %d rotate", transform->rotation);
+  printf("\n");
+}
+
+/*
+ * Function:
+ *	begin_spooled_page()
+ *
+ * For --booklet, diverts the body of a logical page to the end of
+ * booklet_spool, because it can't be printed until the rest of its
+ * signature is known.  Only the page's place in the spool is kept in
+ * memory, so the length of a booklet is limited by disk, not memory.
+ */
+static void
+begin_spooled_page(void)
+{
+  spooled_page	*page;
+
+  if (no_of_spooled_pages == spooled_pages_size)
+    {
+      spooled_pages_size = (spooled_pages_size == 0) ? 64 : spooled_pages_size * 2;
+      spooled_pages = xrealloc(spooled_pages, spooled_pages_size * sizeof(spooled_page));
+    }
+  page = spooled_pages + no_of_spooled_pages++;
+  page->label = logical_page_no;
+  page->printed = FALSE;
+
+  begin_capture(&booklet_spool, TRUE);
+  page->offset = booklet_spool.start;
+}
+
+/*
+ * Function:
+ *	end_spooled_page()
+ */
+static void
+end_spooled_page(boolean print_page)
+{
+  spooled_page	*page = spooled_pages + no_of_spooled_pages - 1;
+
+  end_capture(&booklet_spool, &page->length);
+  page->printed = print_page;
+}
+
+/*
+ * Function:
+ *	copy_spooled_page()
+ */
+static void
+copy_spooled_page(spooled_page *page)
+{
+  char		buffer[BUFSIZ];
+  off_t		left = page->length;
+
+  if (lseek(fileno(booklet_spool.stream), page->offset, SEEK_SET) == -1)
+    {
+      perror(CMD_NAME ": cannot read back page for booklet");
+      exit(1);
+    }
+
+  while (left > 0)
+    {
+      int	got = read(fileno(booklet_spool.stream), buffer,
+			   (left < (off_t)sizeof(buffer)) ? (size_t)left : sizeof(buffer));
+
+      if (got <= 0)
+	{
+	  perror(CMD_NAME ": cannot read back page for booklet");
+	  exit(1);
+	}
+      fwrite(buffer, 1, got, stdout);
+      left -= got;
+    }
+}
+
+/*
+ * Function:
+ *	print_booklet_side()
+ *
+ * Prints one side of a booklet sheet with spooled pages first and
+ * second on its left and right halves.  Pages past no_of_pages are the
+ * blank ones that fill up the last signature.
+ *
+ * The back of a sheet is printed upside down, as it would be with
+ * --rotate-alternate-sheets: the sheet is turned over along its long
+ * edge by the printer, but along its short edge by the reader.
+ */
+static void
+print_booklet_side(size_t first, size_t second, size_t no_of_pages, boolean back)
+{
+  size_t	slots[2];
+  boolean	side_has_printing = FALSE;
+  int		slot;
+
+  slots[0] = first;
+  slots[1] = second;
+
+  begin_physical_page((first < no_of_pages) ? spooled_pages[first].label
+		      : (second < no_of_pages) ? spooled_pages[second].label : 0,
+		      pages_output + 1);
+
+  for (slot = 0; slot < 2; slot++)
+    {
+      if (slots[slot] >= no_of_pages)
+	{
+	  side_has_printing = TRUE;
+	  continue;
+	}
+      if (spooled_pages[slots[slot]].printed) side_has_printing = TRUE;
+
+      printf("gsave\n");
+      place_logical_page(transforms + (back ? logical_pages_on_physical_page : 0) + slot, 0);
+      copy_spooled_page(spooled_pages + slots[slot]);
+      printf("grestore\n");
+    }
+
+  end_physical_page();
+  if (side_has_printing)
+    printf("showpage Pg restore\n");
+  else
+    printf("erasepage Pg restore\n");
+  page_open = FALSE;
+}
+
+/*
+ * Function:
+ *	impose_signature()
+ *
+ * Prints the spooled pages as a signature, a pile of sheets that are
+ * folded together down the middle, and empties the spool.  With n
+ * sheets the first sheet carries the first two and the last two pages,
+ * the next sheet the two pages either side of those, and so on, so that
+ * the middle sheet has the middle pages.
+ */
+static void
+impose_signature(void)
+{
+  size_t	no_of_pages = no_of_spooled_pages;
+  size_t	last = (no_of_pages + 3) / 4 * 4 - 1;
+  size_t	sheet;
+
+  dm('O',2,"postscript.c:impose_signature() %lu pages on %lu sheets\n",
+     (unsigned long)no_of_pages, (unsigned long)(last + 1) / 4);
+
+  for (sheet = 0; sheet <= last / 4; sheet++)
+    {
+      print_booklet_side(last - 2 * sheet, 2 * sheet, no_of_pages, FALSE);
+      print_booklet_side(2 * sheet + 1, last - 1 - 2 * sheet, no_of_pages, TRUE);
+    }
+
+  no_of_spooled_pages = 0;
+  if ((lseek(fileno(booklet_spool.stream), 0, SEEK_SET) == -1)
+      || (ftruncate(fileno(booklet_spool.stream), 0) == -1))
+    {
+      perror(CMD_NAME ": cannot truncate temporary file for booklet");
+      exit(1);
+    }
 }
 
 void set_layout_default(void)
@@ -245,6 +583,40 @@ void set_layout_4(const char *p, const char *s)
   layout = FOUR_ON_ONE;
 }
 
+void set_layout_n(const char *p, const char *s, char *value)
+{
+  int	across = 0;
+  int	down = 0;
+  int	count;
+  char	extra;
+
+  if (layout != NO_LAYOUT) return;
+
+  if (sscanf(value, "%dx%d%c", &across, &down, &extra) == 2)
+    count = across * down;
+  else if (sscanf(value, "%d%c", &count, &extra) == 1)
+    across = down = 0;
+  else
+    count = 0;
+
+  if ((count < 1) || (count > MAX_N_UP) || (across < 0) || (down < 0))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": %s%s needs a number of pages from 1 to %d, or <across>x<down>, but got '%s'\n"),
+	      p, s, MAX_N_UP, value);
+      exit(1);
+    }
+
+  layout = N_ON_ONE;
+  logical_pages_on_physical_page = (unsigned short)count;
+  n_up_across = (short)across;
+  n_up_down = (short)down;
+}
+
+void set_layout_n_default(char *value)
+{
+  /* --one-up provides the default layout */
+}
+
 /*
  * Function:
  *	PS_header()
@@ -258,19 +630,32 @@ PS_header(char *version, boolean print_body)
 {
   unsigned int	file_index;
 
-  printf("%%!PS-Adobe-%c.0\n", ps_level);
-
-  printf("statusdict /setduplexmode known {\n");
-  if (no_of_sides == '2')
-    {
-      printf("  true ");
-    }
-  else
+  /*
+   * Page offsets are only any use if they can be found out and if the
+   * output can be read back at random.
+   */
+  if (page_offsets && (lseek(1, 0, SEEK_CUR) == -1))
     {
-      printf("  false ");
+      fprintf(stderr, gettext(CMD_NAME ": output is not a file, ignoring --page-offsets\n"));
+      page_offsets = FALSE;
     }
-  printf("statusdict /setduplexmode get exec\n} if\n");
 
+  /*
+   * Header comments.  The page count isn't known until the end, and
+   * every page is self-contained, so that the output can be split
+   * into pages by psselect and friends.
+   */
+  printf("%%!PS-Adobe-3.0\n");
+  printf("%%%%Creator: Trueprint %s\n", version);
+  if (ps_level == '2')
+    printf("%%%%LanguageLevel: 2\n");
+  printf("%%%%DocumentNeededResources: font Courier Courier-Oblique Courier-Bold\n");
+  printf("%%%%+ font Helvetica Helvetica-Bold\n");
+  printf("%%%%Pages: (atend)\n");
+  printf("%%%%PageOrder: Ascend\n");
+  printf("%%%%EndComments\n");
+
+  printf("%%%%BeginProlog\n");
   printf("/Ps	%d def\n", pointsize);
   printf("/SPs	%d def\n", (pointsize*3)/4);
   printf("/Lh	%d def\n", pointsize + interline_gap);
@@ -285,10 +670,6 @@ PS_header(char *version, boolean print_body)
   printf("/IFs	/Courier-Oblique findfont SPs scalefont def\n");
   printf("/BFs	/Courier-Bold findfont SPs scalefont def\n");
   printf("/HF	/Helvetica findfont Ps scalefont def\n");
-  if ((no_show_line_number == FALSE) || (no_show_indent_level == FALSE))
-    printf("/Li CFs setfont (1234567890) stringwidth pop def\n");
-  else
-    printf("/Li 0 def\n");
   printf("/Nl	{ /Vpos Vpos Lh sub def } def\n");
   printf("/Lpt	{ 0 Vpos moveto } def\n");
   printf("/Gb	{\n");
@@ -339,10 +720,49 @@ PS_header(char *version, boolean print_body)
   printf("/So	{ gsave dup stringwidth pop Ps 3 div 0 exch rmoveto 0 rlineto fill grestore } def\n");
   printf("/Ul	{ gsave	dup stringwidth pop 0 -1 rmoveto 0 rlineto fill grestore } def\n");
   printf("/Bs	{ gsave	dup show grestore 0.5 0.5 rmoveto show } def\n");
+  /*
+   * Procedures for printing body lines - the start of a line with its
+   * line number in normal or bold, and a segment of text for each
+   * character style (Courier, Italic, Bold, Underline) and diff state
+   * (inserted, deleted, normal).  See segment_ends[] in output.c.
+   */
+  printf("/Sn	{ Lpt CFs setfont show } def\n");
+  printf("/Sb	{ Lpt BFs setfont show } def\n");
+  printf("/Ci	{ BF setfont show } def\n");
+  printf("/Cd	{ CF setfont So show } def\n");
+  printf("/Cn	{ CF setfont show } def\n");
+  printf("/Ii	{ IF setfont Bs } def\n");
+  printf("/Id	{ IF setfont So show } def\n");
+  printf("/In	{ IF setfont show } def\n");
+  printf("/Bi	{ BF setfont show } def\n");
+  printf("/Bd	{ BF setfont So show } def\n");
+  printf("/Bn	{ BF setfont show } def\n");
+  printf("/Ui	{ BF setfont Ul show } def\n");
+  printf("/Ud	{ CF setfont So Ul show } def\n");
+  printf("/Un	{ CF setfont Ul show } def\n");
+  printf("%%%%EndProlog\n");
+
+  printf("%%%%BeginSetup\n");
+  printf("statusdict /setduplexmode known {\n");
+  if (no_of_sides == '2')
+    {
+      printf("  true ");
+    }
+  else
+    {
+      printf("  false ");
+    }
+  printf("statusdict /setduplexmode get exec\n} if\n");
+
+  if ((no_show_line_number == FALSE) || (no_show_indent_level == FALSE))
+    printf("/Li CFs setfont (1234567890) stringwidth pop def\n");
+  else
+    printf("/Li 0 def\n");
 
   if (ps_level == '2'){
 	printf("<</PageSize [%d %d]>> setpagedevice\n", left_margin+right_margin, top_margin+bottom_margin);
   }
+  printf("%%%%EndSetup\n");
 
   /*
    * Print cover sheet
@@ -371,7 +791,9 @@ PS_header(char *version, boolean print_body)
 	    user_name = "Unknown user";
 	  dm('h',3, "postscript.c:PS_header() Username = %s\n", user_name);
 	}
+      record_page();
       printf("%%%%Page: Cover %ld\n", physical_page_no++);
+      printf("/Pg save def\n");
       printf("70 70 moveto\n");
       printf("/Helvetica findfont 10 scalefont setfont\n");
       printf("(Trueprint %s) show\n", version);
@@ -389,11 +811,13 @@ PS_header(char *version, boolean print_body)
 	  if (no_of_files > 20)
 	    printf("70 150 moveto (Etc....) show\n");
 	}
-      printf("showpage\n");
+      printf("showpage Pg restore\n");
       if (no_of_sides == '2')
 	{
+	  record_page();
 	  printf("%%%%Page: Coverback %ld\n", physical_page_no++);
-	  printf("showpage\n");
+	  printf("/Pg save def\n");
+	  printf("showpage Pg restore\n");
 	}
     }
 
@@ -451,6 +875,18 @@ PS_endpage(boolean print_page)
 			   && ((logical_page_no % logical_pages_on_physical_page) == 0))
 			  );
 
+  /*
+   * Each logical page has its own gsave/grestore, except that a booklet
+   * page is wrapped in them when it is imposed
+   */
+  if (pass == 1)
+    {
+      if (booklet)
+	end_spooled_page(print_page);
+      else
+	printf("grestore\n");
+    }
+
   /*
    * If the previous side is now full, then we're moving on to a new
    * physical page and we may need to change left/right page info.  We
@@ -467,20 +903,27 @@ PS_endpage(boolean print_page)
 	  right_page = !right_page;
 	}
 
-      if (pass == 1)
+      if ((pass == 1) && !booklet)
 	{
+	  end_physical_page();
+
 	  if (page_has_printing)
 	    {
-	      printf("showpage\n");
+	      printf("showpage Pg restore\n");
 	    }
 	  else
 	    {
-	      printf("erasepage initgraphics\n");
+	      printf("erasepage Pg restore\n");
 	    }
+	  page_open = FALSE;
 	}
       page_has_printing = FALSE;
     }
 
+  if ((pass == 1) && booklet && (signature_sheets != 0)
+      && (no_of_spooled_pages == 4 * (size_t)signature_sheets))
+    impose_signature();
+
   return reached_end_of_sheet;
 }
 
@@ -511,6 +954,8 @@ PS_startpage(char *head1, char *head2, char *head3,
 
   dm('O',2, "postscript.c:PS_startpage(), logical page = %d, physical page = %d\n", logical_page_no, physical_page_no);
 
+  CHECK_PROGRESS();
+
   if (pass == 0) return;
 
   dm('h',4,"Printing page %s/%s/%s %s/%s/%s + %s, page %d, total %d, index %d\n",
@@ -529,179 +974,24 @@ PS_startpage(char *head1, char *head2, char *head3,
     gap = 0;
 
   /*
-   * Next translate and rotate as appropriate for 1-on-1, 2-on-1, 3-on-1 or 4-on-1
-   * Also print the page header if this is the first logical page on a physical
-   * page.
+   * Start a new physical page if this is the first logical page on it,
+   * then move to this logical page's place on the sheet.  The gsave is
+   * matched by a grestore in PS_endpage(), so no logical page depends on
+   * the one before it.  A booklet page goes to the spool instead, and
+   * is placed when its signature is imposed.
    */
-
-  switch (layout)
+  if (booklet)
+    begin_spooled_page();
+  else
     {
-    case ONE_ON_ONE:
-      printf("%%%%Page: %d %ld\n",logical_page_no, physical_page_no);
-      if (rotate_alternate_sheets && left_page)
-	{
-	  if (orientation == 'p') printf("%d %d translate 180 rotate\n", pos_right+gap,  pos_top);
-	  if (orientation == 'l') printf("%d %d translate 270 rotate\n", pos_left+gap, pos_top);
-	}
-      else
-	{
-	  if (orientation == 'p') printf("%d %d translate\n", 	        pos_left+gap,  pos_bottom);
-	  if (orientation == 'l') printf("%d %d translate 90 rotate\n", pos_right+gap, pos_bottom);
-	}
-      break;
-    case TWO_ON_ONE:
-      switch (logical_page_no & 1)
-	{
-	case 1:
-	  printf("%%%%Page: %d %ld\n",logical_page_no, physical_page_no);
-	  printf("gsave\n");
-	  if (rotate_alternate_sheets && left_page)
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .64 .64 scale 270 rotate\n", pos_left+gap, pos_top);
-	      else
-		printf("%d %d translate .64 .64 scale 180 rotate\n", pos_right+gap,  pos_centre_bottom);
-	    }
-	  else
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .64 .64 scale 90 rotate\n", pos_right+gap, pos_bottom);
-	      else
-		printf("%d %d translate .64 .64 scale\n",           pos_left+gap,  pos_centre_top);
-	    }
-	  break;
-	case 0:
-	  printf("grestore\n");
-	  if (rotate_alternate_sheets && left_page)
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .64 .64 scale 270 rotate\n", pos_left+gap, pos_centre_bottom);
-	      else
-		printf("%d %d translate .64 .64 scale 180 rotate\n", pos_right+gap,  pos_top);
-	    }
-	  else
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .64 .64 scale 90 rotate\n", pos_right+gap, pos_centre_top);
-	      else
-		printf("%d %d translate .64 .64 scale\n",           pos_left+gap,  pos_bottom);
-	    }
-	}
-      break;
-    case THREE_ON_ONE:
-      switch (logical_page_no & 1)
-	{
-	case 1:
-	  printf("%%%%Page: %d %ld\n",logical_page_no, physical_page_no);
-	  printf("gsave\n");
-	  if (rotate_alternate_sheets && left_page)
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale 180 rotate\n", pos_right+gap,        pos_top);
-	      else
-		printf("%d %d translate .5 .5 scale 270 rotate\n", pos_centre_right+gap, pos_top);
-	    }
-	  else
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale\n",           pos_left+gap,        pos_bottom);
-	      else
-		printf("%d %d translate .5 .5 scale 90 rotate\n", pos_centre_left+gap, pos_bottom);
-	    }
-	  break;
-	case 0:
-	  printf("grestore\n");
-	  if (rotate_alternate_sheets && left_page)
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale 180 rotate\n", pos_centre_left+gap, pos_top);
-	      else
-		printf("%d %d translate .5 .5 scale 270 rotate\n", pos_left+gap,        pos_top);
-	    }
-	  else
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale\n",           pos_centre_right+gap, pos_bottom);
-	      else
-		printf("%d %d translate .5 .5 scale 90 rotate\n", pos_right+gap,        pos_bottom);
-	    }
-	}
-      break;
-    case FOUR_ON_ONE:
-      switch (logical_page_no & 3)
-	{
-	case 1:
-	  printf("%%%%Page: %d %ld\n",logical_page_no, physical_page_no);
-	  printf("gsave\n");
-	  if (rotate_alternate_sheets && left_page)
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale 180 rotate\n", pos_right+gap,        pos_centre_bottom);
-	      else
-		printf("%d %d translate .5 .5 scale 270 rotate\n", pos_centre_right+gap, pos_top);
-	    }
-	  else
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale\n",           pos_left+gap,        pos_centre_top);
-	      else
-		printf("%d %d translate .5 .5 scale 90 rotate\n", pos_centre_left+gap, pos_bottom);
-	    }
-	  break;
-	case 2:
-	  printf("grestore gsave\n");
-	  if (rotate_alternate_sheets && left_page)
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale 180 rotate\n", pos_right+gap,  pos_top);
-	      else
-		printf("%d %d translate .5 .5 scale 270 rotate\n", pos_left+gap, pos_top);
-	    }
-	  else
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale\n",           pos_left+gap,  pos_bottom);
-	      else
-		printf("%d %d translate .5 .5 scale 90 rotate\n", pos_right+gap, pos_bottom);
-	    }
-	  break;
-	case 3:
-	  printf("grestore gsave\n");
-	  if (rotate_alternate_sheets && left_page)
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale 180 rotate\n", pos_centre_left+gap, pos_centre_bottom);
-	      else
-		printf("%d %d translate .5 .5 scale 270 rotate\n", pos_centre_right+gap,  pos_centre_bottom);
-	    }
-	  else
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale\n",           pos_centre_right+gap, pos_centre_top);
-	      else
-		printf("%d %d translate .5 .5 scale 90 rotate\n", pos_centre_left+gap,  pos_centre_top);
-	    }
-	  break;
-	case 0:
-	  printf("grestore\n");
-	  if (rotate_alternate_sheets && left_page)
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale 180 rotate\n", pos_centre_left+gap, pos_top);
-	      else
-		printf("%d %d translate .5 .5 scale 270 rotate\n", pos_left+gap,        pos_centre_bottom);
-	    }
-	  else
-	    {
-	      if (orientation == 'p')
-		printf("%d %d translate .5 .5 scale\n",           pos_centre_right+gap, pos_bottom);
-	      else
-		printf("%d %d translate .5 .5 scale 90 rotate\n", pos_right+gap,        pos_centre_top);
-	    }
-	}
-      break;
-    case NO_LAYOUT:
-      abort();
+      if (((logical_page_no - 1) % logical_pages_on_physical_page) == 0)
+	begin_physical_page(logical_page_no, physical_page_no);
+
+      printf("gsave\n");
+      place_logical_page(transforms
+			 + ((rotate_alternate_sheets && left_page) ? logical_pages_on_physical_page : 0)
+			 + ((logical_page_no - 1) % logical_pages_on_physical_page),
+			 gap);
     }
 
   /*
@@ -763,12 +1053,39 @@ PS_startpage(char *head1, char *head2, char *head3,
 /*
  * Function:
  *	PS_end_output()
- * 
+ * Finishes off a partly filled physical page or booklet signature, if
+ * there is one, and prints the trailer with the page count.
+ *
+ * With --page-offsets the trailer also lists the byte offset of each
+ * %%Page comment, one per line, and the last line before %%EOF gives
+ * the offset of that list, so that a reader need only look at the end
+ * of the file to find any page.
  */
 void
 PS_end_output(void)
 {
+  if (booklet && (no_of_spooled_pages != 0))
+    impose_signature();
+  if (page_open)
+    {
+      end_physical_page();
+      printf("showpage Pg restore\n");
+      page_open = FALSE;
+    }
   printf("%%%%Trailer\n");
+  printf("%%%%Pages: %ld\n", pages_output);
+  if (page_offsets)
+    {
+      off_t	table_offset;
+      long	page_index;
+
+      fflush(stdout);
+      table_offset = lseek(1, 0, SEEK_CUR);
+      printf("%%%%TrueprintPageOffsets: %ld\n", pages_output);
+      for (page_index = 0; page_index < pages_output; page_index++)
+	printf("%%%%+ %lu\n", (unsigned long)page_offset_table[page_index]);
+      printf("%%%%TrueprintPageTable: %lu\n", (unsigned long)table_offset);
+    }
   printf("%%%%EOF\n");
 }
 
@@ -781,17 +1098,18 @@ balance_strings(char *string1, char *string2, char *string3, long page_no, boole
 {
   char	*s1, *s2, *s3;
 
+  /* Each string is expanded into its own buffer, so no copies are needed */
   if (right_page)
     {
-      s1 = strdup(expand_string(string1, index_page));
-      s2 = strdup(expand_string(string2, index_page));
-      s3 = strdup(expand_string(string3, index_page));
+      s1 = expand_string(string1, index_page);
+      s2 = expand_string(string2, index_page);
+      s3 = expand_string(string3, index_page);
     }
   else
     {
-      s1 = strdup(expand_string(string3, index_page));
-      s2 = strdup(expand_string(string2, index_page));
-      s3 = strdup(expand_string(string1, index_page));
+      s1 = expand_string(string3, index_page);
+      s2 = expand_string(string2, index_page);
+      s3 = expand_string(string1, index_page);
     }
   /* start  end1  start2  mid2  end2  start3  end3   */
   /*      s1               s2               s3       */
@@ -808,6 +1126,82 @@ balance_strings(char *string1, char *string2, char *string3, long page_no, boole
   printf("(%s) show\n",s2);
 }
 
+/*
+ * Function:
+ *	grid_edge
+ *
+ * Returns the near or far edge of cell number cell, when length points
+ * from start are split into cells, leaving a gutter at each inner edge.
+ */
+static unsigned short
+grid_edge(unsigned short start, unsigned short length, int cells, int cell, boolean far_edge)
+
+{
+  if (!far_edge)
+    return start + cell * length / cells + ((cell > 0) ? GUTTER : 0);
+  else if (cell == cells - 1)
+    return start + length;
+  else
+    return start + (cell + 1) * length / cells - GUTTER;
+}
+
+/*
+ * Function:
+ *	build_transforms
+ *
+ * Fills in transforms[] with where each logical page on a sheet goes,
+ * for a grid of sheet_across by sheet_down cells.  The pages go down the
+ * first column of the logical page, then down the next, as seen with
+ * the logical pages the right way up.  A page that is turned has its
+ * top towards the left of the sheet, so its origin is at the bottom
+ * right of its cell.
+ *
+ * The second half of the table is the same sheet turned upside down,
+ * for --rotate-alternate-sheets.
+ */
+static void
+build_transforms(int sheet_across, int sheet_down, boolean rotated)
+
+{
+  int	no_of_cells = sheet_across * sheet_down;
+  int	slot;
+
+  transforms = xrealloc(transforms, 2 * no_of_cells * sizeof(page_transform));
+
+  for (slot = 0; slot < no_of_cells; slot++)
+    {
+      page_transform	*upright = transforms + slot;
+      page_transform	*upside_down = transforms + no_of_cells + slot;
+      int		across;
+      int		down;
+
+      if (rotated)
+	{
+	  across = slot % sheet_across;
+	  down = slot / sheet_across;
+	}
+      else
+	{
+	  across = slot / sheet_down;
+	  down = sheet_down - 1 - slot % sheet_down;
+	}
+
+      upright->x = grid_edge(pos_left, printable_width, sheet_across, across, rotated);
+      upright->y = grid_edge(bottom_margin, printable_height, sheet_down, down, FALSE);
+      upright->rotation = rotated ? 90 : 0;
+
+      /* Turned upside down, the page lands in the opposite cell */
+      across = sheet_across - 1 - across;
+      down = sheet_down - 1 - down;
+      upside_down->x = grid_edge(pos_left, printable_width, sheet_across, across, !rotated);
+      upside_down->y = grid_edge(bottom_margin, printable_height, sheet_down, down, TRUE);
+      upside_down->rotation = rotated ? 270 : 180;
+    }
+
+  dm('O',3,"postscript.c:build_transforms %d across, %d down, rotated %d, scale %s\n",
+     sheet_across, sheet_down, rotated, page_scale);
+}
+
 /*
  * Function:
  * 	PS_pagesize()
@@ -823,8 +1217,23 @@ PS_pagesize(char *printer, int *width_ptr, int *length_ptr)
 {
   float margin_height;
   short tmp_sides;
+  int sheet_across, sheet_down;
+  boolean rotated;
 
   printer_stats(printer, &tmp_sides, &left_margin, &right_margin, &top_margin, &bottom_margin);
+
+  /*
+   * A booklet is two portrait pages on each side of each sheet, and a
+   * holepunch gap would end up in the fold
+   */
+  if (booklet)
+    {
+      layout = TWO_ON_ONE;
+      orientation = 'p';
+      no_of_sides = '2';
+      no_holepunch = TRUE;
+      no_top_holepunch = TRUE;
+    }
   if (no_of_sides == '0')
     {
       if (tmp_sides == 1)
@@ -851,18 +1260,26 @@ PS_pagesize(char *printer, int *width_ptr, int *length_ptr)
   if ((*length_ptr == -1) && (pointsize == 0))
     abort();
 
+  /*
+   * Work out the size of each logical page and how the logical pages are
+   * laid out on the sheet: how many cells across and down the sheet,
+   * and whether the logical pages are turned to fit them.  The four
+   * fixed layouts keep the sizes they have always had.
+   */
+  page_scale[0] = '\0';
   if (layout == ONE_ON_ONE)
     {
       logical_pages_on_physical_page = 1;
+      sheet_across = sheet_down = 1;
       if (orientation == 'p')
 	{
-	  logical_pages_rotated = FALSE;
+	  rotated = FALSE;
 	  virtual_width = printable_width;
 	  virtual_height = printable_height;
 	}
       else
 	{
-	  logical_pages_rotated = TRUE;
+	  rotated = TRUE;
 	  virtual_width = printable_height;
 	  virtual_height = printable_width;
 	}
@@ -870,15 +1287,18 @@ PS_pagesize(char *printer, int *width_ptr, int *length_ptr)
   else if (layout == TWO_ON_ONE)
     {
       logical_pages_on_physical_page = 2;
+      sheet_across = 1;
+      sheet_down = 2;
+      strcpy(page_scale, ".64");
       if (orientation == 'p')
 	{
-	  logical_pages_rotated = TRUE;
+	  rotated = TRUE;
 	  virtual_width = printable_height/2 * 1.56 - 3;
 	  virtual_height = printable_width * 1.56;
 	}
       else
 	{
-	  logical_pages_rotated = FALSE;
+	  rotated = FALSE;
 	  virtual_width = printable_width * 1.56;
 	  virtual_height = printable_height/2 * 1.56 - 3;
 	}
@@ -886,44 +1306,101 @@ PS_pagesize(char *printer, int *width_ptr, int *length_ptr)
   else if (layout == THREE_ON_ONE)
     {
       logical_pages_on_physical_page = 2;
+      sheet_across = 2;
+      sheet_down = 1;
+      strcpy(page_scale, ".5");
       if (orientation == 'p')
 	{
-	  logical_pages_rotated = FALSE;
+	  rotated = FALSE;
 	  virtual_width = printable_width - 4;
 	  virtual_height = printable_height * 2;
 	}
       else
 	{
-	  logical_pages_rotated = TRUE;
+	  rotated = TRUE;
 	  virtual_width = printable_height * 2;
 	  virtual_height = printable_width - 4;
 	}
     }
-  else
+  else if (layout == FOUR_ON_ONE)
     {
       logical_pages_on_physical_page = 4;
+      sheet_across = sheet_down = 2;
+      strcpy(page_scale, ".5");
       if (orientation == 'p')
 	{
-	  logical_pages_rotated = FALSE;
+	  rotated = FALSE;
 	  virtual_width = printable_width - 4;
 	  virtual_height = printable_height - 4;
 	}
       else
 	{
-	  logical_pages_rotated = TRUE;
+	  rotated = TRUE;
 	  virtual_width = printable_height - 4;
 	  virtual_height = printable_width - 4;
 	}
     }
+  else
+    {
+      /*
+       * Try every grid with the right number of cells, with the logical
+       * pages turned and not, and use the one that shrinks a 1-on-1
+       * page the least.  The logical page is then stretched to fill its
+       * cell.
+       */
+      float	page_across = (orientation == 'p') ? printable_width : printable_height;
+      float	page_down = (orientation == 'p') ? printable_height : printable_width;
+      float	scale = 0;
+      float	cell_width = 0;
+      float	cell_height = 0;
+      int	across;
+      int	turned;
+
+      sheet_across = sheet_down = 1;
+      rotated = FALSE;
+      for (across = 1; across <= logical_pages_on_physical_page; across++)
+	{
+	  int down = logical_pages_on_physical_page / across;
+
+	  if (across * down != logical_pages_on_physical_page) continue;
+	  if ((n_up_across != 0) && ((across != n_up_across) || (down != n_up_down))) continue;
+
+	  for (turned = FALSE; turned <= TRUE; turned++)
+	    {
+	      int	cells_across = turned ? down : across;
+	      int	cells_down = turned ? across : down;
+	      float	width = printable_width / cells_across - ((cells_across > 1) ? 2 * GUTTER + 1 : 0);
+	      float	height = printable_height / cells_down - ((cells_down > 1) ? 2 * GUTTER + 1 : 0);
+	      float	this_scale = turned ? width / page_down : width / page_across;
+
+	      if ((turned ? height / page_across : height / page_down) < this_scale)
+		this_scale = turned ? height / page_across : height / page_down;
+
+	      if (this_scale > scale + 0.001)
+		{
+		  scale = this_scale;
+		  cell_width = width;
+		  cell_height = height;
+		  sheet_across = cells_across;
+		  sheet_down = cells_down;
+		  rotated = turned;
+		}
+	    }
+	}
+
+      /* Round the scale down, so that what is printed is what was measured */
+      scale = (int)(scale * 1000) / 1000.0;
+      if (scale >= 1)
+	scale = 1;
+      else
+	sprintf(page_scale, "%.3f", scale);
+
+      virtual_width = (rotated ? cell_height : cell_width) / scale;
+      virtual_height = (rotated ? cell_width : cell_height) / scale;
+    }
 
-  pos_left          = left_margin;	
-  pos_centre_left   = left_margin + printable_width/2 - 2;
-  pos_centre_right  = left_margin + printable_width/2 + 2;
-  pos_right         = left_margin + printable_width;
-  pos_bottom        = bottom_margin;
-  pos_centre_bottom = bottom_margin + printable_height/2 - 2;
-  pos_centre_top    = bottom_margin + printable_height/2 + 2;
-  pos_top           = bottom_margin + printable_height;
+  pos_left = left_margin;
+  build_transforms(sheet_across, sheet_down, rotated);
 
   dm('O',3,"postscript.c:PS_pagesize virtual width %d, virtual height %d\n", virtual_width, virtual_height);
   dm('O',3,"postscript.c:PS_pagesize specified width %d, specified length %d\n", *width_ptr, *length_ptr);
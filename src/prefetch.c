@@ -0,0 +1,318 @@
+/*
+ * Source file:
+ *	prefetch.c
+ *
+ * With --prefetch, a process forked at the start of each pass opens and
+ * reads ahead the next few files while trueprint is busy with the
+ * current one, so that when print_files() gets to a file it is already
+ * in the cache.  This matters most for lots of small files on network
+ * storage, where opening each file costs more than reading it.
+ *
+ * trueprint tells the process which file it has got to through a pipe.
+ * The process keeps at most --prefetch files, and at most
+ * --prefetch-limit megabytes, ahead of it, and otherwise waits to hear
+ * that trueprint has moved on.  It never writes anything, and if it
+ * can't open or read a file it just moves on: trueprint will report the
+ * problem when it gets there itself.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef MSWIN
+# include <sys/wait.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int close(int fildes);
+extern pid_t fork(void);
+extern int pipe(int fildes[2]);
+extern int read(int fildes, void *buf, size_t nbyte);
+extern int write(int fildes, const void *buf, size_t nbyte);
+#endif
+
+#include "trueprint.h"
+#include "main.h"
+#include "utils.h"
+#include "debug.h"
+#include "options.h"
+
+#include "prefetch.h"
+
+/*
+ * Private part
+ */
+static short	prefetch_files;
+static short	prefetch_limit;		/* megabytes */
+static pid_t	prefetch_pid = -1;
+static int	prefetch_pipe = -1;	/* trueprint's end */
+static char	**files;
+
+static void run_prefetch(int from_trueprint);
+static off_t prefetch_one(const char *filename, off_t most);
+
+/******************************************************************************
+ * Function:
+ *	setup_prefetch
+ */
+void
+setup_prefetch(void)
+
+{
+  short_option(NULL, "prefetch", 0, NULL, 0, 0, 1000, &prefetch_files, NULL, NULL,
+	       OPT_MISC,
+	       "read the next <number> files ahead in the background",
+	       NULL);
+
+  short_option(NULL, "prefetch-limit", 16, NULL, 0, 1, 4096, &prefetch_limit, NULL, NULL,
+	       OPT_MISC,
+	       "read no more than <number> megabytes ahead with --prefetch",
+	       NULL);
+}
+
+/******************************************************************************
+ * Function:
+ *	start_prefetch
+ *
+ * Called at the start of each pass, before the first of filenames is
+ * opened.
+ */
+void
+start_prefetch(char **filenames)
+
+{
+#ifdef MSWIN
+  return;
+#else
+  int	fds[2];
+
+  if ((prefetch_files == 0) || (no_of_files < 2)) return;
+
+  files = filenames;
+  if (pipe(fds) == -1)
+    {
+      dm('p',2,"prefetch.c:start_prefetch() cannot create pipe, %s\n", strerror(errno));
+      return;
+    }
+
+  /* Don't let the child flush what is still buffered */
+  fflush(NULL);
+
+  if ((prefetch_pid = fork()) == -1)
+    {
+      dm('p',2,"prefetch.c:start_prefetch() cannot fork, %s\n", strerror(errno));
+      close(fds[0]);
+      close(fds[1]);
+      return;
+    }
+
+  if (prefetch_pid == 0)
+    {
+      close(fds[1]);
+      run_prefetch(fds[0]);
+      _exit(0);
+    }
+
+  close(fds[0]);
+  prefetch_pipe = fds[1];
+
+  /*
+   * If the process falls behind then trueprint mustn't wait for it,
+   * so anything that doesn't fit in the pipe is dropped: the next
+   * file number to get through says all the dropped ones did.
+   */
+  fcntl(prefetch_pipe, F_SETFL, fcntl(prefetch_pipe, F_GETFL) | O_NONBLOCK);
+
+  dm('p',2,"prefetch.c:start_prefetch() process %d reading %d files ahead\n",
+     (int)prefetch_pid, prefetch_files);
+#endif
+}
+
+/******************************************************************************
+ * Function:
+ *	prefetch_file
+ *
+ * Tells the prefetch process that trueprint is about to open file
+ * number file.  Reading ahead is only ever a help, so if the process
+ * has gone away then trueprint carries on without it, rather than
+ * being killed by a SIGPIPE.
+ */
+void
+prefetch_file(unsigned int file)
+
+{
+#ifndef MSWIN
+  struct sigaction	ignore;
+  struct sigaction	previous;
+  int			written;
+  int			write_errno;
+
+  if (prefetch_pipe == -1) return;
+
+  memset(&ignore, 0, sizeof(ignore));
+  ignore.sa_handler = SIG_IGN;
+  sigemptyset(&ignore.sa_mask);
+  sigaction(SIGPIPE, &ignore, &previous);
+  written = write(prefetch_pipe, &file, sizeof(file));
+  write_errno = errno;
+  sigaction(SIGPIPE, &previous, NULL);
+
+  if (written != -1) return;
+
+  if (write_errno == EPIPE)
+    {
+      dm('p',2,"prefetch.c:prefetch_file() prefetch process has gone, carrying on without it\n");
+      end_prefetch();
+    }
+  else
+    dm('p',4,"prefetch.c:prefetch_file() dropped file %u, %s\n", file, strerror(write_errno));
+#endif
+}
+
+/******************************************************************************
+ * Function:
+ *	end_prefetch
+ *
+ * Called at the end of each pass.  The process may be in the middle of
+ * reading a file that trueprint will never look at again, so rather
+ * than wait for it to finish, stop it.
+ */
+void
+end_prefetch(void)
+
+{
+#ifndef MSWIN
+  int	status;
+
+  if (prefetch_pipe == -1) return;
+
+  close(prefetch_pipe);
+  prefetch_pipe = -1;
+
+  kill(prefetch_pid, SIGTERM);
+  while ((waitpid(prefetch_pid, &status, 0) == -1) && (errno == EINTR))
+    ;
+  prefetch_pid = -1;
+#endif
+}
+
+#ifndef MSWIN
+/******************************************************************************
+ * Function:
+ *	run_prefetch
+ *
+ * The prefetch process.  Works through the files a step ahead of
+ * trueprint until trueprint closes the pipe, waiting at the end of the
+ * list rather than exiting early.
+ */
+static void
+run_prefetch(int from_trueprint)
+
+{
+  off_t		*sizes = xmalloc(no_of_files * sizeof(off_t));
+  off_t		limit = (off_t)prefetch_limit * 1024 * 1024;
+  off_t		ahead = 0;	/* bytes read in files trueprint hasn't reached */
+  unsigned int	current = 0;	/* the file trueprint is on */
+  unsigned int	next = 1;	/* the next file to read ahead */
+  unsigned int	reached;
+  boolean	blocking = TRUE;
+  ssize_t	got;
+
+  for (;;)
+    {
+      boolean	block = (next >= no_of_files)
+			|| (next - current > (unsigned int)prefetch_files)
+			|| (ahead >= limit);
+
+      /*
+       * Catch up with trueprint before reading anything more, and if
+       * there is nothing more to read until it moves on then wait.
+       */
+      if (block != blocking)
+	{
+	  int flags = fcntl(from_trueprint, F_GETFL);
+
+	  fcntl(from_trueprint, F_SETFL, block ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+	  blocking = block;
+	}
+
+      got = read(from_trueprint, &reached, sizeof(reached));
+      if (got == sizeof(reached))
+	{
+	  for (; (current < reached) && (current + 1 < next); current++)
+	    ahead -= sizes[current + 1];
+	  if (reached >= next)
+	    {
+	      current = reached;
+	      next = reached + 1;
+	      ahead = 0;
+	    }
+	}
+      else if ((got == -1) && !block && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+	{
+	  sizes[next] = prefetch_one(files[next], limit - ahead);
+	  ahead += sizes[next];
+	  next++;
+	}
+      else if (!((got == -1) && (errno == EINTR)))
+	break;
+    }
+
+  free(sizes);
+}
+
+/******************************************************************************
+ * Function:
+ *	prefetch_one
+ *
+ * Opens filename and gets at most most bytes of it into the cache.
+ * Returns the number of bytes asked for.
+ */
+static off_t
+prefetch_one(const char *filename, off_t most)
+
+{
+  int		fd;
+  struct stat	file_info;
+  off_t		wanted;
+
+  /* stdin is copied to a file in the first pass, so there's nothing to do */
+  if (strcmp(filename, "-") == 0) return 0;
+
+  if ((fd = open(filename, O_RDONLY)) == -1) return 0;
+
+  if ((fstat(fd, &file_info) == -1) || !S_ISREG(file_info.st_mode))
+    {
+      close(fd);
+      return 0;
+    }
+  wanted = (file_info.st_size < most) ? file_info.st_size : most;
+
+#ifdef POSIX_FADV_WILLNEED
+  /* Let the system do the reading, in the background */
+  if (posix_fadvise(fd, 0, wanted, POSIX_FADV_WILLNEED) != 0)
+#endif
+    {
+      char	buffer[BUFFER_SIZE];
+      off_t	done = 0;
+      ssize_t	got;
+
+      while ((done < wanted) && ((got = read(fd, buffer, BUFFER_SIZE)) > 0))
+	done += got;
+    }
+
+  close(fd);
+  dm('p',3,"prefetch.c:prefetch_one() read ahead %ld bytes of %s\n", (long)wanted, filename);
+  return wanted;
+}
+#endif
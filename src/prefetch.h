@@ -0,0 +1,9 @@
+/*
+ * Include file:
+ *	prefetch.h
+ */
+
+extern void setup_prefetch(void);
+extern void start_prefetch(char **filenames);
+extern void prefetch_file(unsigned int file);
+extern void end_prefetch(void);
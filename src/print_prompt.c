@@ -24,6 +24,7 @@
  */
 
 char    *print_selection;
+boolean changed_pages_only;
 
 
 
@@ -50,6 +51,12 @@ setup_print_prompter(void)
 		 "don't prompt for each page, whether it should be printed or not",
 		 "prompt for each page, whether it should be printed or not");
 
+  boolean_option(NULL, "changed-pages-only", "all-pages", FALSE, &changed_pages_only, NULL, NULL,
+		 OPT_PRINT,
+		 "leave out pages and functions with no changes (needs --diff,\n"
+		 "    --diff-patch or --diff-revision)",
+		 "print pages and functions whether or not they have changes");
+
 }
 
 /*
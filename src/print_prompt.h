@@ -9,6 +9,8 @@ typedef enum {
   PAGE_BODY
 } page_types;
 
+extern boolean changed_pages_only;
+
 extern void setup_print_prompter(void);
 extern boolean print_prompt(page_types type, long filepage_no, char *file);
 extern void skipspaces(char **);
@@ -3,14 +3,44 @@
  *	printers_fl.c
  *
  * Reads in the printers file and returns values based on printer name
+ *
+ * The printers file is compiled into an image with a hash table of
+ * printer names, each already resolved to its printer type.  The image
+ * is saved next to the printers file with the suffix .cache, and later
+ * runs map the saved image instead of reading the printers file, as
+ * long as the printers file hasn't changed since.  Users who can't write
+ * there, which is most of them for an installed printers file, get a
+ * cache of their own in ~/.trueprint instead.  If no cache can be
+ * written then the image is simply built afresh on each run.
  */
 
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef MSWIN
+# include <sys/mman.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int close(int fildes);
+extern int read(int fildes, void *buf, size_t nbyte);
+extern int write(int fildes, const void *buf, size_t nbyte);
+extern int unlink(const char *path);
+extern pid_t getpid(void);
+#endif
+
+#ifndef O_RDONLY
+# define O_RDONLY 0
+#endif
 
 #include "trueprint.h"
 #include "main.h"
@@ -36,96 +66,289 @@ typedef struct printer_record {
   struct printer_record *next;
 } printer_record;
 
+/*
+ * The compiled image: a header, the printer types, the hash table of
+ * printer names and finally the strings.  The offsets in the header
+ * are from the start of the image.
+ */
+#define CACHE_MAGIC	"TPPRNT2"
+#define CACHE_SUFFIX	".cache"
+#define USER_CACHE_DIR	"/.trueprint"
+#define NO_TYPE		-1
+
+typedef struct cache_header {
+  char		magic[8];
+  unsigned int	header_size;	/* catches images from a different build */
+  unsigned int	image_size;
+  long		source_mtime;	/* of the printers file the image came from */
+  long		source_ctime;
+  long		source_size;
+  unsigned long	source_device;	/* an edit that makes a new file changes these */
+  unsigned long	source_inode;
+  unsigned int	hash_size;	/* slots in the names table, a power of 2 */
+  unsigned int	types_offset;
+  unsigned int	names_offset;
+  unsigned int	strings_offset;
+} cache_header;
+
+typedef struct cache_type {
+  unsigned int	name;		/* offset of the name in the strings */
+  int		sides, left, right, top, bottom;
+} cache_type;
+
+typedef struct cache_name {
+  unsigned int	name;		/* offset of the name plus one, 0 for an empty slot */
+  unsigned int	type_name;	/* offset of the type's name in the strings */
+  int		type;		/* index into the types, or NO_TYPE */
+} cache_name;
+
 static struct printer_type *parse_printer_type(char *line);
 static struct printer_record *parse_printer_record(char *line);
+static unsigned int hash_string(const char *string, size_t length);
+static boolean map_cache(const char *cache_filename, struct stat *source_stat);
+static boolean check_cache(void);
+static boolean compile_printers_file(struct stat *source_stat);
+static boolean save_cache(const char *cache_filename);
+static char *user_cache_filename(void);
+static const cache_name *find_printer(const char *printer);
 static char *printers_filename;
 
+/*
+ * The printers file is read at most once per process, so that a server
+ * (see server.c) can read it before it starts taking jobs.
+ */
+static boolean printers_file_read;
+static boolean printers_file_ok;
+static int printers_file_errno;
+static char *image;
+static size_t image_size;
+static boolean image_mapped;
+
 /******************************************************************************
  * Function:
  *	setup_printersile_fl
  * If environment variable PRINTERS_FILE is set then use that, otherwise
  * use the configured value for PRINTERS_FILE.
+ *
+ * A server calls this again for each job, so the printers file that has
+ * already been read is kept unless the job names a different one.
  */
 void
 setup_printers_fl(void)
 {
-  printers_filename = NULL;
+  char *filename = NULL;
 
   if (use_environment)
-    printers_filename = getenv("TP_PRINTERS_FILE");
+    filename = getenv("TP_PRINTERS_FILE");
+
+  if ((filename == NULL) || (strlen(filename) == 0))
+    filename = PRINTERS_FILE;
 
-  if ((printers_filename == NULL) || (strlen(printers_filename) == 0))
-    printers_filename = PRINTERS_FILE;
+  if (printers_file_read && (strcmp(filename, printers_filename) != 0))
+    {
+#ifndef MSWIN
+      if (image_mapped) munmap(image, image_size);
+      else
+#endif
+	free(image);
+      image = NULL;
+      printers_file_read = FALSE;
+      printers_file_ok = FALSE;
+    }
+
+  printers_filename = filename;
 }
 
 /******************************************************************************
  * Function:
- *	printer_stats
+ *	hash_string
  *
- * Looks up printer in printers_filename.
+ * The hash is saved in the cache, so it must not depend on the size of
+ * size_t.
  */
-void
-printer_stats(char *printer, short *sides, 
-	      unsigned short *lm, unsigned short *rm, 
-	      unsigned short *tm, unsigned short *bm)
+static unsigned int
+hash_string(const char *string, size_t length)
 {
-  char buffer[1024];
-  char *env_printer;
-  FILE *printers_file;
-  printer_record *printers_list = NULL;
-  printer_type *types_list = NULL;
-  printer_record *tmp_printer = NULL;
-  printer_type *tmp_type = NULL;
-  printer_record *this_printer = NULL;
-  printer_type *this_type = NULL;
+  unsigned int hash = 5381;
 
-  /*
-   * Set up defaults
-   */
-  *lm	= 15;
-  *rm	= 590;
-  *tm	= 776;
-  *bm	= 30;
-  *sides = 1;
+  while (length-- > 0)
+    hash = ((hash * 33) ^ (unsigned char)*string++) & 0xffffffffU;
 
-  /*
-   * If this is a test and nothing should be taken from outside trueprint,
-   * then simply use the default settings
-   */
-  if (!use_environment)
+  return hash;
+}
+
+/******************************************************************************
+ * Function:
+ *	map_cache
+ *
+ * Maps the cache, if there is one and it was made from the printers file
+ * as it is now.
+ */
+static boolean
+map_cache(const char *cache_filename, struct stat *source_stat)
+{
+  struct stat	cache_stat;
+  cache_header	*header;
+  int		fd;
+
+  if ((fd = open(cache_filename, O_RDONLY)) == -1) return FALSE;
+
+  if ((fstat(fd, &cache_stat) == -1)
+      || ((size_t)cache_stat.st_size < sizeof(cache_header)))
     {
-      env_printer = "testprinter";
-      dm('D',3,"Using testprinter entry\n");
-      return;
+      close(fd);
+      return FALSE;
     }
 
-  /*
-   * If there is no printer name use the defaults
-   */
-  if ((printer == NULL) || (*printer == '\0'))
+  image_size = (size_t)cache_stat.st_size;
+#ifndef MSWIN
+  image = mmap(NULL, image_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (image == MAP_FAILED)
     {
-      if (((env_printer = getenv("PRINTER")) == NULL) || (*env_printer == '\0'))
-	{
-	  dm('D',3, CMD_NAME ": $PRINTER null or not defined: using default printer properties\n");
-	  return;
-	}
-      else
+      image = NULL;
+      close(fd);
+      return FALSE;
+    }
+  image_mapped = TRUE;
+#else
+  image = xmalloc(image_size);
+  if (read(fd, image, image_size) != (int)image_size)
+    {
+      free(image);
+      image = NULL;
+      close(fd);
+      return FALSE;
+    }
+  image_mapped = FALSE;
+#endif
+  close(fd);
+
+  header = (cache_header *)image;
+  if ((memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0)
+      && (header->header_size == sizeof(cache_header))
+      && (header->image_size == image_size)
+      && (header->source_mtime == (long)source_stat->st_mtime)
+      && (header->source_ctime == (long)source_stat->st_ctime)
+      && (header->source_size == (long)source_stat->st_size)
+      && (header->source_device == (unsigned long)source_stat->st_dev)
+      && (header->source_inode == (unsigned long)source_stat->st_ino)
+      && check_cache())
+    {
+      dm('D',3,"printers_fl.c:map_cache() using %s\n", cache_filename);
+      return TRUE;
+    }
+
+  dm('D',3,"printers_fl.c:map_cache() %s is out of date\n", cache_filename);
+#ifndef MSWIN
+  munmap(image, image_size);
+#else
+  free(image);
+#endif
+  image = NULL;
+  return FALSE;
+}
+
+/******************************************************************************
+ * Function:
+ *	check_cache
+ *
+ * Checks that everything in the mapped image lies inside it, so that a
+ * corrupt or foreign cache is rebuilt rather than read out of bounds.
+ * The arithmetic is done so that it can't overflow, whatever the header
+ * says.
+ */
+static boolean
+check_cache(void)
+{
+  const cache_header *header = (const cache_header *)image;
+  const cache_type *types;
+  const cache_name *names;
+  size_t	no_of_types;
+  size_t	strings_size;
+  size_t	index;
+  boolean	empty_slot = FALSE;
+
+  /* The tables must follow the header, in order, each a whole number of entries */
+  if ((header->types_offset < sizeof(cache_header))
+      || (header->types_offset % sizeof(int) != 0)
+      || (header->names_offset < header->types_offset)
+      || ((header->names_offset - header->types_offset) % sizeof(cache_type) != 0)
+      || (header->strings_offset < header->names_offset)
+      || (header->strings_offset > image_size))
+    return FALSE;
+
+  /* find_printer() uses hash_size - 1 as a mask */
+  if ((header->hash_size == 0) || ((header->hash_size & (header->hash_size - 1)) != 0)
+      || (header->hash_size != (header->strings_offset - header->names_offset) / sizeof(cache_name))
+      || ((header->strings_offset - header->names_offset) % sizeof(cache_name) != 0))
+    return FALSE;
+
+  /* Every string ends inside the image if the last one does */
+  strings_size = image_size - header->strings_offset;
+  if ((strings_size > 0) && (image[image_size - 1] != '\0'))
+    return FALSE;
+
+  no_of_types = (header->names_offset - header->types_offset) / sizeof(cache_type);
+  types = (const cache_type *)(image + header->types_offset);
+  for (index = 0; index < no_of_types; index++)
+    if (types[index].name >= strings_size) return FALSE;
+
+  names = (const cache_name *)(image + header->names_offset);
+  for (index = 0; index < header->hash_size; index++)
+    {
+      if (names[index].name == 0)
 	{
-	  printer = env_printer;
+	  /* Without one, looking up a missing printer would never stop */
+	  empty_slot = TRUE;
+	  continue;
 	}
+      if ((names[index].name - 1 >= strings_size)
+	  || (names[index].type_name >= strings_size)
+	  || ((names[index].type != NO_TYPE)
+	      && ((names[index].type < 0) || ((size_t)names[index].type >= no_of_types))))
+	return FALSE;
     }
 
-  /*
-   * Open the printers file, and return defaults if we can't
-   */
+  return empty_slot;
+}
+
+/******************************************************************************
+ * Function:
+ *	compile_printers_file
+ *
+ * Reads the printers file and builds the image in memory.  Where a name
+ * or type appears more than once the last one in the file is used.
+ */
+static boolean
+compile_printers_file(struct stat *source_stat)
+{
+  char		buffer[1024];
+  FILE		*printers_file;
+  printer_record *printers_list = NULL;
+  printer_type	*types_list = NULL;
+  printer_record *tmp_printer;
+  printer_type	*tmp_type;
+  cache_header	header;
+  cache_type	*types = NULL;
+  cache_name	*names;
+  unsigned int	*type_table;	/* type indexes plus one, by name */
+  char		*strings = NULL;
+  size_t	strings_size = 0;
+  size_t	strings_used = 0;
+  unsigned int	no_of_types = 0;
+  unsigned int	no_of_names = 0;
+  unsigned int	hash_size;
+  unsigned int	mask;
+
   if ((printers_file = fopen(printers_filename, "r")) == NULL)
     {
-      fprintf(stderr, gettext(CMD_NAME ": warning: cannot open %s, %s\n"), printers_filename, strerror(errno));
-      return;
+      printers_file_errno = errno;
+      return FALSE;
     }
 
   /*
-   * Read in the printer file information
+   * Read in the printer file information.  The lists end up in reverse
+   * order, so the first entry found for anything is the last in the file.
    */
   while (fgets(buffer, 1024, printers_file))
     {
@@ -142,74 +365,388 @@ printer_stats(char *printer, short *sides,
 	  tmp_type = parse_printer_type(buffer);
 	  tmp_type->next = types_list;
 	  types_list = tmp_type;
+	  no_of_types++;
 	}
       else if (strncmp(buffer, "printer", 7) == 0)
 	{
+	  char *name;
+
 	  tmp_printer = parse_printer_record(buffer);
 	  tmp_printer->next = printers_list;
 	  printers_list = tmp_printer;
+	  for (name = tmp_printer->names; name; name = strchr(name + 1, ','))
+	    no_of_names++;
 	}
     }
 
+  if (fclose(printers_file) == EOF)
+    {
+      perror(CMD_NAME ": Cannot close printers file");
+      exit(2);
+    }
+
   /*
-   * Find printer
+   * Both tables are at most half full
    */
-  for (tmp_printer = printers_list; tmp_printer; tmp_printer = tmp_printer->next)
+  for (hash_size = 8; (hash_size < no_of_names * 2) || (hash_size < no_of_types * 2); hash_size *= 2)
+    ;
+  mask = hash_size - 1;
+  names = xmalloc(hash_size * sizeof(cache_name));
+  memset(names, 0, hash_size * sizeof(cache_name));
+  type_table = xmalloc(hash_size * sizeof(unsigned int));
+  memset(type_table, 0, hash_size * sizeof(unsigned int));
+  if (no_of_types > 0) types = xmalloc(no_of_types * sizeof(cache_type));
+
+#define ADD_STRING(s, length) \
+  (((strings_used + (length) + 1 > strings_size) \
+    ? (strings_size = (strings_size + (length) + 1) * 2, \
+       strings = xrealloc(strings, strings_size)) : 0), \
+   memcpy(strings + strings_used, (s), (length)), \
+   strings[strings_used + (length)] = '\0', \
+   (strings_used += (length) + 1) - (length) - 1)
+
+  no_of_types = 0;
+  for (tmp_type = types_list; tmp_type; tmp_type = tmp_type->next)
     {
-      char *s = strtok(tmp_printer->names,",");
+      size_t	length = strlen(tmp_type->name);
+      unsigned int slot = hash_string(tmp_type->name, length) & mask;
+
+      while (type_table[slot]
+	     && (strcmp(strings + types[type_table[slot]-1].name, tmp_type->name) != 0))
+	slot = (slot + 1) & mask;
+      if (type_table[slot]) continue;
+
+      types[no_of_types].name = (unsigned int)ADD_STRING(tmp_type->name, length);
+      types[no_of_types].sides = tmp_type->sides;
+      types[no_of_types].left = tmp_type->left;
+      types[no_of_types].right = tmp_type->right;
+      types[no_of_types].top = tmp_type->top;
+      types[no_of_types].bottom = tmp_type->bottom;
+      type_table[slot] = ++no_of_types;
+    }
 
-      while (s)
+  for (tmp_printer = printers_list; tmp_printer; tmp_printer = tmp_printer->next)
+    {
+      size_t	type_length = strlen(tmp_printer->type);
+      unsigned int slot = hash_string(tmp_printer->type, type_length) & mask;
+      int	type;
+      unsigned int type_name;
+      char	*name;
+
+      while (type_table[slot]
+	     && (strcmp(strings + types[type_table[slot]-1].name, tmp_printer->type) != 0))
+	slot = (slot + 1) & mask;
+      type = (int)type_table[slot] - 1;
+      type_name = (type == NO_TYPE)
+	? (unsigned int)ADD_STRING(tmp_printer->type, type_length)
+	: types[type].name;
+
+      for (name = tmp_printer->names; *name; )
 	{
-	  dm('D',5,"Comparing printer names %s and %s\n",printer,s);
-	  if (strcmp(printer,s) == 0)
+	  size_t length = strcspn(name, ",");
+
+	  slot = hash_string(name, length) & mask;
+	  while (names[slot].name
+		 && ((strncmp(strings + names[slot].name - 1, name, length) != 0)
+		     || (strings[names[slot].name - 1 + length] != '\0')))
+	    slot = (slot + 1) & mask;
+	  if (!names[slot].name)
 	    {
-	      this_printer = tmp_printer;
-	      break;
+	      names[slot].name = (unsigned int)ADD_STRING(name, length) + 1;
+	      names[slot].type_name = type_name;
+	      names[slot].type = type;
 	    }
-	  s = strtok(NULL,",");
+
+	  name += length;
+	  if (*name == ',') name++;
 	}
-      if (this_printer) break;
     }
+#undef ADD_STRING
 
   /*
-   * If printer not found, return defaults
+   * Put the image together
    */
-  if (!this_printer)
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.header_size = sizeof(cache_header);
+  header.source_mtime = (long)source_stat->st_mtime;
+  header.source_ctime = (long)source_stat->st_ctime;
+  header.source_size = (long)source_stat->st_size;
+  header.source_device = (unsigned long)source_stat->st_dev;
+  header.source_inode = (unsigned long)source_stat->st_ino;
+  header.hash_size = hash_size;
+  header.types_offset = sizeof(cache_header);
+  header.names_offset = header.types_offset + no_of_types * sizeof(cache_type);
+  header.strings_offset = header.names_offset + hash_size * sizeof(cache_name);
+  header.image_size = header.strings_offset + (unsigned int)strings_used;
+
+  image_size = header.image_size;
+  image = xmalloc(image_size);
+  image_mapped = FALSE;
+  memcpy(image, &header, sizeof(header));
+  if (no_of_types > 0)
+    memcpy(image + header.types_offset, types, no_of_types * sizeof(cache_type));
+  memcpy(image + header.names_offset, names, hash_size * sizeof(cache_name));
+  if (strings_used > 0)
+    memcpy(image + header.strings_offset, strings, strings_used);
+
+  free(types);
+  free(names);
+  free(type_table);
+  free(strings);
+
+  while (types_list)
     {
-      fprintf(stderr, gettext(CMD_NAME ": warning: cannot find printer %s in %s\n"), printer, printers_filename);
-      fprintf(stderr, gettext(CMD_NAME ": send mail to %s if you want to have it added\n"), TP_ADMIN_USER);
+      tmp_type = types_list->next;
+      free(types_list->name);
+      free(types_list);
+      types_list = tmp_type;
+    }
+  while (printers_list)
+    {
+      tmp_printer = printers_list->next;
+      free(printers_list->names);
+      free(printers_list->type);
+      free(printers_list);
+      printers_list = tmp_printer;
+    }
+
+  dm('D',2,"printers_fl.c:compile_printers_file() %u types, %u names, %lu byte image\n",
+     no_of_types, no_of_names, (unsigned long)image_size);
+
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	save_cache
+ *
+ * Writes the image to a temporary file and renames it into place, so
+ * that another trueprint never maps a half-written cache.  Returns
+ * FALSE if it fails, which only means the next run builds the image
+ * again.
+ */
+static boolean
+save_cache(const char *cache_filename)
+{
+  char	*temp_filename;
+  int	fd;
+  boolean written;
+
+  temp_filename = xmalloc(strlen(cache_filename) + 24);
+  sprintf(temp_filename, "%s.%ld", cache_filename, (long)getpid());
+
+  if ((fd = open(temp_filename, O_WRONLY|O_CREAT|O_EXCL, 0644)) == -1)
+    {
+      dm('D',3,"printers_fl.c:save_cache() cannot create %s\n", temp_filename);
+      free(temp_filename);
+      return FALSE;
+    }
+
+  written = (write(fd, image, image_size) == (int)image_size);
+  if (close(fd) == -1) written = FALSE;
+
+  if (!written || (rename(temp_filename, cache_filename) == -1))
+    {
+      dm('D',3,"printers_fl.c:save_cache() cannot write %s\n", cache_filename);
+      unlink(temp_filename);
+      written = FALSE;
+    }
+  else
+    dm('D',3,"printers_fl.c:save_cache() wrote %s\n", cache_filename);
+
+  free(temp_filename);
+  return written;
+}
+
+/******************************************************************************
+ * Function:
+ *	user_cache_filename
+ *
+ * Returns the name of the user's own cache for printers_filename, in
+ * ~/.trueprint, or NULL if there is no home directory.  The name
+ * includes a hash of the printers file's name, so that each printers
+ * file gets its own cache.
+ */
+static char *
+user_cache_filename(void)
+{
+  char	*home = getenv("HOME");
+  char	*filename;
+
+  if ((home == NULL) || (*home == '\0')) return NULL;
+
+  filename = xmalloc(strlen(home) + sizeof(USER_CACHE_DIR) + 32);
+  sprintf(filename, "%s%s", home, USER_CACHE_DIR);
+  mkdir(filename, 0777);
+  sprintf(filename + strlen(filename), "/printers-%08x%s",
+	  hash_string(printers_filename, strlen(printers_filename)), CACHE_SUFFIX);
+
+  return filename;
+}
+
+/******************************************************************************
+ * Function:
+ *	read_printers_file
+ *
+ * Gets the image for printers_filename, from the cache if that is up to
+ * date and otherwise by compiling the printers file, if that hasn't been
+ * done already.  Returns FALSE if the file can't be read, leaving the
+ * caller to complain if it actually needs the file.
+ */
+boolean
+read_printers_file(void)
+{
+  struct stat	source_stat;
+  char		*cache_filename;
+
+  if (printers_file_read) return printers_file_ok;
+  printers_file_read = TRUE;
+
+  if (stat(printers_filename, &source_stat) == -1)
+    {
+      printers_file_errno = errno;
+      return FALSE;
+    }
+
+  cache_filename = xmalloc(strlen(printers_filename) + sizeof(CACHE_SUFFIX));
+  strcpy(cache_filename, printers_filename);
+  strcat(cache_filename, CACHE_SUFFIX);
+
+  if (map_cache(cache_filename, &source_stat))
+    printers_file_ok = TRUE;
+  else
+    {
+      char *user_cache = user_cache_filename();
+
+      if ((user_cache != NULL) && map_cache(user_cache, &source_stat))
+	printers_file_ok = TRUE;
+      else if (compile_printers_file(&source_stat))
+	{
+	  if (!save_cache(cache_filename) && (user_cache != NULL))
+	    save_cache(user_cache);
+	  printers_file_ok = TRUE;
+	}
+      free(user_cache);
+    }
+
+  free(cache_filename);
+  return printers_file_ok;
+}
+
+/******************************************************************************
+ * Function:
+ *	find_printer
+ *
+ * Returns the entry for printer in the image, or NULL.
+ */
+static const cache_name *
+find_printer(const char *printer)
+{
+  const cache_header *header = (const cache_header *)image;
+  const cache_name *names = (const cache_name *)(image + header->names_offset);
+  const char	*strings = image + header->strings_offset;
+  unsigned int	mask = header->hash_size - 1;
+  unsigned int	slot = hash_string(printer, strlen(printer)) & mask;
+
+  while (names[slot].name)
+    {
+      dm('D',5,"Comparing printer names %s and %s\n",printer,strings + names[slot].name - 1);
+      if (strcmp(strings + names[slot].name - 1, printer) == 0)
+	return &names[slot];
+      slot = (slot + 1) & mask;
+    }
+
+  return NULL;
+}
+
+/******************************************************************************
+ * Function:
+ *	printer_stats
+ *
+ * Looks up printer in printers_filename.
+ */
+void
+printer_stats(char *printer, short *sides, 
+	      unsigned short *lm, unsigned short *rm, 
+	      unsigned short *tm, unsigned short *bm)
+{
+  char *env_printer;
+  const cache_header *header;
+  const cache_name *this_printer;
+  const cache_type *this_type;
+  const char *strings;
+
+  /*
+   * Set up defaults
+   */
+  *lm	= 15;
+  *rm	= 590;
+  *tm	= 776;
+  *bm	= 30;
+  *sides = 1;
+
+  /*
+   * If this is a test and nothing should be taken from outside trueprint,
+   * then simply use the default settings
+   */
+  if (!use_environment)
+    {
+      env_printer = "testprinter";
+      dm('D',3,"Using testprinter entry\n");
       return;
     }
 
   /*
-   * Find type
+   * If there is no printer name use the defaults
    */
-  for (tmp_type = types_list; tmp_type; tmp_type = tmp_type->next)
+  if ((printer == NULL) || (*printer == '\0'))
     {
-      if (strcmp(this_printer->type,tmp_type->name) == 0)
+      if (((env_printer = getenv("PRINTER")) == NULL) || (*env_printer == '\0'))
+	{
+	  dm('D',3, CMD_NAME ": $PRINTER null or not defined: using default printer properties\n");
+	  return;
+	}
+      else
 	{
-	  this_type = tmp_type;
-	  break;
+	  printer = env_printer;
 	}
     }
 
   /*
-   * If printer type not found, return defaults
+   * Read the printers file, and return defaults if we can't
    */
-  if (!this_type)
+  if (!read_printers_file())
     {
-      fprintf(stderr, gettext(CMD_NAME ": warning: cannot find printer type %s in %s\n"), this_printer->type, printers_filename);
-      fprintf(stderr, gettext(CMD_NAME ": you should notify %s\n"), TP_ADMIN_USER);
+      fprintf(stderr, gettext(CMD_NAME ": warning: cannot open %s, %s\n"), printers_filename, strerror(printers_file_errno));
       return;
     }
 
-  if (fclose(printers_file) == EOF)
+  header = (const cache_header *)image;
+  strings = image + header->strings_offset;
+
+  /*
+   * Find printer, and if it isn't there return defaults
+   */
+  if ((this_printer = find_printer(printer)) == NULL)
     {
-      perror(CMD_NAME ": Cannot close printers file");
-      exit(2);
+      fprintf(stderr, gettext(CMD_NAME ": warning: cannot find printer %s in %s\n"), printer, printers_filename);
+      fprintf(stderr, gettext(CMD_NAME ": send mail to %s if you want to have it added\n"), TP_ADMIN_USER);
+      return;
+    }
+
+  /*
+   * If printer type not found, return defaults
+   */
+  if (this_printer->type == NO_TYPE)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": warning: cannot find printer type %s in %s\n"), strings + this_printer->type_name, printers_filename);
+      fprintf(stderr, gettext(CMD_NAME ": you should notify %s\n"), TP_ADMIN_USER);
+      return;
     }
 
-  dm('D',3,"printers_file.c: Printer type %s\n", this_type->name);
+  this_type = (const cache_type *)(image + header->types_offset) + this_printer->type;
+  dm('D',3,"printers_file.c: Printer type %s\n", strings + this_type->name);
 
   *lm	= this_type->left;
   *rm	= this_type->right;
@@ -267,7 +804,7 @@ struct printer_record *parse_printer_record(char *line)
   r->type     = strdup(strtok(NULL, ":"));
 
   /* Overwrite newline at end of last field */
-  r->type[strlen(r->type)-1] = '\0';
+  r->type[strcspn(r->type, "\n")] = '\0';
 
   r->next     = NULL;
 
@@ -1,2 +1,3 @@
 extern void setup_printers_fl(void);
 extern void printer_stats(char *printer,short *sides, unsigned short *lm, unsigned short *rm, unsigned short *tm, unsigned short *bm);
+extern boolean read_printers_file(void);
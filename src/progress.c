@@ -0,0 +1,258 @@
+/*
+ * Source file:
+ *	progress.c
+ *
+ * With --progress, reports how a job is getting on every few seconds:
+ * which pass it is on, which file, how much of the input has been read
+ * and how many pages made, and in the second pass how long is left.
+ * The first pass reads all the input, so its byte count is what the
+ * second pass measures itself against.
+ *
+ * A timer sets progress_due and the report is written the next time
+ * trueprint starts a page or a file, so between reports all it costs is
+ * one test of a flag per page.
+ */
+
+#include "config.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int write(int fildes, const void *buf, size_t nbyte);
+#endif
+
+#include "trueprint.h"
+#include "main.h"
+#include "input.h"
+#include "output.h"
+#include "debug.h"
+#include "options.h"
+
+#include "progress.h"
+
+#if defined(SIGALRM) && defined(ITIMER_REAL)
+# define HAVE_PROGRESS_TIMER 1
+#endif
+
+#define PROGRESS_INTERVAL	2	/* seconds between reports */
+
+/*
+ * Public part
+ */
+volatile sig_atomic_t	progress_due;
+
+/*
+ * Private part
+ */
+static boolean	progress_wanted;
+static short	progress_fd;
+static boolean	timer_running;
+static time_t	pass_start;
+static time_t	job_start;
+static long	first_pass_bytes;
+
+#if HAVE_PROGRESS_TIMER
+static void progress_alarm(int signal_number);
+static void set_progress_timer(int seconds);
+#endif
+static void write_progress(const char *line);
+
+/*****************************************************************************
+ * Function:
+ *	setup_progress
+ */
+void
+setup_progress(void)
+
+{
+  boolean_option(NULL, "progress", "no-progress", FALSE, &progress_wanted, NULL, NULL,
+		 OPT_MISC,
+		 "report how the job is getting on every few seconds",
+		 "don't report how the job is getting on");
+
+  short_option(NULL, "progress-fd", 2, NULL, 0, 0, 1023, &progress_fd, NULL, NULL,
+	       OPT_MISC,
+	       "write --progress reports to file descriptor <number>\n"
+	       "    instead of standard error",
+	       NULL);
+}
+
+#if HAVE_PROGRESS_TIMER
+/*****************************************************************************
+ * Function:
+ *	progress_alarm
+ */
+static void
+progress_alarm(int signal_number)
+
+{
+  progress_due = 1;
+}
+
+/*****************************************************************************
+ * Function:
+ *	set_progress_timer
+ *
+ * Starts the timer going off every so many seconds, or stops it if
+ * seconds is 0.
+ */
+static void
+set_progress_timer(int seconds)
+
+{
+  struct itimerval	timer;
+
+  timer.it_interval.tv_sec = seconds;
+  timer.it_interval.tv_usec = 0;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_REAL, &timer, NULL);
+}
+#endif
+
+/*****************************************************************************
+ * Function:
+ *	start_progress_pass
+ *
+ * Called at the start of each pass.  The timer isn't inherited by
+ * processes that trueprint forks, so it is only ever running here.
+ */
+void
+start_progress_pass(void)
+
+{
+  if (!progress_wanted) return;
+
+  pass_start = time(NULL);
+  if (pass == 0)
+    job_start = pass_start;
+  else
+    first_pass_bytes = input_bytes;
+  input_bytes = 0;
+
+#if HAVE_PROGRESS_TIMER
+  if (!timer_running)
+    {
+      struct sigaction	action;
+
+      memset(&action, 0, sizeof(action));
+      action.sa_handler = progress_alarm;
+      sigemptyset(&action.sa_mask);
+# ifdef SA_RESTART
+      /* Reads and writes carry on as though nothing had happened */
+      action.sa_flags = SA_RESTART;
+# endif
+      sigaction(SIGALRM, &action, NULL);
+      set_progress_timer(PROGRESS_INTERVAL);
+      timer_running = TRUE;
+    }
+#endif
+
+  progress_due = 0;
+  dm('p',2,"progress.c:start_progress_pass() pass %d, first pass read %ld bytes\n",
+     pass, first_pass_bytes);
+}
+
+/*****************************************************************************
+ * Function:
+ *	report_progress
+ */
+void
+report_progress(void)
+
+{
+  char		line[256];
+  time_t	now = time(NULL);
+  unsigned int	file = (file_number < no_of_files) ? file_number + 1 : 0;
+  const char	*name = (file_number < no_of_files) ? current_filename : "";
+  int		length;
+
+  progress_due = 0;
+  if (!progress_wanted) return;
+
+  if ((pass == 1) && (file == 0))
+    {
+      strcpy(line, CMD_NAME ": pass 2 of 2, printing the indexes\n");
+    }
+  else if (pass == 0)
+    {
+      sprintf(line, CMD_NAME ": pass 1 of 2, file %u/%u, %ld bytes, %ld pages, %lds\n",
+	      file, no_of_files, input_bytes, page_number, (long)(now - pass_start));
+    }
+  else
+    {
+      length = sprintf(line, CMD_NAME ": pass 2 of 2, file %u/%u, %ld/%ld bytes, page %ld of %ld",
+		       file, no_of_files, input_bytes, first_pass_bytes, page_number, total_pages);
+
+      /*
+       * The rest of the pass should go at the rate it has gone so far
+       */
+      if ((input_bytes > 0) && (first_pass_bytes >= input_bytes) && (now > pass_start))
+	{
+	  long left = (long)((double)(now - pass_start) * (first_pass_bytes - input_bytes) / input_bytes);
+
+	  sprintf(line + length, ", about %ldm%02lds left\n", left / 60, left % 60);
+	}
+      else
+	strcpy(line + length, "\n");
+    }
+
+  /* Then the file's name, cut short if need be, with room for " ()\n" and the NUL */
+  length = strlen(line) - 1;
+  if ((*name != '\0') && (length + 5 < (int)sizeof(line)))
+    sprintf(line + length, " (%.*s)\n", (int)sizeof(line) - length - 5, name);
+
+  write_progress(line);
+}
+
+/*****************************************************************************
+ * Function:
+ *	end_progress
+ *
+ * Stops the timer and reports how the job went.
+ */
+void
+end_progress(void)
+
+{
+  char	line[128];
+
+  if (!progress_wanted) return;
+
+#if HAVE_PROGRESS_TIMER
+  if (timer_running)
+    {
+      set_progress_timer(0);
+      signal(SIGALRM, SIG_DFL);
+      timer_running = FALSE;
+    }
+#endif
+  progress_due = 0;
+
+  sprintf(line, CMD_NAME ": done, %u files, %ld bytes, %ld pages, %lds\n",
+	  no_of_files, first_pass_bytes, total_pages, (long)(time(NULL) - job_start));
+  write_progress(line);
+}
+
+/*****************************************************************************
+ * Function:
+ *	write_progress
+ *
+ * Reports go straight to the file descriptor, with one write each, so
+ * that they don't get mixed up with anything buffered for stderr.
+ */
+static void
+write_progress(const char *line)
+
+{
+  if (write(progress_fd, line, strlen(line)) == -1)
+    dm('p',2,"progress.c:write_progress() cannot write to %d\n", progress_fd);
+}
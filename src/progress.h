@@ -0,0 +1,16 @@
+/*
+ * Include file:
+ *	progress.h
+ */
+
+#include <signal.h>
+
+extern volatile sig_atomic_t	progress_due;
+
+extern void setup_progress(void);
+extern void start_progress_pass(void);
+extern void report_progress(void);
+extern void end_progress(void);
+
+/* Cheap enough to call for every page */
+#define CHECK_PROGRESS()	((void)(progress_due && (report_progress(), 0)))
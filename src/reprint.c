@@ -0,0 +1,633 @@
+/*
+ * Source file:
+ *	reprint.c
+ *
+ * Supports --manifest, which keeps a record of each run so that the
+ * next run over mostly the same files only has to read and format the
+ * files that have changed.
+ *
+ * For each file the manifest holds its size and a hash of its contents,
+ * what the index was told about its functions, and the body of each of
+ * its pages as it was printed.  Page headers, footers and blank pages
+ * are never stored - they depend on where the file falls in the listing
+ * and on the time, so they are always printed afresh, and the stored
+ * bodies are slotted in between them.  Page numbers in the function and
+ * file indexes come out right because the index is told about every
+ * file in the usual order.
+ *
+ * Stored pages are only used if they would come out the same, so the
+ * manifest also holds a hash of the settings that affect them, and
+ * nothing is reused when printing diffs, since they depend on another
+ * file.
+ *
+ * The manifest is a text file, except that each page body is stored
+ * as is after a line giving its length:
+ *
+ *	Trueprint manifest 1
+ *	settings <hash>
+ *	file <size> <hash> <chars> <name>
+ *	function <start char> <end char> <page> <end page> <name>
+ *	page <length>
+ *	<length bytes of page body>
+ *	end
+ *
+ * with a file line for each file, followed by its functions and pages.
+ * Characters and pages are counted from the start of the file.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef MSWIN
+# include <sys/mman.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int close(int fildes);
+extern off_t lseek(int fildes, off_t offset, int whence);
+extern int read(int fildes, void *buf, size_t nbyte);
+extern pid_t getpid(void);
+extern int unlink(const char *path);
+#endif
+
+#include "trueprint.h"
+#include "main.h"
+#include "diffs.h"
+#include "index.h"
+#include "input.h"
+#include "output.h"
+#include "options.h"
+#include "debug.h"
+#include "utils.h"
+
+#include "reprint.h"
+
+/*
+ * Private part
+ */
+#define MANIFEST_HEADER	"Trueprint manifest 1\n"
+
+typedef struct stored_file {
+  char		*name;
+  long		size;
+  unsigned long	hash;
+  long		chars;		/* how far char_number moved over the file */
+  char		*functions;	/* first function line in old_manifest */
+  long		no_of_functions;
+  long		no_of_pages;
+  char		**pages;	/* page bodies in old_manifest */
+  size_t	*page_lengths;
+} stored_file;
+
+typedef struct file_state {
+  long		size;
+  unsigned long	hash;
+  stored_file	*stored;	/* pages to use, or NULL to print afresh */
+  long		first_char;
+  long		first_page;
+  size_t	first_function;
+  size_t	end_function;
+  long		chars;
+} file_state;
+
+static char	*manifest_filename;
+static unsigned long settings_hash;
+static char	*old_manifest;
+static size_t	old_manifest_size;
+static stored_file *stored_files;
+static long	no_of_stored_files;
+static file_state *file_states;
+static char	*new_manifest_filename;
+static FILE	*new_manifest;
+static boolean	new_manifest_failed;
+static output_capture page_capture = { "manifest", NULL, -1 };
+
+static unsigned long hash_bytes(unsigned long hash, const char *bytes, size_t length);
+static void read_manifest(void);
+static boolean parse_manifest(void);
+static stored_file *find_stored_file(unsigned int this_file_number, const char *filename);
+static boolean hash_stream(int stream, long *size, unsigned long *hash);
+static void index_stored_file(stored_file *stored);
+static void start_manifest_file(unsigned int this_file_number);
+static void write_page(const char *body, size_t length);
+
+/******************************************************************************
+ * Function:
+ *	setup_reprint
+ */
+void
+setup_reprint(void)
+{
+  manifest_filename = NULL;
+
+  string_option(NULL, "manifest", NULL, &manifest_filename, NULL, NULL,
+		OPT_OUTPUT,
+		"keep a manifest of this run in file <string>, and reuse the\n"
+		"    pages of files that haven't changed since the last one");
+}
+
+/******************************************************************************
+ * Function:
+ *	hash_bytes
+ *
+ * 32-bit FNV-1a, whatever the size of a long, so that manifests don't
+ * depend on the machine.
+ */
+static unsigned long
+hash_bytes(unsigned long hash, const char *bytes, size_t length)
+{
+  while (length-- > 0)
+    hash = ((hash ^ (unsigned char)*bytes++) * 16777619UL) & 0xffffffffUL;
+
+  return hash;
+}
+
+/******************************************************************************
+ * Function:
+ *	init_reprint
+ *
+ * Called once all the options are set.  argv[1] to argv[argc-1] are the
+ * options from the command line, and language_options are the defaults
+ * for the language.  Works out the hash of the settings that affect
+ * page bodies, and reads the last manifest.
+ */
+void
+init_reprint(int argc, char **argv, char *language_options)
+{
+  char	buffer[64];
+  char	*string;
+  int	arg_index;
+
+  if ((manifest_filename == NULL) || (*manifest_filename == '\0')) return;
+
+  file_states = xmalloc(no_of_files * sizeof(file_state));
+  memset(file_states, 0, no_of_files * sizeof(file_state));
+
+  settings_hash = 2166136261UL;
+#ifdef PACKAGE_VERSION
+  settings_hash = hash_bytes(settings_hash, PACKAGE_VERSION, strlen(PACKAGE_VERSION) + 1);
+#endif
+  sprintf(buffer, "%d %d %d", use_environment, page_width, page_length);
+  settings_hash = hash_bytes(settings_hash, buffer, strlen(buffer) + 1);
+  for (arg_index = 1; arg_index < argc; arg_index++)
+    settings_hash = hash_bytes(settings_hash, argv[arg_index], strlen(argv[arg_index]) + 1);
+  if (use_environment && ((string = getenv("TP_OPTS")) != NULL))
+    settings_hash = hash_bytes(settings_hash, string, strlen(string) + 1);
+  settings_hash = hash_bytes(settings_hash, language_options, strlen(language_options) + 1);
+
+  dm('f',2,"reprint.c:init_reprint() Settings hash is %08lx\n", settings_hash);
+
+  if (!diffs_wanted()) read_manifest();
+}
+
+/******************************************************************************
+ * Function:
+ *	read_manifest
+ *
+ * Maps the last manifest into old_manifest and indexes it, if it was
+ * made with the same settings.  The mapping is private, so the lines
+ * can be cut up in place, and only the pages that are reused are ever
+ * read in.  A missing or damaged manifest just means that every file
+ * is printed afresh.
+ */
+static void
+read_manifest(void)
+{
+  struct stat	manifest_stat;
+  int		fd;
+
+  if ((fd = open(manifest_filename, O_RDONLY)) == -1)
+    {
+      dm('f',2,"reprint.c:read_manifest() No manifest in %s\n", manifest_filename);
+      return;
+    }
+
+  if ((fstat(fd, &manifest_stat) == -1)
+      || (manifest_stat.st_size == 0))
+    {
+      close(fd);
+      return;
+    }
+
+  old_manifest_size = (size_t)manifest_stat.st_size;
+#ifndef MSWIN
+  old_manifest = mmap(NULL, old_manifest_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (old_manifest == MAP_FAILED)
+    old_manifest = NULL;
+#else
+  old_manifest = xmalloc(old_manifest_size);
+  if (read(fd, old_manifest, old_manifest_size) != (int)old_manifest_size)
+    {
+      free(old_manifest);
+      old_manifest = NULL;
+    }
+#endif
+  if (old_manifest == NULL)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": warning: cannot read manifest %s, %s\n"),
+	      manifest_filename, strerror(errno));
+      close(fd);
+      return;
+    }
+  close(fd);
+
+  if (!parse_manifest())
+    {
+      dm('f',2,"reprint.c:read_manifest() Not using manifest %s\n", manifest_filename);
+      no_of_stored_files = 0;
+    }
+}
+
+/******************************************************************************
+ * Function:
+ *	parse_manifest
+ *
+ * Fills in stored_files[] from old_manifest.  Returns FALSE if the
+ * manifest is for different settings or isn't a manifest at all.  The
+ * manifest isn't terminated, so each line is ended with a NUL in place
+ * of its newline before anything looks at it.
+ */
+static boolean
+parse_manifest(void)
+{
+  char		*next = old_manifest;
+  char		*end = old_manifest + old_manifest_size;
+  long		stored_files_size = 0;
+  unsigned long	hash;
+  int		used = 0;
+  char		*line_end;
+
+  if ((old_manifest_size < strlen(MANIFEST_HEADER))
+      || (memcmp(next, MANIFEST_HEADER, strlen(MANIFEST_HEADER)) != 0))
+    return FALSE;
+  next += strlen(MANIFEST_HEADER);
+
+  if ((line_end = memchr(next, '\n', (size_t)(end - next))) == NULL)
+    return FALSE;
+  *line_end = '\0';
+  if ((sscanf(next, "settings %lx%n", &hash, &used) < 1) || (next + used != line_end))
+    return FALSE;
+  if (hash != settings_hash)
+    {
+      dm('f',2,"reprint.c:parse_manifest() Settings have changed since the manifest was made\n");
+      return FALSE;
+    }
+  next = line_end + 1;
+
+  while (next < end)
+    {
+      stored_file *stored;
+
+      if ((line_end = memchr(next, '\n', (size_t)(end - next))) == NULL)
+	return FALSE;
+      *line_end = '\0';
+
+      if (strcmp(next, "end") == 0)
+	return TRUE;
+
+      if (strncmp(next, "file ", 5) == 0)
+	{
+	  if (no_of_stored_files == stored_files_size)
+	    {
+	      stored_files_size = (stored_files_size == 0) ? 64 : stored_files_size * 2;
+	      stored_files = xrealloc(stored_files, stored_files_size * sizeof(stored_file));
+	    }
+	  stored = &stored_files[no_of_stored_files++];
+	  memset(stored, 0, sizeof(stored_file));
+
+	  used = 0;
+	  if ((sscanf(next, "file %ld %lx %ld %n", &stored->size, &stored->hash, &stored->chars, &used) < 3)
+	      || (used == 0))
+	    return FALSE;
+	  stored->name = next + used;
+	}
+      else if ((strncmp(next, "function ", 9) == 0) && (no_of_stored_files > 0))
+	{
+	  stored = &stored_files[no_of_stored_files-1];
+	  if (stored->no_of_functions++ == 0) stored->functions = next;
+	}
+      else if ((strncmp(next, "page ", 5) == 0) && (no_of_stored_files > 0))
+	{
+	  unsigned long page_length;
+
+	  stored = &stored_files[no_of_stored_files-1];
+	  if ((sscanf(next, "page %lu", &page_length) != 1)
+	      || ((size_t)(end - line_end - 1) < page_length + 1)
+	      || (line_end[page_length + 1] != '\n'))
+	    return FALSE;
+
+	  stored->pages = xrealloc(stored->pages, (stored->no_of_pages + 1) * sizeof(char *));
+	  stored->page_lengths = xrealloc(stored->page_lengths, (stored->no_of_pages + 1) * sizeof(size_t));
+	  stored->pages[stored->no_of_pages] = line_end + 1;
+	  stored->page_lengths[stored->no_of_pages++] = (size_t)page_length;
+	  line_end += page_length + 1;
+	}
+      else
+	return FALSE;
+
+      next = line_end + 1;
+    }
+
+  /* No end line, so the manifest is incomplete */
+  return FALSE;
+}
+
+/******************************************************************************
+ * Function:
+ *	find_stored_file
+ *
+ * Files usually come in the same order as last time, so look there
+ * first.
+ */
+static stored_file *
+find_stored_file(unsigned int this_file_number, const char *filename)
+{
+  long	stored_index;
+
+  if (((long)this_file_number < no_of_stored_files)
+      && (strcmp(stored_files[this_file_number].name, filename) == 0))
+    return &stored_files[this_file_number];
+
+  for (stored_index = 0; stored_index < no_of_stored_files; stored_index++)
+    if (strcmp(stored_files[stored_index].name, filename) == 0)
+      return &stored_files[stored_index];
+
+  return NULL;
+}
+
+/******************************************************************************
+ * Function:
+ *	hash_stream
+ *
+ * Hashes the whole of an input file, and leaves it back at the start.
+ */
+static boolean
+hash_stream(int stream, long *size, unsigned long *hash)
+{
+  char	buffer[BUFFER_SIZE];
+  int	got;
+
+  *size = 0;
+  *hash = 2166136261UL;
+
+  while ((got = read(stream, buffer, BUFFER_SIZE)) > 0)
+    {
+      *hash = hash_bytes(*hash, buffer, (size_t)got);
+      *size += got;
+    }
+
+  return ((got == 0) && (lseek(stream, 0, SEEK_SET) != (off_t)-1));
+}
+
+/******************************************************************************
+ * Function:
+ *	index_stored_file
+ *
+ * Tells the index about the functions in a stored file, as if the file
+ * had just been read, and moves char_number over it.
+ */
+static void
+index_stored_file(stored_file *stored)
+{
+  char	*next = stored->functions;
+  long	first_char = char_number;
+  long	function_index;
+
+  for (function_index = 0; function_index < stored->no_of_functions; function_index++)
+    {
+      long	start, end, page, end_page;
+      char	*name;
+      char	*line_end = next + strlen(next);
+      int	used = 0;
+
+      sscanf(next, "function %ld %ld %ld %ld %n", &start, &end, &page, &end_page, &used);
+      name = xmalloc((size_t)(line_end - next - used) + 1);
+      memcpy(name, next + used, (size_t)(line_end - next - used));
+      name[line_end - next - used] = '\0';
+
+      add_function(name, first_char + start, first_char + end,
+		   page_number + 1 + page, current_filename);
+      end_function(page_number + 1 + end_page);
+
+      free(name);
+      next = line_end + 1;
+    }
+}
+
+/******************************************************************************
+ * Function:
+ *	reprint_file
+ *
+ * Called for each file in each pass, once stream is open.  Returns TRUE
+ * if the file's pages have been printed from the last manifest, so the
+ * file needn't be read.
+ */
+boolean
+reprint_file(unsigned int this_file_number, int stream)
+{
+  file_state	*state;
+  stored_file	*stored;
+
+  if (file_states == NULL) return FALSE;
+
+  state = &file_states[this_file_number];
+
+  if (pass == 0)
+    {
+      state->first_char = char_number;
+      state->first_page = page_number + 1;
+      state->first_function = no_of_indexed_functions();
+
+      if (!hash_stream(stream, &state->size, &state->hash))
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": cannot read %s, %s\n"),
+		  current_filename, strerror(errno));
+	  exit(1);
+	}
+
+      stored = find_stored_file(this_file_number, current_filename);
+      if ((stored != NULL)
+	  && (stored->size == state->size)
+	  && (stored->hash == state->hash)
+	  && (stored->no_of_pages > 0))
+	{
+	  dm('f',3,"reprint.c:reprint_file() Reusing %ld pages of %s\n", stored->no_of_pages, current_filename);
+	  state->stored = stored;
+	  state->chars = stored->chars;
+	  index_stored_file(stored);
+	}
+      else
+	return FALSE;
+    }
+  else
+    {
+      start_manifest_file(this_file_number);
+      if (state->stored == NULL) return FALSE;
+    }
+
+  got_some_input = 1;
+  print_stored_file(state->stored->no_of_pages);
+  char_number += state->chars;
+
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	reprint_end_file
+ *
+ * Called at the end of each file in pass 0, to note what needs to go in
+ * the new manifest.
+ */
+void
+reprint_end_file(unsigned int this_file_number)
+{
+  file_state *state;
+
+  if (file_states == NULL) return;
+
+  state = &file_states[this_file_number];
+  if (state->stored == NULL) state->chars = char_number - state->first_char;
+  state->end_function = no_of_indexed_functions();
+}
+
+/******************************************************************************
+ * Function:
+ *	start_manifest_file
+ *
+ * Starts the entry for a file in the new manifest, which is written
+ * alongside the output in pass 1.  If the new manifest can't be written
+ * then the old one is left alone.
+ */
+static void
+start_manifest_file(unsigned int this_file_number)
+{
+  file_state	*state = &file_states[this_file_number];
+  size_t	function_index;
+
+  if (new_manifest_failed) return;
+
+  if (new_manifest == NULL)
+    {
+      new_manifest_filename = xmalloc(strlen(manifest_filename) + 24);
+      sprintf(new_manifest_filename, "%s.%ld", manifest_filename, (long)getpid());
+      if ((new_manifest = fopen(new_manifest_filename, "w")) == NULL)
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": warning: cannot write manifest %s, %s\n"),
+		  new_manifest_filename, strerror(errno));
+	  new_manifest_failed = TRUE;
+	  return;
+	}
+      fprintf(new_manifest, MANIFEST_HEADER);
+      fprintf(new_manifest, "settings %08lx\n", settings_hash);
+    }
+
+  fprintf(new_manifest, "file %ld %08lx %ld %s\n", state->size, state->hash, state->chars, current_filename);
+
+  for (function_index = state->first_function; function_index < state->end_function; function_index++)
+    {
+      long	start, end, page, end_page;
+      char	*name;
+
+      get_indexed_function(function_index, &name, &start, &end, &page, &end_page);
+      fprintf(new_manifest, "function %ld %ld %ld %ld %s\n",
+	      start - state->first_char, end - state->first_char,
+	      page - state->first_page, end_page - state->first_page, name);
+    }
+}
+
+/******************************************************************************
+ * Function:
+ *	write_page
+ */
+static void
+write_page(const char *body, size_t length)
+{
+  if ((new_manifest == NULL) || new_manifest_failed) return;
+
+  fprintf(new_manifest, "page %lu\n", (unsigned long)length);
+  fwrite(body, 1, length, new_manifest);
+  putc('\n', new_manifest);
+}
+
+/******************************************************************************
+ * Function:
+ *	put_stored_page
+ *
+ * Prints the body of a page of the current file from the last manifest.
+ */
+void
+put_stored_page(long page)
+{
+  stored_file *stored = file_states[file_number].stored;
+
+  fwrite(stored->pages[page], 1, stored->page_lengths[page], stdout);
+  write_page(stored->pages[page], stored->page_lengths[page]);
+}
+
+/******************************************************************************
+ * Function:
+ *	begin_page_capture
+ *
+ * Called in pass 1 once a page's header has been printed.  Diverts the
+ * body of the page so that it can go in the new manifest as well.
+ */
+void
+begin_page_capture(void)
+{
+  if ((new_manifest == NULL) || new_manifest_failed) return;
+
+  begin_capture(&page_capture, FALSE);
+}
+
+/******************************************************************************
+ * Function:
+ *	end_page_capture
+ *
+ * Puts the output back, and prints the body of the page and adds it to
+ * the new manifest.
+ */
+void
+end_page_capture(void)
+{
+  char	*page_buffer;
+  off_t	page_length;
+
+  if ((page_buffer = end_capture(&page_capture, &page_length)) == NULL)
+    return;
+
+  fwrite(page_buffer, 1, (size_t)page_length, stdout);
+  write_page(page_buffer, (size_t)page_length);
+}
+
+/******************************************************************************
+ * Function:
+ *	finish_reprint
+ *
+ * Called once all the pages have been printed, to replace the last
+ * manifest with the new one.
+ */
+void
+finish_reprint(void)
+{
+  if ((new_manifest == NULL) || new_manifest_failed) return;
+
+  fprintf(new_manifest, "end\n");
+  if ((fclose(new_manifest) == EOF)
+      || (rename(new_manifest_filename, manifest_filename) == -1))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": warning: cannot write manifest %s, %s\n"),
+	      manifest_filename, strerror(errno));
+      unlink(new_manifest_filename);
+    }
+  new_manifest = NULL;
+}
@@ -0,0 +1,13 @@
+/*
+ * Include file:
+ *	reprint.h
+ */
+
+extern void setup_reprint(void);
+extern void init_reprint(int argc, char **argv, char *language_options);
+extern boolean reprint_file(unsigned int this_file_number, int stream);
+extern void reprint_end_file(unsigned int this_file_number);
+extern void put_stored_page(long page);
+extern void begin_page_capture(void);
+extern void end_page_capture(void);
+extern void finish_reprint(void);
@@ -0,0 +1,505 @@
+/*
+ * Source file:
+ *	server.c
+ *
+ * Lets one trueprint process serve many jobs.  The server does the
+ * start-up work - declaring options, reading the printers file - once,
+ * and then listens on a Unix domain socket.  For each job it forks a
+ * copy of itself, so every job starts from the same warm state without
+ * any of the global state having to be reset.
+ *
+ * A client sends its arguments, environment and current directory,
+ * together with its standard input, output and error, which the job
+ * then uses directly.  When the job is finished the server sends back
+ * a single byte with its exit code.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef MSWIN
+# include <sys/socket.h>
+# include <sys/un.h>
+# include <sys/wait.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int close(int fildes);
+extern int dup2(int fildes, int fildes2);
+extern int chdir(const char *path);
+extern pid_t fork(void);
+#endif
+
+#include "trueprint.h"
+#include "utils.h"
+#include "debug.h"
+
+#include "server.h"
+
+extern char **environ;
+
+/*
+ * Private part
+ */
+#define MAX_JOB_SIZE	(16*1024*1024)	/* arguments + environment + directory */
+#define JOB_FDS		3		/* standard input, output and error */
+
+#ifndef MSWIN
+static int open_socket(const char *socket_path, struct sockaddr_un *address);
+static boolean write_all(int fd, const char *buffer, size_t length);
+static boolean read_all(int fd, char *buffer, size_t length);
+static void run_job(int connection, int *argc, char ***argv);
+static char **unpack_strings(char **buffer, char *end, int *count);
+#endif
+
+#ifndef MSWIN
+/******************************************************************************
+ * Function:
+ *	open_socket
+ *
+ * Creates a Unix domain socket and fills in the address for socket_path.
+ */
+static int
+open_socket(const char *socket_path, struct sockaddr_un *address)
+{
+  int fd;
+
+  if (strlen(socket_path) >= sizeof(address->sun_path))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": socket name %s is too long\n"), socket_path);
+      exit(1);
+    }
+
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  strcpy(address->sun_path, socket_path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+      perror(CMD_NAME ": cannot create socket");
+      exit(2);
+    }
+
+  return fd;
+}
+
+/******************************************************************************
+ * Function:
+ *	write_all
+ */
+static boolean
+write_all(int fd, const char *buffer, size_t length)
+{
+  while (length > 0)
+    {
+      ssize_t written = write(fd, buffer, length);
+
+      if (written == -1)
+	{
+	  if (errno == EINTR) continue;
+	  return FALSE;
+	}
+      buffer += written;
+      length -= (size_t)written;
+    }
+
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	read_all
+ */
+static boolean
+read_all(int fd, char *buffer, size_t length)
+{
+  while (length > 0)
+    {
+      ssize_t got = read(fd, buffer, length);
+
+      if (got == -1)
+	{
+	  if (errno == EINTR) continue;
+	  return FALSE;
+	}
+      if (got == 0) return FALSE;
+      buffer += got;
+      length -= (size_t)got;
+    }
+
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	unpack_strings
+ *
+ * A job is sent as a sequence of nul-terminated strings: a count
+ * followed by that many strings, for the arguments and then the
+ * environment, and finally the directory.  This returns a null
+ * terminated array of the next set of strings, moving *buffer past them.
+ */
+static char **
+unpack_strings(char **buffer, char *end, int *count)
+{
+  char **strings;
+  int	string_index;
+
+  if (*buffer >= end) return NULL;
+  *count = atoi(*buffer);
+  *buffer += strlen(*buffer) + 1;
+  if ((*count < 0) || (*count > (end - *buffer))) return NULL;
+
+  strings = xmalloc(sizeof(char *) * (size_t)(*count + 1));
+  for (string_index = 0; string_index < *count; string_index++)
+    {
+      if (*buffer >= end) return NULL;
+      strings[string_index] = *buffer;
+      *buffer += strlen(*buffer) + 1;
+    }
+  strings[*count] = NULL;
+
+  return strings;
+}
+
+/******************************************************************************
+ * Function:
+ *	run_job
+ *
+ * Runs in a child of the server for each connection.  Reads the job,
+ * then forks the process that runs it, which returns to the caller with
+ * its arguments in *argc and *argv.  This process waits for the job to
+ * finish and sends its exit code back to the client.
+ */
+static void
+run_job(int connection, int *argc, char ***argv)
+{
+  union {
+    struct cmsghdr	header;
+    char		space[CMSG_SPACE(sizeof(int) * JOB_FDS)];
+  } control;
+  struct msghdr	message;
+  struct iovec	io;
+  struct cmsghdr *cmsg;
+  size_t	job_size;
+  char		*job;
+  char		*next;
+  char		**job_argv;
+  char		**job_env;
+  int		job_argc;
+  int		job_envc;
+  int		fds[JOB_FDS];
+  int		fd_index;
+  int		status;
+  unsigned char	exit_code = 2;
+  pid_t		pid;
+
+  memset(&message, 0, sizeof(message));
+  io.iov_base = (char *)&job_size;
+  io.iov_len = sizeof(job_size);
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control.space;
+  message.msg_controllen = sizeof(control.space);
+
+  if ((recvmsg(connection, &message, 0) != (ssize_t)sizeof(job_size))
+      || ((cmsg = CMSG_FIRSTHDR(&message)) == NULL)
+      || (cmsg->cmsg_level != SOL_SOCKET)
+      || (cmsg->cmsg_type != SCM_RIGHTS)
+      || (cmsg->cmsg_len != CMSG_LEN(sizeof(int) * JOB_FDS)))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": server: badly formed job\n"));
+      _exit(1);
+    }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  if ((job_size == 0) || (job_size > MAX_JOB_SIZE))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": server: badly formed job\n"));
+      _exit(1);
+    }
+  job = xmalloc(job_size);
+  next = job;
+  if (!read_all(connection, job, job_size)
+      || (job[job_size-1] != '\0')
+      || ((job_argv = unpack_strings(&next, job + job_size, &job_argc)) == NULL)
+      || (job_argc == 0)
+      || ((job_env = unpack_strings(&next, job + job_size, &job_envc)) == NULL)
+      || (next >= job + job_size))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": server: badly formed job\n"));
+      _exit(1);
+    }
+
+  if ((pid = fork()) == -1)
+    {
+      perror(CMD_NAME ": server: cannot fork");
+      write_all(connection, (char *)&exit_code, 1);
+      _exit(2);
+    }
+
+  if (pid == 0)
+    {
+      /*
+       * This is the job itself.  Take over the client's files, directory
+       * and environment and go back to main().
+       */
+      for (fd_index = 0; fd_index < JOB_FDS; fd_index++)
+	{
+	  if (dup2(fds[fd_index], fd_index) == -1)
+	    {
+	      perror(CMD_NAME ": server: cannot take over client files");
+	      exit(2);
+	    }
+	}
+      for (fd_index = 0; fd_index < JOB_FDS; fd_index++)
+	if (fds[fd_index] >= JOB_FDS) close(fds[fd_index]);
+      close(connection);
+
+      if (chdir(next) == -1)
+	{
+	  fprintf(stderr, gettext(CMD_NAME ": cannot change to directory %s, %s\n"),
+		  next, strerror(errno));
+	  exit(1);
+	}
+      environ = job_env;
+
+      *argc = job_argc;
+      *argv = job_argv;
+      return;
+    }
+
+  /*
+   * Let go of the client's files, so that the client sees end of file
+   * on them as soon as the job has finished with them.
+   */
+  for (fd_index = 0; fd_index < JOB_FDS; fd_index++)
+    close(fds[fd_index]);
+
+  while (waitpid(pid, &status, 0) == -1)
+    {
+      if (errno != EINTR)
+	{
+	  perror(CMD_NAME ": server: cannot wait for job");
+	  _exit(2);
+	}
+    }
+
+  if (WIFEXITED(status))
+    exit_code = (unsigned char)WEXITSTATUS(status);
+
+  write_all(connection, (char *)&exit_code, 1);
+  _exit(0);
+}
+#endif /* !MSWIN */
+
+/******************************************************************************
+ * Function:
+ *	serve
+ *
+ * Listens on socket_path for jobs, forking a process for each one.
+ * Never returns in the server itself.  Returns in each job process, with
+ * *argc and *argv set to the job's arguments.
+ */
+void
+serve(const char *socket_path, int *argc, char ***argv)
+{
+#ifdef MSWIN
+  fprintf(stderr, gettext(CMD_NAME ": server mode is not supported on this system\n"));
+  exit(1);
+#else
+  struct sockaddr_un	address;
+  struct stat		socket_stat;
+  int			listener;
+  int			connection;
+  mode_t		old_umask;
+  pid_t			pid;
+
+  listener = open_socket(socket_path, &address);
+
+  /*
+   * Clear away a socket left behind by an earlier server, but don't
+   * remove anything else.
+   */
+  if ((stat(socket_path, &socket_stat) == 0) && S_ISSOCK(socket_stat.st_mode))
+    unlink(socket_path);
+
+  /*
+   * Jobs run as the user who started the server, so nobody else may
+   * connect to it.
+   */
+  old_umask = umask(077);
+  if (bind(listener, (struct sockaddr *)&address, sizeof(address)) == -1)
+    {
+      fprintf(stderr, gettext(CMD_NAME ": cannot create socket %s, %s\n"),
+	      socket_path, strerror(errno));
+      exit(1);
+    }
+  umask(old_umask);
+
+  if (listen(listener, SOMAXCONN) == -1)
+    {
+      perror(CMD_NAME ": cannot listen for jobs");
+      exit(2);
+    }
+
+  /*
+   * The server never waits for its children, so don't let them turn
+   * into zombies.
+   */
+  signal(SIGCHLD, SIG_IGN);
+
+  dm('P',1,"server.c:serve() Listening on %s\n", socket_path);
+
+  for (;;)
+    {
+      if ((connection = accept(listener, NULL, NULL)) == -1)
+	{
+	  if ((errno == EINTR) || (errno == ECONNABORTED)) continue;
+	  perror(CMD_NAME ": cannot accept job");
+	  exit(2);
+	}
+
+      if ((pid = fork()) == -1)
+	{
+	  perror(CMD_NAME ": server: cannot fork");
+	  close(connection);
+	  continue;
+	}
+
+      if (pid == 0)
+	{
+	  close(listener);
+	  signal(SIGCHLD, SIG_DFL);
+	  run_job(connection, argc, argv);
+	  return;
+	}
+
+      dm('P',2,"server.c:serve() Started job process %d\n", (int)pid);
+      close(connection);
+    }
+#endif /* MSWIN */
+}
+
+/******************************************************************************
+ * Function:
+ *	send_job
+ *
+ * Hands this invocation over to the server listening on socket_path.
+ * Returns the job's exit code, or -1 if there is no server, in which
+ * case the caller should do the job itself.
+ */
+int
+send_job(const char *socket_path, int argc, char **argv)
+{
+#ifdef MSWIN
+  return -1;
+#else
+  union {
+    struct cmsghdr	header;
+    char		space[CMSG_SPACE(sizeof(int) * JOB_FDS)];
+  } control;
+  struct sockaddr_un	address;
+  struct msghdr	message;
+  struct iovec	io;
+  struct cmsghdr *cmsg;
+  int		fds[JOB_FDS];
+  int		connection;
+  int		envc;
+  int		string_index;
+  char		count[24];
+  char		*directory;
+  char		*job;
+  size_t	job_size = 0;
+  size_t	job_used = 0;
+  unsigned char	exit_code;
+
+  connection = open_socket(socket_path, &address);
+  if (connect(connection, (struct sockaddr *)&address, sizeof(address)) == -1)
+    {
+      close(connection);
+      return -1;
+    }
+
+  /* The server couldn't find the files, so do the job here */
+  if ((directory = current_directory()) == NULL)
+    {
+      close(connection);
+      return -1;
+    }
+
+  for (envc = 0; environ[envc]; envc++)
+    ;
+
+  /*
+   * Work out the size of the job, then fill it in
+   */
+  job_size += strlen(directory) + 1 + 2 * sizeof(count);
+  for (string_index = 0; string_index < argc; string_index++)
+    job_size += strlen(argv[string_index]) + 1;
+  for (string_index = 0; string_index < envc; string_index++)
+    job_size += strlen(environ[string_index]) + 1;
+  job = xmalloc(job_size);
+
+#define ADD_STRING(s) (strcpy(job + job_used, (s)), job_used += strlen(s) + 1)
+  sprintf(count, "%d", argc);
+  ADD_STRING(count);
+  for (string_index = 0; string_index < argc; string_index++)
+    ADD_STRING(argv[string_index]);
+  sprintf(count, "%d", envc);
+  ADD_STRING(count);
+  for (string_index = 0; string_index < envc; string_index++)
+    ADD_STRING(environ[string_index]);
+  ADD_STRING(directory);
+#undef ADD_STRING
+  free(directory);
+
+  /*
+   * Send the size along with our standard input, output and error,
+   * then the job itself.
+   */
+  fflush(stdout);
+  for (string_index = 0; string_index < JOB_FDS; string_index++)
+    fds[string_index] = string_index;
+
+  memset(&message, 0, sizeof(message));
+  memset(&control, 0, sizeof(control));
+  io.iov_base = (char *)&job_used;
+  io.iov_len = sizeof(job_used);
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control.space;
+  message.msg_controllen = sizeof(control.space);
+  cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * JOB_FDS);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if ((sendmsg(connection, &message, 0) != (ssize_t)sizeof(job_used))
+      || !write_all(connection, job, job_used))
+    {
+      perror(CMD_NAME ": cannot send job to server");
+      exit(2);
+    }
+  free(job);
+
+  if (!read_all(connection, (char *)&exit_code, 1))
+    {
+      fprintf(stderr, gettext(CMD_NAME ": server did not finish the job\n"));
+      exit(2);
+    }
+  close(connection);
+
+  return exit_code;
+#endif /* MSWIN */
+}
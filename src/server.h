@@ -0,0 +1,7 @@
+/*
+ * Include file:
+ *	server.h
+ */
+
+extern void serve(const char *socket_path, int *argc, char ***argv);
+extern int send_job(const char *socket_path, int argc, char **argv);
@@ -1,71 +1,1342 @@
-/* search files related to print (still in development)
-
-This   program  is   free  software:   you  can
-redistribute  it  and/or  modify it  under  the
-terms  of  the GNU  General  Public License  as
-published  by  the  Free  Software  Foundation;
-either version  3 of  the License, or  (at your
-option) any later version.
-
-This program is distributed in the hope that it
-will  be  useful,  but  WITHOUT  ANY  WARRANTY;
-without   even    the   implied   warranty   of
-MERCHANTABILITY  or  FITNESS  FOR A  PARTICULAR
-PURPOSE. See the GNU General Public License for
-more details.
-
-You  should have  received  a copy  of the  GNU
-General   Public   License   along  with   this
-program. If not, see http://www.gnu.org/licenses/.
-
-
-*/
-
-#include<stdio.h>
-#include<sys/stat.h>
-#include<sys/types.h>
-#include<pwd.h>
-#include<unistd.h>
-#include<string.h>
-#include<errno.h>
-#include<dirent.h>
-#include<stdbool.h>
-
-
-int main(int argc, char *argv[]) {
-int i =0;
-char *p;
-FILE *sfile;
-char buffer[200];
-char *sword = "file.c"; /* testing */
-bool found = false;
-struct passwd *pw = getpwuid(getuid());
-
-char *homedir = pw->pw_dir;
-const char *plocation = "/.trueprint/files";
-/* printf("%s\n",homedir); */
-const char *npath = strcat(homedir,plocation);
-int value = chdir(npath);
-DIR *opendirp = opendir(npath);
-struct dirent *d; 
-while ((d = readdir(opendirp)) != NULL )
-/* for (i=0;i<=5;i++) */
-{
-sfile=fopen(d->d_name,"r");
-while (!found && (fgets(buffer, sizeof(buffer), sfile ) != 0))
-{
-found = strstr(buffer,sword);
-}
-/* printf("%d\n",found); */
-if (found == 1)
-printf("found in: %s\n",d->d_name); 
-fclose(sfile);
-
-/* printf("%d %d\n",value,errno); */
-/* printf("%s\n",d->d_name); */
-} 
-closedir(opendirp);
-
-return 0;
+/*
+ * Source file:
+ *	tpsearch.c
+ *
+ * Searches the listings kept in ~/.trueprint/files for files that
+ * contain every one of the terms given on the command line.
+ *
+ * The search is driven by an inverted index of the trigrams (runs of
+ * three bytes) in each listing, kept in .tpsearch-index in the same
+ * directory.  A file can only contain a term if it contains all of the
+ * term's trigrams, so the index narrows the search down to a few
+ * candidates, which are then read to check that the terms really are
+ * there.  The candidates are split between one process per processor.
+ * Terms shorter than three characters can't be looked up, and if every
+ * term is that short every file is a candidate.
+ *
+ * The archive that trueprint --archive keeps in the same directory is
+ * indexed by the text of its records, and each record that has every
+ * term is reported separately, with the file and the pages it was
+ * printed on.
+ *
+ * The index is brought up to date before each search: listings whose
+ * size or modification time have changed, and new listings, are read
+ * again, and listings that have gone are dropped.  Nothing else is
+ * read, so keeping the index up to date is cheap however many listings
+ * there are.
+ *
+ * Index layout, with numbers in network byte order:
+ *	header		"TPSX", version, number of files, number of trigrams,
+ *			offset of postings, offset of trigram table
+ *	file table	for each file, in order of name: size (8 bytes),
+ *			modification time (8), length of name (2), name
+ *	postings	for each trigram, the numbers of the files that
+ *			contain it, in order, as differences in base 128
+ *	trigram table	for each trigram, in order: trigram (4 bytes),
+ *			offset of its postings (8), length of its postings (4)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pwd.h>
+
+#ifndef MSWIN
+# include <sys/mman.h>
+# include <sys/wait.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int close(int fildes);
+extern pid_t fork(void);
+extern int getopt(int argc, char * const argv[], const char *optstring);
+extern uid_t getuid(void);
+extern int read(int fildes, void *buf, size_t nbyte);
+extern long sysconf(int name);
+extern char *optarg;
+extern int optind;
+#endif
+
+#ifndef O_RDONLY
+# define O_RDONLY 0
+#endif
+
+#include "trueprint.h"
+#include "utils.h"
+#include "archive_fl.h"
+
+/*
+ * Private part
+ */
+#define SEARCH_NAME	"tpsearch"
+#define INDEX_NAME	".tpsearch-index"
+#define INDEX_MAGIC	"TPSX"
+#define INDEX_VERSION	1
+#define HEADER_SIZE	32
+#define TRIGRAM_ENTRY	16
+#define NO_OF_TRIGRAMS	(1L << 24)
+
+/*
+ * New listings are indexed this many bytes at a time, which bounds the
+ * memory needed for a first index of a large archive
+ */
+#define BATCH_BYTES	(16L * 1024 * 1024)
+
+/*
+ * The file table entry of a listing that is still waiting to be indexed
+ */
+#define NOT_INDEXED	(~(unsigned long long)0)
+
+typedef struct {
+  char		*name;
+  off_t		size;
+  time_t	mtime;
+  boolean	indexed;	/* in the index with this size and time */
+} listing;
+
+typedef struct {
+  unsigned char		*data;
+  size_t		size;
+  unsigned long		no_of_files;
+  unsigned long		no_of_trigrams;
+  const unsigned char	*postings;
+  const unsigned char	*trigram_table;
+} search_index;
+
+typedef struct {
+  unsigned long	trigram;
+  unsigned long	file;
+} trigram_pair;
+
+typedef void (*work_fn)(unsigned long first, unsigned long last, FILE *output);
+
+static char		*listings_dir;
+static listing		*listings;
+static unsigned long	no_of_listings;
+static int		workers;
+
+static char		**terms;
+static int		no_of_terms;
+static unsigned long	*candidates;
+
+static unsigned long get_be32(const unsigned char *bytes);
+static unsigned long long get_be64(const unsigned char *bytes);
+static void put_be32(FILE *stream, unsigned long value);
+static void put_be64(FILE *stream, unsigned long long value);
+static char *file_path(const char *name);
+static unsigned char *read_whole_file(const char *name, size_t *size);
+static unsigned char *read_listing(const char *name, size_t *size);
+static int compare_listings(const void *, const void *);
+static int compare_name(const char *name, const char *table_name, size_t length);
+static void read_listings(void);
+static boolean open_index(search_index *index);
+static boolean check_index(search_index *index, unsigned long long postings_offset,
+			   unsigned long long table_offset);
+static void close_index(search_index *index);
+static FILE **run_workers(unsigned long no_of_items, work_fn work);
+static void extract_trigrams(unsigned long first, unsigned long last, FILE *output);
+static void sort_pairs(trigram_pair *pairs, size_t no_of_pairs);
+static unsigned long write_postings(FILE *stream, unsigned long *files, size_t no_of_files);
+static void write_index(search_index *old_index, const long *old_to_new,
+			trigram_pair *pairs, size_t no_of_pairs);
+static boolean update_index_batch(void);
+static void update_index(void);
+static unsigned long *find_postings(search_index *index, unsigned long trigram, size_t *count);
+static boolean contains(const unsigned char *text, size_t size, const char *term);
+static void check_candidates(unsigned long first, unsigned long last, FILE *output);
+static void usage(void);
+
+/******************************************************************************
+ * Function:
+ *	get_be32
+ */
+static unsigned long
+get_be32(const unsigned char *bytes)
+{
+  return ((unsigned long)bytes[0] << 24) | ((unsigned long)bytes[1] << 16)
+    | ((unsigned long)bytes[2] << 8) | (unsigned long)bytes[3];
+}
+
+/******************************************************************************
+ * Function:
+ *	get_be64
+ */
+static unsigned long long
+get_be64(const unsigned char *bytes)
+{
+  return ((unsigned long long)get_be32(bytes) << 32) | get_be32(bytes + 4);
+}
+
+/******************************************************************************
+ * Function:
+ *	put_be32
+ */
+static void
+put_be32(FILE *stream, unsigned long value)
+{
+  putc((int)((value >> 24) & 0xff), stream);
+  putc((int)((value >> 16) & 0xff), stream);
+  putc((int)((value >> 8) & 0xff), stream);
+  putc((int)(value & 0xff), stream);
+}
+
+/******************************************************************************
+ * Function:
+ *	put_be64
+ */
+static void
+put_be64(FILE *stream, unsigned long long value)
+{
+  put_be32(stream, (unsigned long)(value >> 32));
+  put_be32(stream, (unsigned long)(value & 0xffffffffUL));
+}
+
+/******************************************************************************
+ * Function:
+ *	file_path
+ *
+ * Returns the full name of a file in the listings directory, for the
+ * caller to free.
+ */
+static char *
+file_path(const char *name)
+{
+  char *path = xmalloc(strlen(listings_dir) + strlen(name) + 2);
+
+  sprintf(path, "%s/%s", listings_dir, name);
+  return path;
+}
+
+/******************************************************************************
+ * Function:
+ *	read_whole_file
+ *
+ * Reads a listing into memory, or returns NULL if it can't be read,
+ * e.g. because it has been removed since the directory was read.
+ */
+static unsigned char *
+read_whole_file(const char *name, size_t *size)
+{
+  char		*path = file_path(name);
+  struct stat	stat_buffer;
+  unsigned char	*contents;
+  size_t	got = 0;
+  int		fd;
+
+  if (((fd = open(path, O_RDONLY)) == -1) || (fstat(fd, &stat_buffer) == -1))
+    {
+      if (fd != -1) close(fd);
+      free(path);
+      return NULL;
+    }
+  free(path);
+
+  contents = xmalloc((size_t)stat_buffer.st_size + 1);
+  while (got < (size_t)stat_buffer.st_size)
+    {
+      int bytes = read(fd, contents + got, (size_t)stat_buffer.st_size - got);
+
+      if (bytes == -1 && errno == EINTR) continue;
+      if (bytes <= 0) break;
+      got += (size_t)bytes;
+    }
+  close(fd);
+
+  *size = got;
+  return contents;
+}
+
+/******************************************************************************
+ * Function:
+ *	read_listing
+ *
+ * Reads the text to index for a listing, which for the archive that
+ * trueprint --archive writes is the text of its records.
+ */
+static unsigned char *
+read_listing(const char *name, size_t *size)
+{
+  unsigned char		*contents = read_whole_file(name, size);
+  archive_record	*records;
+  size_t		no_of_records;
+  char			*text;
+
+  if ((contents == NULL) || !is_archive(contents, *size)) return contents;
+
+  records = read_archive(contents, *size, &no_of_records, &text, size);
+  free(records);
+  free(contents);
+  return (unsigned char *)text;
+}
+
+/******************************************************************************
+ * Function:
+ *	compare_listings, compare_name
+ */
+static int
+compare_listings(const void *p1, const void *p2)
+{
+  return strcmp(((const listing *)p1)->name, ((const listing *)p2)->name);
+}
+
+/*
+ * Compares a name with one from the file table, which isn't terminated
+ */
+static int
+compare_name(const char *name, const char *table_name, size_t length)
+{
+  int compare = strncmp(name, table_name, length);
+
+  if (compare != 0) return compare;
+  return (name[length] != '\0');
+}
+
+/******************************************************************************
+ * Function:
+ *	read_listings
+ *
+ * Reads the names, sizes and times of the listings into listings[],
+ * in order of name.  Files starting with . are ignored.
+ */
+static void
+read_listings(void)
+{
+  DIR		*directory;
+  struct dirent	*entry;
+  unsigned long	listings_size = 0;
+
+  if ((directory = opendir(listings_dir)) == NULL)
+    {
+      fprintf(stderr, gettext(SEARCH_NAME ": cannot open %s, %s\n"), listings_dir, strerror(errno));
+      exit(2);
+    }
+
+  while ((entry = readdir(directory)) != NULL)
+    {
+      struct stat	stat_buffer;
+      char		*path;
+
+      if (entry->d_name[0] == '.') continue;
+
+      path = file_path(entry->d_name);
+      if ((stat(path, &stat_buffer) == -1) || !S_ISREG(stat_buffer.st_mode))
+	{
+	  free(path);
+	  continue;
+	}
+      free(path);
+
+      if (no_of_listings == listings_size)
+	{
+	  listings_size = (listings_size == 0) ? 1024 : listings_size * 2;
+	  listings = xrealloc(listings, listings_size * sizeof(listing));
+	}
+      listings[no_of_listings].name = strcpy(xmalloc(strlen(entry->d_name) + 1), entry->d_name);
+      listings[no_of_listings].size = stat_buffer.st_size;
+      listings[no_of_listings].mtime = stat_buffer.st_mtime;
+      listings[no_of_listings].indexed = FALSE;
+      no_of_listings++;
+    }
+  closedir(directory);
+
+  if (no_of_listings > 0)
+    qsort(listings, no_of_listings, sizeof(listing), compare_listings);
+}
+
+/******************************************************************************
+ * Function:
+ *	open_index
+ *
+ * Maps the index, if there is one.  Returns FALSE if there isn't a
+ * usable index, in which case it will be built from scratch.
+ */
+static boolean
+open_index(search_index *index)
+{
+  char			*path = file_path(INDEX_NAME);
+  struct stat		stat_buffer;
+  int			fd;
+  unsigned long long	postings_offset;
+  unsigned long long	table_offset;
+
+  memset(index, 0, sizeof(search_index));
+
+  fd = open(path, O_RDONLY);
+  free(path);
+  if (fd == -1) return FALSE;
+  if ((fstat(fd, &stat_buffer) == -1) || (stat_buffer.st_size < HEADER_SIZE))
+    {
+      close(fd);
+      return FALSE;
+    }
+
+  index->size = (size_t)stat_buffer.st_size;
+#ifndef MSWIN
+  index->data = mmap(NULL, index->size, PROT_READ, MAP_SHARED, fd, 0);
+  if (index->data == MAP_FAILED)
+    {
+      close(fd);
+      index->data = NULL;
+      return FALSE;
+    }
+#else
+  index->data = xmalloc(index->size);
+  if (read(fd, index->data, index->size) != (int)index->size)
+    {
+      close(fd);
+      free(index->data);
+      index->data = NULL;
+      return FALSE;
+    }
+#endif
+  close(fd);
+
+  postings_offset = get_be64(index->data + 16);
+  table_offset = get_be64(index->data + 24);
+  index->no_of_files = get_be32(index->data + 8);
+  index->no_of_trigrams = get_be32(index->data + 12);
+
+  if ((memcmp(index->data, INDEX_MAGIC, 4) != 0)
+      || (get_be32(index->data + 4) != INDEX_VERSION)
+      || !check_index(index, postings_offset, table_offset))
+    {
+      fprintf(stderr, gettext(SEARCH_NAME ": rebuilding the index, it is not in the right format\n"));
+      close_index(index);
+      return FALSE;
+    }
+
+  index->postings = index->data + postings_offset;
+  index->trigram_table = index->data + table_offset;
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	check_index
+ *
+ * Checks that the file table, the postings and the trigram table lie
+ * where the header says, and that every entry points inside them, so
+ * that nothing reads past the end of the index.  The sizes are worked
+ * out from what is left of the index, so nothing can overflow.  The
+ * postings themselves are checked as they are read by find_postings().
+ */
+static boolean
+check_index(search_index *index, unsigned long long postings_offset,
+	    unsigned long long table_offset)
+{
+  const unsigned char	*entry = index->data + HEADER_SIZE;
+  unsigned long long	postings_size;
+  unsigned long long	left;
+  unsigned long		file;
+  unsigned long		trigram;
+  unsigned long		previous = 0;
+
+  if ((postings_offset < HEADER_SIZE) || (postings_offset > table_offset)
+      || (table_offset > index->size)
+      || ((index->size - table_offset) / TRIGRAM_ENTRY != index->no_of_trigrams)
+      || ((index->size - table_offset) % TRIGRAM_ENTRY != 0))
+    return FALSE;
+
+  /* The file table must fill the space up to the postings exactly */
+  left = postings_offset - HEADER_SIZE;
+  for (file = 0; file < index->no_of_files; file++)
+    {
+      size_t length;
+
+      if (left < 18) return FALSE;
+      length = ((size_t)entry[16] << 8) | entry[17];
+      if (left - 18 < length) return FALSE;
+      entry += 18 + length;
+      left -= 18 + length;
+    }
+  if (left != 0) return FALSE;
+
+  /* find_postings() needs the trigrams in order */
+  postings_size = table_offset - postings_offset;
+  entry = index->data + table_offset;
+  for (trigram = 0; trigram < index->no_of_trigrams; trigram++, entry += TRIGRAM_ENTRY)
+    {
+      unsigned long long offset = get_be64(entry + 4);
+
+      if (((trigram > 0) && (get_be32(entry) <= previous))
+	  || (offset > postings_size)
+	  || (get_be32(entry + 12) > postings_size - offset))
+	return FALSE;
+      previous = get_be32(entry);
+    }
+
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	close_index
+ */
+static void
+close_index(search_index *index)
+{
+  if (index->data == NULL) return;
+#ifndef MSWIN
+  munmap(index->data, index->size);
+#else
+  free(index->data);
+#endif
+  index->data = NULL;
+}
+
+/******************************************************************************
+ * Function:
+ *	run_workers
+ *
+ * Splits items 0 to no_of_items-1 into one slice for each worker, and
+ * runs work() on each slice in its own process.  Returns what each
+ * worker wrote, rewound and in order of the slices.
+ */
+static FILE **
+run_workers(unsigned long no_of_items, work_fn work)
+{
+  int		no_of_workers = workers;
+  FILE		**outputs;
+  pid_t		*pids;
+  int		worker;
+  int		failures = 0;
+
+  if ((unsigned long)no_of_workers > no_of_items)
+    no_of_workers = (no_of_items == 0) ? 1 : (int)no_of_items;
+
+  outputs = xmalloc((no_of_workers + 1) * sizeof(FILE *));
+  pids = xmalloc(no_of_workers * sizeof(pid_t));
+
+  fflush(NULL);
+  for (worker = 0; worker < no_of_workers; worker++)
+    {
+      unsigned long first = no_of_items * worker / no_of_workers;
+      unsigned long last = no_of_items * (worker + 1) / no_of_workers;
+
+      if ((outputs[worker] = tmpfile()) == NULL)
+	{
+	  perror(SEARCH_NAME ": cannot create temporary file");
+	  exit(2);
+	}
+
+      if (no_of_workers == 1)
+	{
+	  work(first, last, outputs[worker]);
+	  pids[worker] = 0;
+	  continue;
+	}
+
+      if ((pids[worker] = fork()) == -1)
+	{
+	  perror(SEARCH_NAME ": cannot fork");
+	  exit(2);
+	}
+      if (pids[worker] == 0)
+	{
+	  work(first, last, outputs[worker]);
+	  if (fflush(outputs[worker]) == EOF) exit(2);
+	  exit(0);
+	}
+    }
+
+  for (worker = 0; worker < no_of_workers; worker++)
+    {
+      int status;
+
+      if (pids[worker] != 0)
+	{
+	  while (waitpid(pids[worker], &status, 0) == -1)
+	    if (errno != EINTR)
+	      {
+		perror(SEARCH_NAME ": cannot wait for worker");
+		exit(2);
+	      }
+	  if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) failures++;
+	}
+      rewind(outputs[worker]);
+    }
+  outputs[no_of_workers] = NULL;
+  free(pids);
+
+  if (failures)
+    {
+      fprintf(stderr, gettext(SEARCH_NAME ": %d workers failed\n"), failures);
+      exit(2);
+    }
+
+  return outputs;
+}
+
+/******************************************************************************
+ * Function:
+ *	extract_trigrams
+ *
+ * Writes the distinct trigrams of each listing from first to last that
+ * is waiting to be indexed, each as a trigram_pair.
+ */
+static void
+extract_trigrams(unsigned long first, unsigned long last, FILE *output)
+{
+  unsigned long	file;
+  unsigned char	*seen = xmalloc(NO_OF_TRIGRAMS / 8);
+  trigram_pair	*pairs = NULL;
+  size_t	pairs_size = 0;
+
+  memset(seen, 0, NO_OF_TRIGRAMS / 8);
+
+  for (file = first; file < last; file++)
+    {
+      unsigned char	*contents;
+      size_t		size;
+      size_t		position;
+      size_t		no_of_pairs = 0;
+      size_t		pair;
+
+      if (listings[file].indexed) continue;
+      if ((contents = read_listing(listings[file].name, &size)) == NULL) continue;
+
+      for (position = 0; position + 2 < size; position++)
+	{
+	  unsigned long trigram = ((unsigned long)contents[position] << 16)
+	    | ((unsigned long)contents[position + 1] << 8) | contents[position + 2];
+
+	  if (seen[trigram >> 3] & (1 << (trigram & 7))) continue;
+	  seen[trigram >> 3] |= (unsigned char)(1 << (trigram & 7));
+
+	  if (no_of_pairs == pairs_size)
+	    {
+	      pairs_size = (pairs_size == 0) ? 4096 : pairs_size * 2;
+	      pairs = xrealloc(pairs, pairs_size * sizeof(trigram_pair));
+	    }
+	  pairs[no_of_pairs].trigram = trigram;
+	  pairs[no_of_pairs].file = file;
+	  no_of_pairs++;
+	}
+      free(contents);
+
+      for (pair = 0; pair < no_of_pairs; pair++)
+	seen[pairs[pair].trigram >> 3] = 0;
+      if (no_of_pairs > 0)
+	fwrite(pairs, sizeof(trigram_pair), no_of_pairs, output);
+    }
+
+  free(pairs);
+  free(seen);
 }
 
+/******************************************************************************
+ * Function:
+ *	sort_pairs
+ *
+ * Sorts pairs[] into order of trigram with a radix sort, 12 bits at a
+ * time.  The sort is stable, so pairs that were in order of file stay
+ * that way for each trigram.
+ */
+static void
+sort_pairs(trigram_pair *pairs, size_t no_of_pairs)
+{
+  trigram_pair	*sorted = xmalloc(no_of_pairs * sizeof(trigram_pair));
+  size_t	*counts = xmalloc(((1 << 12) + 1) * sizeof(size_t));
+  int		shift;
+
+  for (shift = 0; shift < 24; shift += 12)
+    {
+      trigram_pair	*from = (shift == 0) ? pairs : sorted;
+      trigram_pair	*to = (shift == 0) ? sorted : pairs;
+      size_t		pair;
+      int		digit;
+
+      memset(counts, 0, ((1 << 12) + 1) * sizeof(size_t));
+      for (pair = 0; pair < no_of_pairs; pair++)
+	counts[((from[pair].trigram >> shift) & 0xfff) + 1]++;
+      for (digit = 1; digit <= (1 << 12); digit++)
+	counts[digit] += counts[digit - 1];
+      for (pair = 0; pair < no_of_pairs; pair++)
+	to[counts[(from[pair].trigram >> shift) & 0xfff]++] = from[pair];
+    }
+
+  free(counts);
+  free(sorted);
+}
+
+/******************************************************************************
+ * Function:
+ *	write_postings
+ *
+ * Writes a list of file numbers, in order, as differences in base 128
+ * with the top bit set on all but the last byte of each.  Returns the
+ * number of bytes written.
+ */
+static unsigned long
+write_postings(FILE *stream, unsigned long *files, size_t no_of_files)
+{
+  unsigned long	previous = 0;
+  unsigned long	written = 0;
+  size_t	file;
+
+  for (file = 0; file < no_of_files; file++)
+    {
+      unsigned long	difference = files[file] - previous;
+      unsigned char	bytes[10];
+      int		no_of_bytes = 0;
+
+      do
+	{
+	  bytes[no_of_bytes++] = (unsigned char)(difference & 0x7f);
+	  difference >>= 7;
+	}
+      while (difference != 0);
+      written += no_of_bytes;
+      while (--no_of_bytes > 0)
+	putc(bytes[no_of_bytes] | 0x80, stream);
+      putc(bytes[0], stream);
+
+      previous = files[file];
+    }
+
+  return written;
+}
+
+/******************************************************************************
+ * Function:
+ *	find_postings
+ *
+ * Returns the numbers of the files in the index that contain trigram,
+ * in order, or NULL if there are none.  A number that runs past the end
+ * of its postings, or past the last file, ends the list.
+ */
+static unsigned long *
+find_postings(search_index *index, unsigned long trigram, size_t *count)
+{
+  unsigned long		low = 0;
+  unsigned long		high = index->no_of_trigrams;
+
+  *count = 0;
+
+  while (low < high)
+    {
+      unsigned long		middle = low + (high - low) / 2;
+      const unsigned char	*entry = index->trigram_table + middle * TRIGRAM_ENTRY;
+      unsigned long		entry_trigram = get_be32(entry);
+
+      if (entry_trigram < trigram)
+	low = middle + 1;
+      else if (entry_trigram > trigram)
+	high = middle;
+      else
+	{
+	  const unsigned char	*next = index->postings + get_be64(entry + 4);
+	  const unsigned char	*end = next + get_be32(entry + 12);
+	  unsigned long		*files = xmalloc((end - next) * sizeof(unsigned long));
+	  unsigned long		file = 0;
+
+	  while (next < end)
+	    {
+	      unsigned long difference = 0;
+
+	      while ((next < end) && (*next & 0x80))
+		difference = (difference << 7) | (*next++ & 0x7f);
+	      if (next == end) break;
+	      difference = (difference << 7) | *next++;
+
+	      file += difference;
+	      if ((file >= index->no_of_files) || ((*count > 0) && (difference == 0)))
+		break;
+	      files[(*count)++] = file;
+	    }
+	  return files;
+	}
+    }
+
+  return NULL;
+}
+
+/******************************************************************************
+ * Function:
+ *	write_index
+ *
+ * Writes a new index, merging the postings of the old one, with its file
+ * numbers changed by old_to_new[] (-1 to drop them), and pairs[], which
+ * is in order.  The new index replaces the old one only once it is
+ * complete.
+ */
+static void
+write_index(search_index *old_index, const long *old_to_new,
+	    trigram_pair *pairs, size_t no_of_pairs)
+{
+  char		*path = file_path(INDEX_NAME);
+  char		*new_path = xmalloc(strlen(path) + 24);
+  FILE		*stream;
+  unsigned long	file;
+  unsigned long	old_trigram = 0;
+  size_t	next_pair = 0;
+  unsigned long	*merged = NULL;
+  size_t	merged_size = 0;
+  unsigned char	*table = NULL;
+  unsigned long	no_of_trigrams = 0;
+  unsigned long	table_size = 0;
+  unsigned long long	offset = 0;
+  long		postings_offset;
+  long		table_offset;
+
+  sprintf(new_path, "%s.%ld", path, (long)getpid());
+  if ((stream = fopen(new_path, "wb")) == NULL)
+    {
+      fprintf(stderr, gettext(SEARCH_NAME ": cannot write %s, %s\n"), new_path, strerror(errno));
+      exit(2);
+    }
+
+  /* The header is filled in at the end */
+  for (file = 0; file < HEADER_SIZE; file++)
+    putc(0, stream);
+
+  for (file = 0; file < no_of_listings; file++)
+    {
+      size_t length = strlen(listings[file].name);
+
+      if (listings[file].indexed)
+	{
+	  put_be64(stream, (unsigned long long)listings[file].size);
+	  put_be64(stream, (unsigned long long)listings[file].mtime);
+	}
+      else
+	{
+	  put_be64(stream, NOT_INDEXED);
+	  put_be64(stream, NOT_INDEXED);
+	}
+      putc((int)((length >> 8) & 0xff), stream);
+      putc((int)(length & 0xff), stream);
+      fwrite(listings[file].name, 1, length, stream);
+    }
+
+  postings_offset = ftell(stream);
+
+  /*
+   * Go through the trigrams of the old index and of the new pairs
+   * together, in order
+   */
+  while ((old_index->data != NULL && old_trigram < old_index->no_of_trigrams)
+	 || (next_pair < no_of_pairs))
+    {
+      unsigned long	trigram;
+      size_t		no_of_merged = 0;
+      size_t		no_of_old = 0;
+      unsigned long	*old_files = NULL;
+      size_t		old_file;
+      size_t		pairs_end;
+      unsigned long	length;
+
+      if ((old_index->data != NULL) && (old_trigram < old_index->no_of_trigrams))
+	{
+	  trigram = get_be32(old_index->trigram_table + old_trigram * TRIGRAM_ENTRY);
+	  if ((next_pair < no_of_pairs) && (pairs[next_pair].trigram < trigram))
+	    trigram = pairs[next_pair].trigram;
+	}
+      else
+	trigram = pairs[next_pair].trigram;
+
+      if ((old_index->data != NULL) && (old_trigram < old_index->no_of_trigrams)
+	  && (get_be32(old_index->trigram_table + old_trigram * TRIGRAM_ENTRY) == trigram))
+	{
+	  old_files = find_postings(old_index, trigram, &no_of_old);
+	  old_trigram++;
+	}
+
+      for (pairs_end = next_pair;
+	   (pairs_end < no_of_pairs) && (pairs[pairs_end].trigram == trigram);
+	   pairs_end++)
+	;
+
+      if (merged_size < no_of_old + pairs_end - next_pair)
+	{
+	  merged_size = no_of_old + pairs_end - next_pair;
+	  merged = xrealloc(merged, merged_size * sizeof(unsigned long));
+	}
+
+      /*
+       * Old file numbers stay in order when they are changed, so the two
+       * lists can simply be merged
+       */
+      old_file = 0;
+      while ((old_file < no_of_old) || (next_pair < pairs_end))
+	{
+	  long old_new = -1;
+
+	  if (old_file < no_of_old)
+	    {
+	      old_new = (old_files[old_file] < old_index->no_of_files)
+		? old_to_new[old_files[old_file]] : -1;
+	      if (old_new == -1)
+		{
+		  old_file++;
+		  continue;
+		}
+	    }
+
+	  if ((next_pair < pairs_end)
+	      && ((old_new == -1) || (pairs[next_pair].file < (unsigned long)old_new)))
+	    merged[no_of_merged++] = pairs[next_pair++].file;
+	  else
+	    {
+	      merged[no_of_merged++] = (unsigned long)old_new;
+	      old_file++;
+	    }
+	}
+      free(old_files);
+
+      if (no_of_merged == 0) continue;
+
+      length = write_postings(stream, merged, no_of_merged);
+
+      if (no_of_trigrams == table_size)
+	{
+	  table_size = (table_size == 0) ? 4096 : table_size * 2;
+	  table = xrealloc(table, table_size * TRIGRAM_ENTRY);
+	}
+      {
+	unsigned char		*entry = table + no_of_trigrams * TRIGRAM_ENTRY;
+	int			byte;
+
+	for (byte = 0; byte < 4; byte++)
+	  entry[byte] = (unsigned char)((trigram >> (24 - 8 * byte)) & 0xff);
+	for (byte = 0; byte < 8; byte++)
+	  entry[4 + byte] = (unsigned char)((offset >> (56 - 8 * byte)) & 0xff);
+	for (byte = 0; byte < 4; byte++)
+	  entry[12 + byte] = (unsigned char)((length >> (24 - 8 * byte)) & 0xff);
+      }
+      no_of_trigrams++;
+      offset += length;
+    }
+  free(merged);
+
+  table_offset = postings_offset + (long)offset;
+  if (no_of_trigrams > 0)
+    fwrite(table, TRIGRAM_ENTRY, no_of_trigrams, stream);
+  free(table);
+
+  rewind(stream);
+  fwrite(INDEX_MAGIC, 1, 4, stream);
+  put_be32(stream, INDEX_VERSION);
+  put_be32(stream, no_of_listings);
+  put_be32(stream, no_of_trigrams);
+  put_be64(stream, (unsigned long long)postings_offset);
+  put_be64(stream, (unsigned long long)table_offset);
+
+  if ((fclose(stream) == EOF) || (rename(new_path, path) == -1))
+    {
+      fprintf(stderr, gettext(SEARCH_NAME ": cannot write %s, %s\n"), path, strerror(errno));
+      unlink(new_path);
+      exit(2);
+    }
+
+  free(new_path);
+  free(path);
+}
+
+/******************************************************************************
+ * Function:
+ *	update_index_batch
+ *
+ * Matches the listings against the file table of the index, and indexes
+ * up to BATCH_BYTES of the ones that are new or have changed.  Returns
+ * FALSE if the index was already up to date.
+ */
+static boolean
+update_index_batch(void)
+{
+  search_index		old_index;
+  long			*old_to_new = NULL;
+  unsigned long		file;
+  unsigned long		kept = 0;
+  unsigned long		batch_end;
+  long			batch_bytes = 0;
+  FILE			**outputs;
+  int			output;
+  trigram_pair		*pairs = NULL;
+  size_t		no_of_pairs = 0;
+  size_t		pairs_size = 0;
+
+  for (file = 0; file < no_of_listings; file++)
+    listings[file].indexed = FALSE;
+
+  /*
+   * Both the file table and listings[] are in order of name
+   */
+  if (open_index(&old_index))
+    {
+      const unsigned char	*entry = old_index.data + HEADER_SIZE;
+      unsigned long		old_file;
+
+      old_to_new = xmalloc((old_index.no_of_files + 1) * sizeof(long));
+      file = 0;
+      for (old_file = 0; old_file < old_index.no_of_files; old_file++)
+	{
+	  unsigned long long	size = get_be64(entry);
+	  unsigned long long	mtime = get_be64(entry + 8);
+	  size_t		length = ((size_t)entry[16] << 8) | entry[17];
+	  const char		*name = (const char *)entry + 18;
+	  int			compare = 1;
+
+	  while ((file < no_of_listings)
+		 && ((compare = compare_name(listings[file].name, name, length)) < 0))
+	    file++;
+
+	  old_to_new[old_file] = -1;
+	  if ((file < no_of_listings) && (compare == 0)
+	      && (size == (unsigned long long)listings[file].size)
+	      && (mtime == (unsigned long long)listings[file].mtime))
+	    {
+	      old_to_new[old_file] = (long)file;
+	      listings[file].indexed = TRUE;
+	      kept++;
+	    }
+	  entry += 18 + length;
+	}
+    }
+
+  if ((kept == no_of_listings) && (old_index.data != NULL)
+      && (old_index.no_of_files == no_of_listings))
+    {
+      close_index(&old_index);
+      free(old_to_new);
+      return FALSE;
+    }
+
+  /*
+   * Take the next batch of listings to index, in order of name
+   */
+  for (batch_end = 0; batch_end < no_of_listings; batch_end++)
+    if (!listings[batch_end].indexed)
+      {
+	if ((batch_bytes > 0) && (batch_bytes + (long)listings[batch_end].size > BATCH_BYTES))
+	  break;
+	batch_bytes += (long)listings[batch_end].size;
+      }
+
+  outputs = run_workers(batch_end, extract_trigrams);
+  for (output = 0; outputs[output] != NULL; output++)
+    {
+      size_t got;
+
+      do
+	{
+	  if (no_of_pairs == pairs_size)
+	    {
+	      pairs_size = (pairs_size == 0) ? 65536 : pairs_size * 2;
+	      pairs = xrealloc(pairs, pairs_size * sizeof(trigram_pair));
+	    }
+	  got = fread(pairs + no_of_pairs, sizeof(trigram_pair),
+		      pairs_size - no_of_pairs, outputs[output]);
+	  no_of_pairs += got;
+	}
+      while (got > 0);
+      fclose(outputs[output]);
+    }
+  free(outputs);
+
+  if (no_of_pairs > 0)
+    sort_pairs(pairs, no_of_pairs);
+  for (file = 0; file < batch_end; file++)
+    listings[file].indexed = TRUE;
+
+  write_index(&old_index, old_to_new, pairs, no_of_pairs);
+
+  close_index(&old_index);
+  free(old_to_new);
+  free(pairs);
+  return TRUE;
+}
+
+/******************************************************************************
+ * Function:
+ *	update_index
+ */
+static void
+update_index(void)
+{
+  read_listings();
+
+  while (update_index_batch())
+    ;
+}
+
+/******************************************************************************
+ * Function:
+ *	contains
+ *
+ * Like strstr(), for text that may contain nulls.
+ */
+static boolean
+contains(const unsigned char *text, size_t size, const char *term)
+{
+  size_t		length = strlen(term);
+  const unsigned char	*next = text;
+  const unsigned char	*end = text + size;
+
+  if (length == 0) return TRUE;
+
+  while ((size_t)(end - next) >= length)
+    {
+      next = memchr(next, term[0], (size_t)(end - next) - length + 1);
+      if (next == NULL) return FALSE;
+      if (memcmp(next, term, length) == 0) return TRUE;
+      next++;
+    }
+  return FALSE;
+}
+
+/******************************************************************************
+ * Function:
+ *	check_candidates
+ *
+ * Reads candidates first to last, and writes a line for each that
+ * contains every term.  A match in the archive is reported for each
+ * record that contains every term, with the file and its pages.
+ */
+static void
+check_candidates(unsigned long first, unsigned long last, FILE *output)
+{
+  unsigned long candidate;
+
+  for (candidate = first; candidate < last; candidate++)
+    {
+      const char	*name = listings[candidates[candidate]].name;
+      unsigned char	*contents;
+      size_t		size;
+      boolean		found;
+      int		term;
+
+      if ((contents = read_whole_file(name, &size)) == NULL) continue;
+
+      if (is_archive(contents, size))
+	{
+	  archive_record	*records;
+	  size_t		no_of_records;
+	  size_t		record;
+	  char			*text;
+	  size_t		text_length;
+
+	  records = read_archive(contents, size, &no_of_records, &text, &text_length);
+	  for (record = 0; record < no_of_records; record++)
+	    {
+	      const char	*record_text = text + records[record].offset;
+	      size_t		record_length = records[record].length;
+	      size_t		name_length;
+
+	      found = TRUE;
+	      for (term = 0; found && (term < no_of_terms); term++)
+		found = contains((const unsigned char *)record_text, record_length, terms[term]);
+	      if (!found) continue;
+
+	      /* The first line of a record is "file <name>" */
+	      if ((record_length > 5) && (strncmp(record_text, "file ", 5) == 0))
+		{
+		  record_text += 5;
+		  record_length -= 5;
+		}
+	      for (name_length = 0;
+		   (name_length < record_length) && (record_text[name_length] != '\n');
+		   name_length++)
+		;
+
+	      fprintf(output, "%s: %.*s, ", name, (int)name_length, record_text);
+	      if (records[record].last_page > records[record].first_page)
+		fprintf(output, "pages %ld-%ld", records[record].first_page, records[record].last_page);
+	      else
+		fprintf(output, "page %ld", records[record].first_page);
+	      if (records[record].printed != 0)
+		fprintf(output, ", printed %s", ctime(&records[record].printed));
+	      else
+		putc('\n', output);
+	    }
+	  free(records);
+	  free(text);
+	}
+      else
+	{
+	  found = TRUE;
+	  for (term = 0; found && (term < no_of_terms); term++)
+	    found = contains(contents, size, terms[term]);
+	  if (found) fprintf(output, "%s\n", name);
+	}
+
+      free(contents);
+    }
+}
+
+/******************************************************************************
+ * Function:
+ *	usage
+ */
+static void
+usage(void)
+{
+  fprintf(stderr, gettext("Usage: " SEARCH_NAME " [-d directory] [-j workers] [-u] term...\n"
+			  "Lists the stored listings that contain every term.\n"
+			  "  -d directory  search directory instead of ~" ARCHIVE_DIR "\n"
+			  "  -j workers    check candidates with this many processes\n"
+			  "  -u            only bring the index up to date\n"));
+  exit(2);
+}
+
+/******************************************************************************
+ * Function:
+ *	main
+ */
+int
+main(int argc, char *argv[])
+{
+  search_index		index;
+  boolean		update_only = FALSE;
+  boolean		all_short = TRUE;
+  unsigned long		no_of_candidates;
+  unsigned long		candidate;
+  unsigned long		found = 0;
+  FILE			**outputs;
+  int			output;
+  int			option;
+  int			term;
+
+  program_name = SEARCH_NAME;
+  workers = 0;
+  while ((option = getopt(argc, argv, "d:j:u")) != -1)
+    switch (option)
+      {
+      case 'd': listings_dir = optarg; break;
+      case 'j': workers = atoi(optarg); break;
+      case 'u': update_only = TRUE; break;
+      default: usage();
+      }
+  terms = argv + optind;
+  no_of_terms = argc - optind;
+  if ((no_of_terms == 0) && !update_only) usage();
+
+  if (workers <= 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+      long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+      workers = (processors > 0) ? (int)((processors < 256) ? processors : 256) : 1;
+#else
+      workers = 1;
+#endif
+    }
+
+  if (listings_dir == NULL)
+    {
+      const char *home = getenv("HOME");
+
+      if ((home == NULL) || (*home == '\0'))
+	{
+	  struct passwd *pw = getpwuid(getuid());
+
+	  if (pw == NULL)
+	    {
+	      fprintf(stderr, gettext(SEARCH_NAME ": cannot find your home directory\n"));
+	      exit(2);
+	    }
+	  home = pw->pw_dir;
+	}
+      listings_dir = xmalloc(strlen(home) + strlen(ARCHIVE_DIR) + 1);
+      sprintf(listings_dir, "%s%s", home, ARCHIVE_DIR);
+    }
+
+  update_index();
+  if (update_only) exit(0);
+
+  if (!open_index(&index))
+    {
+      fprintf(stderr, gettext(SEARCH_NAME ": cannot read the index in %s\n"), listings_dir);
+      exit(2);
+    }
+
+  /*
+   * Narrow the search down to the files that have every trigram of
+   * every term
+   */
+  candidates = NULL;
+  no_of_candidates = 0;
+  for (term = 0; term < no_of_terms; term++)
+    {
+      const unsigned char	*text = (const unsigned char *)terms[term];
+      size_t			length = strlen(terms[term]);
+      size_t			position;
+
+      for (position = 0; position + 2 < length; position++)
+	{
+	  unsigned long	trigram = ((unsigned long)text[position] << 16)
+	    | ((unsigned long)text[position + 1] << 8) | text[position + 2];
+	  size_t	count;
+	  unsigned long	*files = find_postings(&index, trigram, &count);
+
+	  if (all_short)
+	    {
+	      candidates = files;
+	      no_of_candidates = count;
+	      all_short = FALSE;
+	    }
+	  else
+	    {
+	      /* Both lists are in order, so keep the files that are in both */
+	      unsigned long	kept = 0;
+	      size_t		next = 0;
+
+	      for (candidate = 0; candidate < no_of_candidates; candidate++)
+		{
+		  while ((next < count) && (files[next] < candidates[candidate])) next++;
+		  if ((next < count) && (files[next] == candidates[candidate]))
+		    candidates[kept++] = candidates[candidate];
+		}
+	      no_of_candidates = kept;
+	      free(files);
+	    }
+	}
+    }
+  close_index(&index);
+
+  if (all_short)
+    {
+      candidates = xmalloc((no_of_listings + 1) * sizeof(unsigned long));
+      for (candidate = 0; candidate < no_of_listings; candidate++)
+	candidates[candidate] = candidate;
+      no_of_candidates = no_of_listings;
+    }
+
+  outputs = run_workers(no_of_candidates, check_candidates);
+  for (output = 0; outputs[output] != NULL; output++)
+    {
+      int result;
+
+      while ((result = getc(outputs[output])) != EOF)
+	{
+	  putchar(result);
+	  if (result == '\n') found++;
+	}
+      fclose(outputs[output]);
+    }
+
+  exit((found > 0) ? 0 : 1);
+}
@@ -6,14 +6,31 @@
 #include "config.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#else
+extern int close(int fildes);
+extern int dup(int fildes);
+extern int dup2(int fildes, int fildes2);
+extern int ftruncate(int fildes, off_t length);
+extern char *getcwd(char *buf, size_t size);
+extern off_t lseek(int fildes, off_t offset, int whence);
+extern int read(int fildes, void *buf, size_t nbyte);
+#endif
 
 #include "trueprint.h"
 
 #include "utils.h"
 
+/* Used in messages, so that programs other than trueprint can share this */
+const char *program_name = CMD_NAME;
+
 void
 skipspaces(char **ptr)
 {
@@ -27,7 +44,7 @@ xmalloc(size_t s)
 
   if ((r = malloc(s)) == NULL)
     {
-      fprintf(stderr, gettext(CMD_NAME ": cannot allocate memory\n"));
+      fprintf(stderr, gettext("%s: cannot allocate memory\n"), program_name);
       exit(2);
     }
 
@@ -41,12 +58,134 @@ xrealloc(void *v, size_t s)
 
   if ((r = realloc(v,s)) == NULL)
     {
-      fprintf(stderr, gettext(CMD_NAME ": cannot reallocate memory\n"));
+      fprintf(stderr, gettext("%s: cannot reallocate memory\n"), program_name);
       exit(2);
     }
 
   return r;
 }
 
+/*
+ * Returns the current directory in memory from xmalloc(), or NULL if it
+ * can't be found.  getcwd() is tried with a bigger buffer each time, as
+ * there is no limit on how long the name can be.
+ */
+char *
+current_directory(void)
+{
+  size_t size = 256;
+  char *directory = xmalloc(size);
+
+  while (getcwd(directory, size) == NULL)
+    {
+      if (errno != ERANGE)
+	{
+	  free(directory);
+	  return NULL;
+	}
+      size *= 2;
+      directory = xrealloc(directory, size);
+    }
+
+  return directory;
+}
+
+/*
+ * Sends standard output to capture's temporary file until end_capture().
+ * The output replaces what was captured last time, unless append is
+ * set, in which case it goes on the end and is left there.
+ */
+void
+begin_capture(output_capture *capture, boolean append)
+{
+  fflush(stdout);
+
+  if ((capture->stream == NULL) && ((capture->stream = tmpfile()) == NULL))
+    {
+      fprintf(stderr, gettext("%s: cannot create temporary file for %s, %s\n"),
+	      program_name, capture->what, strerror(errno));
+      exit(1);
+    }
+
+  /*
+   * fd 1 will share the file's offset, which may have been moved by
+   * reading earlier output back
+   */
+  if (append)
+    capture->start = lseek(fileno(capture->stream), 0, SEEK_END);
+  else if (((capture->start = lseek(fileno(capture->stream), 0, SEEK_SET)) != -1)
+	   && (ftruncate(fileno(capture->stream), 0) == -1))
+    capture->start = -1;
+
+  if ((capture->start == -1)
+      || ((capture->saved_stdout = dup(1)) == -1)
+      || (dup2(fileno(capture->stream), 1) == -1))
+    {
+      fprintf(stderr, gettext("%s: cannot redirect output for %s, %s\n"),
+	      program_name, capture->what, strerror(errno));
+      exit(1);
+    }
+  capture->append = append;
+}
+
+/*
+ * Puts standard output back and sets *length to how much was captured.
+ * Returns the captured output, which stays valid until the next
+ * end_capture(), or NULL if it was appended, in which case it is left
+ * in capture->stream from capture->start on.  Does nothing and returns
+ * NULL if nothing is being captured.
+ */
+char *
+end_capture(output_capture *capture, off_t *length)
+{
+  off_t		end;
+  size_t	done;
+
+  *length = 0;
+  if (capture->saved_stdout == -1) return NULL;
+
+  fflush(stdout);
+  if (((end = lseek(1, 0, SEEK_CUR)) == -1)
+      || (dup2(capture->saved_stdout, 1) == -1))
+    {
+      fprintf(stderr, gettext("%s: cannot restore output after %s, %s\n"),
+	      program_name, capture->what, strerror(errno));
+      exit(1);
+    }
+  close(capture->saved_stdout);
+  capture->saved_stdout = -1;
+
+  *length = end - capture->start;
+  if (capture->append) return NULL;
+
+  /*
+   * The output went through fd 1, so only the file descriptor is used
+   * here - stdio's idea of the stream's position is no use.
+   */
+  if ((size_t)*length + 1 > capture->buffer_size)
+    {
+      capture->buffer_size = (size_t)*length + 1;
+      capture->buffer = xrealloc(capture->buffer, capture->buffer_size);
+    }
+  if (lseek(fileno(capture->stream), capture->start, SEEK_SET) == -1)
+    done = 0;
+  else
+    for (done = 0; done < (size_t)*length; )
+      {
+	int got = read(fileno(capture->stream), capture->buffer + done, (size_t)*length - done);
+
+	if ((got <= 0) && !((got == -1) && (errno == EINTR))) break;
+	if (got > 0) done += got;
+      }
+  if (done != (size_t)*length)
+    {
+      fprintf(stderr, gettext("%s: cannot read back output for %s, %s\n"),
+	      program_name, capture->what, strerror(errno));
+      exit(1);
+    }
+
+  return capture->buffer;
+}
+
 #if ! HAVE_GETTEXT
 #endif
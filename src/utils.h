@@ -1,8 +1,33 @@
 #include "replace/replace.h"
 #include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+extern const char *program_name;
 
 void skipspaces(char **);
 
 extern void *xmalloc(size_t);
 
 extern void *xrealloc(void *, size_t);
+
+extern char *current_directory(void);
+
+/*
+ * Standard output diverted into a temporary file, so that it can be
+ * looked at before it is printed.  Start one off as
+ * { "what it is for", NULL, -1 }, what being used in messages.
+ */
+typedef struct output_capture {
+  const char	*what;
+  FILE		*stream;	/* the temporary file, made when first needed */
+  int		saved_stdout;	/* -1 unless capturing */
+  boolean	append;
+  off_t		start;		/* where this capture starts in stream */
+  char		*buffer;	/* what end_capture() read back */
+  size_t	buffer_size;
+} output_capture;
+
+extern void begin_capture(output_capture *capture, boolean append);
+
+extern char *end_capture(output_capture *capture, off_t *length);